@@ -34,6 +34,7 @@ float USussCanActivateAbilityInputProvider::EvaluateAbility(const AActor* Owner,
 USussCanActivateAbilityInputProvider::USussCanActivateAbilityInputProvider()
 {
 	InputTag = TAG_SussInputCanActivateAbility;
+	ContextElements = static_cast<int32>(ESussInputContextElements::Self);
 }
 
 float USussCanActivateAbilityInputProvider::Evaluate_Implementation(const USussBrainComponent* Brain,
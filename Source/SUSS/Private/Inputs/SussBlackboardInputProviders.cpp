@@ -15,6 +15,7 @@ UE_DEFINE_GAMEPLAY_TAG_COMMENT(TAG_SussInputBlackboardAuto, "Suss.Input.Blackboa
 USussBlackboardFloatInputProvider::USussBlackboardFloatInputProvider()
 {
 	InputTag = TAG_SussInputBlackboardFloat;
+	ContextElements = static_cast<int32>(ESussInputContextElements::Self);
 }
 
 float USussBlackboardFloatInputProvider::Evaluate_Implementation(const USussBrainComponent* Brain,
@@ -35,6 +36,7 @@ float USussBlackboardFloatInputProvider::Evaluate_Implementation(const USussBrai
 USussBlackboardBoolInputProvider::USussBlackboardBoolInputProvider()
 {
 	InputTag = TAG_SussInputBlackboardBool;
+	ContextElements = static_cast<int32>(ESussInputContextElements::Self);
 }
 
 float USussBlackboardBoolInputProvider::Evaluate_Implementation(const USussBrainComponent* Brain,
@@ -55,6 +57,7 @@ float USussBlackboardBoolInputProvider::Evaluate_Implementation(const USussBrain
 USussBlackboardAutoInputProvider::USussBlackboardAutoInputProvider()
 {
 	InputTag = TAG_SussInputBlackboardAuto;
+	ContextElements = static_cast<int32>(ESussInputContextElements::Self);
 }
 
 float USussBlackboardAutoInputProvider::Evaluate_Implementation(const USussBrainComponent* Brain,
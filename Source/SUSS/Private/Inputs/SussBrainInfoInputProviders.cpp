@@ -7,6 +7,7 @@ UE_DEFINE_GAMEPLAY_TAG_COMMENT(TAG_SussInputTimeSinceActionPerformed, "Suss.Inpu
 USussTimeSinceActionPerformedInputProvider::USussTimeSinceActionPerformedInputProvider()
 {
 	InputTag = TAG_SussInputTimeSinceActionPerformed;
+	ContextElements = static_cast<int32>(ESussInputContextElements::Self);
 }
 
 float USussTimeSinceActionPerformedInputProvider::Evaluate_Implementation(const USussBrainComponent* Brain,
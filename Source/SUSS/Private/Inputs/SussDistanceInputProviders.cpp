@@ -4,6 +4,7 @@
 #include "AIController.h"
 #include "NavigationSystem.h"
 #include "SussBrainComponent.h"
+#include "SussPathDistanceWorldSubsystem.h"
 #include "SussUtility.h"
 
 UE_DEFINE_GAMEPLAY_TAG_COMMENT(TAG_SussInputTargetDistance, "Suss.Input.Distance.ToTarget", "Get the 3D distance to a target")
@@ -12,10 +13,13 @@ UE_DEFINE_GAMEPLAY_TAG_COMMENT(TAG_SussInputTargetDistance2D, "Suss.Input.Distan
 UE_DEFINE_GAMEPLAY_TAG_COMMENT(TAG_SussInputLocationDistance2D, "Suss.Input.Distance.ToLocation2D", "Get the 2D (XY) distance to a location")
 UE_DEFINE_GAMEPLAY_TAG_COMMENT(TAG_SussInputTargetDistancePath, "Suss.Input.Distance.ToTargetPath", "Get the distance to a target along navmesh paths")
 UE_DEFINE_GAMEPLAY_TAG_COMMENT(TAG_SussInputLocationDistancePath, "Suss.Input.Distance.ToLocationPath", "Get the distance to a location along navmesh paths")
+UE_DEFINE_GAMEPLAY_TAG_COMMENT(TAG_SussInputTargetDistancePathApprox, "Suss.Input.Distance.ToTargetPathApprox", "Get the approximate distance to a target along navmesh paths, cheaper than ToTargetPath")
+UE_DEFINE_GAMEPLAY_TAG_COMMENT(TAG_SussInputLocationDistancePathApprox, "Suss.Input.Distance.ToLocationPathApprox", "Get the approximate distance to a location along navmesh paths, cheaper than ToLocationPath")
 
 USussTargetDistanceInputProvider::USussTargetDistanceInputProvider()
 {
 	InputTag = TAG_SussInputTargetDistance;
+	ContextElements = static_cast<int32>(ESussInputContextElements::Self | ESussInputContextElements::Target);
 }
 
 float USussTargetDistanceInputProvider::Evaluate_Implementation(const class USussBrainComponent* Brain,
@@ -30,6 +34,7 @@ float USussTargetDistanceInputProvider::Evaluate_Implementation(const class USus
 USussLocationDistanceInputProvider::USussLocationDistanceInputProvider()
 {
 	InputTag = TAG_SussInputLocationDistance;
+	ContextElements = static_cast<int32>(ESussInputContextElements::Self | ESussInputContextElements::Location);
 }
 
 float USussLocationDistanceInputProvider::Evaluate_Implementation(const class USussBrainComponent* Brain,
@@ -44,6 +49,7 @@ float USussLocationDistanceInputProvider::Evaluate_Implementation(const class US
 USussTargetDistance2DInputProvider::USussTargetDistance2DInputProvider()
 {
 	InputTag = TAG_SussInputTargetDistance2D;
+	ContextElements = static_cast<int32>(ESussInputContextElements::Self | ESussInputContextElements::Target);
 }
 
 float USussTargetDistance2DInputProvider::Evaluate_Implementation(const class USussBrainComponent* Brain,
@@ -65,6 +71,7 @@ float USussTargetDistance2DInputProvider::Evaluate_Implementation(const class US
 USussLocationDistance2DInputProvider::USussLocationDistance2DInputProvider()
 {
 	InputTag = TAG_SussInputLocationDistance2D;
+	ContextElements = static_cast<int32>(ESussInputContextElements::Self | ESussInputContextElements::Location);
 }
 
 float USussLocationDistance2DInputProvider::Evaluate_Implementation(const class USussBrainComponent* Brain,
@@ -76,9 +83,53 @@ float USussLocationDistance2DInputProvider::Evaluate_Implementation(const class
 		Ctx.Location);
 }
 
+namespace
+{
+	float GetCachedPathDistanceTo(const USussBrainComponent* Brain, const FVector& Location, bool bAllowPartialPath)
+	{
+		AAIController* Agent = Brain->GetAIController();
+		if (Agent && Agent->GetPawn())
+		{
+			const FVector FromLocation = Agent->GetPawn()->GetActorLocation();
+			FNavPathSharedPtr Path;
+			float Distance;
+			if (auto PathSys = GetSussPathDistanceWorldSubsystem(Agent->GetWorld()))
+			{
+				Distance = PathSys->GetPathDistance(Agent, FromLocation, Location, bAllowPartialPath, &Path);
+			}
+			else
+			{
+				Path = USussUtility::FindPathFromTo(Agent, FromLocation, Location, bAllowPartialPath);
+				Distance = Path.IsValid() ? Path->GetLength() : BIG_NUMBER;
+			}
+
+			// Keep the path so that if this context's action is chosen and moves here, it can re-use it
+			Brain->RecordScoringPath(Location, Path);
+			return Distance;
+		}
+		return BIG_NUMBER;
+	}
+
+	float GetApproxPathDistanceTo(const USussBrainComponent* Brain, const FVector& Location)
+	{
+		AAIController* Agent = Brain->GetAIController();
+		if (Agent && Agent->GetPawn())
+		{
+			const FVector FromLocation = Agent->GetPawn()->GetActorLocation();
+			if (auto PathSys = GetSussPathDistanceWorldSubsystem(Agent->GetWorld()))
+			{
+				return PathSys->GetApproxPathDistance(Agent, FromLocation, Location);
+			}
+			return FVector::Distance(FromLocation, Location);
+		}
+		return BIG_NUMBER;
+	}
+}
+
 USussTargetDistancePathInputProvider::USussTargetDistancePathInputProvider()
 {
 	InputTag = TAG_SussInputTargetDistancePath;
+	ContextElements = static_cast<int32>(ESussInputContextElements::Self | ESussInputContextElements::Target);
 }
 
 DECLARE_CYCLE_STAT(TEXT("SUSS Target Distance Path Input"), STAT_SUSSTargetDistancePathInput, STATGROUP_SUSS);
@@ -97,7 +148,7 @@ float USussTargetDistancePathInputProvider::Evaluate_Implementation(const USussB
 			bAllowPartialPath = pAllowPartialPathParam->BoolValue;
 		}
 
-		return USussUtility::GetPathDistanceTo(Brain->GetAIController(), Context.Target->GetActorLocation(), bAllowPartialPath);
+		return GetCachedPathDistanceTo(Brain, Context.Target->GetActorLocation(), bAllowPartialPath);
 	}
 	return BIG_NUMBER;
 }
@@ -105,6 +156,7 @@ float USussTargetDistancePathInputProvider::Evaluate_Implementation(const USussB
 USussLocationDistancePathInputProvider::USussLocationDistancePathInputProvider()
 {
 	InputTag = TAG_SussInputLocationDistancePath;
+	ContextElements = static_cast<int32>(ESussInputContextElements::Self | ESussInputContextElements::Location);
 }
 
 DECLARE_CYCLE_STAT(TEXT("SUSS Location Distance Path Input"), STAT_SUSSLocationDistancePathInput, STATGROUP_SUSS);
@@ -121,5 +173,35 @@ float USussLocationDistancePathInputProvider::Evaluate_Implementation(const USus
 		bAllowPartialPath = pAllowPartialPathParam->BoolValue;
 	}
 
-	return USussUtility::GetPathDistanceTo(Brain->GetAIController(), Context.Location, bAllowPartialPath);
+	return GetCachedPathDistanceTo(Brain, Context.Location, bAllowPartialPath);
+}
+
+USussTargetDistancePathApproxInputProvider::USussTargetDistancePathApproxInputProvider()
+{
+	InputTag = TAG_SussInputTargetDistancePathApprox;
+	ContextElements = static_cast<int32>(ESussInputContextElements::Self | ESussInputContextElements::Target);
+}
+
+float USussTargetDistancePathApproxInputProvider::Evaluate_Implementation(const USussBrainComponent* Brain,
+	const FSussContext& Context,
+	const TMap<FName, FSussParameter>& Parameters) const
+{
+	if (Context.Target.IsValid())
+	{
+		return GetApproxPathDistanceTo(Brain, Context.Target->GetActorLocation());
+	}
+	return BIG_NUMBER;
+}
+
+USussLocationDistancePathApproxInputProvider::USussLocationDistancePathApproxInputProvider()
+{
+	InputTag = TAG_SussInputLocationDistancePathApprox;
+	ContextElements = static_cast<int32>(ESussInputContextElements::Self | ESussInputContextElements::Location);
+}
+
+float USussLocationDistancePathApproxInputProvider::Evaluate_Implementation(const USussBrainComponent* Brain,
+	const FSussContext& Context,
+	const TMap<FName, FSussParameter>& Parameters) const
+{
+	return GetApproxPathDistanceTo(Brain, Context.Location);
 }
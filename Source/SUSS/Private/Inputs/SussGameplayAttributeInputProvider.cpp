@@ -27,6 +27,11 @@ float USussGameplayAttributeInputProvider::GetAttributeValue(const AActor* FromA
 	return 0;
 }
 
+USussGameplayAttributeSelfInputProvider::USussGameplayAttributeSelfInputProvider()
+{
+	ContextElements = static_cast<int32>(ESussInputContextElements::Self);
+}
+
 float USussGameplayAttributeSelfInputProvider::Evaluate_Implementation(const USussBrainComponent* Brain,
                                                                        const FSussContext& Context,
                                                                        const TMap<FName, FSussParameter>& Parameters) const
@@ -34,6 +39,11 @@ float USussGameplayAttributeSelfInputProvider::Evaluate_Implementation(const USu
 	return GetAttributeValue(Context.ControlledActor);
 }
 
+USussGameplayAttributeTargetInputProvider::USussGameplayAttributeTargetInputProvider()
+{
+	ContextElements = static_cast<int32>(ESussInputContextElements::Target);
+}
+
 float USussGameplayAttributeTargetInputProvider::Evaluate_Implementation(const class USussBrainComponent* Brain,
                                                                          const FSussContext& Context,
                                                                          const TMap<FName, FSussParameter>& Parameters) const
@@ -47,6 +47,11 @@ float USussGameplayTagInputProvider::ScoreTagsOnActor(const AActor* FromActor) c
 	return 0;
 }
 
+USussGameplayTagSelfInputProvider::USussGameplayTagSelfInputProvider()
+{
+	ContextElements = static_cast<int32>(ESussInputContextElements::Self);
+}
+
 float USussGameplayTagSelfInputProvider::Evaluate_Implementation(
 	const class USussBrainComponent* Brain,
 	const FSussContext& Context,
@@ -55,6 +60,11 @@ float USussGameplayTagSelfInputProvider::Evaluate_Implementation(
 	return ScoreTagsOnActor(Context.ControlledActor);
 }
 
+USussGameplayTagTargetInputProvider::USussGameplayTagTargetInputProvider()
+{
+	ContextElements = static_cast<int32>(ESussInputContextElements::Target);
+}
+
 float USussGameplayTagTargetInputProvider::Evaluate_Implementation(
 	const class USussBrainComponent* Brain,
 	const FSussContext& Context,
@@ -15,6 +15,7 @@ UE_DEFINE_GAMEPLAY_TAG_COMMENT(TAG_SussInputLineOfSightToTarget, "Suss.Input.Per
 USussSelfSightRangeInputProvider::USussSelfSightRangeInputProvider()
 {
 	InputTag = TAG_SussInputSelfSightRange;
+	ContextElements = static_cast<int32>(ESussInputContextElements::Self);
 }
 
 float USussSelfSightRangeInputProvider::Evaluate_Implementation(const class USussBrainComponent* Brain,
@@ -36,6 +37,7 @@ float USussSelfSightRangeInputProvider::Evaluate_Implementation(const class USus
 USussSelfHearingRangeInputProvider::USussSelfHearingRangeInputProvider()
 {
 	InputTag = TAG_SussInputSelfHearingRange;
+	ContextElements = static_cast<int32>(ESussInputContextElements::Self);
 }
 
 float USussSelfHearingRangeInputProvider::Evaluate_Implementation(const class USussBrainComponent* Brain,
@@ -57,6 +59,7 @@ float USussSelfHearingRangeInputProvider::Evaluate_Implementation(const class US
 USussLineOfSightToTargetInputProvider::USussLineOfSightToTargetInputProvider()
 {
 	InputTag = TAG_SussInputLineOfSightToTarget;
+	ContextElements = static_cast<int32>(ESussInputContextElements::Self | ESussInputContextElements::Target);
 }
 
 float USussLineOfSightToTargetInputProvider::Evaluate_Implementation(const USussBrainComponent* Brain,
@@ -67,11 +70,11 @@ float USussLineOfSightToTargetInputProvider::Evaluate_Implementation(const USuss
 	if (Pawn && Context.Target.IsValid())
 	{
 		UWorld* World = Pawn->GetWorld();
+		const AActor* Target = Context.Target.Get();
 		FVector Start, End;
 		FRotator DummyRot;
 		Pawn->GetActorEyesViewPoint(Start, DummyRot);
-		End = Context.Target->GetActorLocation();
-		ECollisionChannel Channel = USussUtility::GetLineOfSightTraceChannel();
+		End = Target->GetActorLocation();
 
 		float Radius = 0;
 		if (auto pRadiusParam = Parameters.Find(SUSS::RadiusParamName))
@@ -79,44 +82,234 @@ float USussLineOfSightToTargetInputProvider::Evaluate_Implementation(const USuss
 			Radius = pRadiusParam->FloatValue;
 		}
 
-		FCollisionQueryParams Params(SCENE_QUERY_STAT(LineOfSight), true, Pawn);
-		Params.AddIgnoredActor(Context.Target.Get());
-		FHitResult Hit;
-		bool bHit = false;
-
-		if (Radius > 0)
+		if (bUseSightPerception && Radius <= 0 && IsRecentlySeenBySightPerception(Brain, Target))
 		{
-			bHit = World->SweepSingleByChannel(Hit, Start, End, FQuat::Identity, Channel, FCollisionShape::MakeSphere(Radius), Params);
 #if ENABLE_VISUAL_LOG
-			// You'd think you could do UE_VLOG_CYLINDER with start/end but those are always vertical regardless
-			UE_VLOG_ARROW(Brain->GetLogOwner(), LogSuss, Verbose, Start, End, bHit ? FColor::Red : FColor::Green, TEXT(""));
-			// Display a sphere every X radii up to hit point
-			const FVector DebugEnd =  bHit ? Hit.Location : End;
-			int LogSphereCount = FVector::Distance(Start, DebugEnd) / (Radius * 4);
-			for (int c = 0; c <= LogSphereCount; ++c)
+			UE_VLOG_ARROW(Brain->GetLogOwner(), LogSuss, VeryVerbose, Start, End, FColor::Green, TEXT("Sight"));
+#endif
+			return 1;
+		}
+
+		if (CachedResultLifetime <= 0)
+		{
+			return TraceLineOfSight(Brain, Start, End, Radius, Pawn, Target) ? 1 : 0;
+		}
+
+		const double Now = World->GetTimeSeconds();
+		if (Now - LastCachePurgeTime > 1 || Now < LastCachePurgeTime)
+		{
+			PurgeCache(Now);
+		}
+
+		const FLineOfSightCacheKey Key(Pawn, Target, Radius);
+		FLineOfSightCacheEntry* pEntry = CachedResults.Find(Key);
+		if (!pEntry)
+		{
+			// First request for this pair, always trace inline so we have a real result
+			pEntry = &CachedResults.Add(Key);
+			pEntry->Start = Start;
+			pEntry->End = End;
+			pEntry->Time = Now;
+			pEntry->bHasLineOfSight = TraceLineOfSight(Brain, Start, End, Radius, Pawn, Target);
+		}
+		else if (!IsCachedResultValid(*pEntry, Start, End, Now))
+		{
+			// Assume a trace that's taking far too long has been lost, rather than waiting forever
+			const bool bPending = pEntry->bPending && Now - pEntry->PendingTime <= PendingTraceTimeout && Now >= pEntry->PendingTime;
+			if (bAsyncTraces)
 			{
-				const FVector Pos = FMath::Lerp(Start, DebugEnd, (float)c / LogSphereCount);
-				UE_VLOG_LOCATION(Brain->GetLogOwner(), LogSuss, Verbose, Pos, Radius, bHit ? FColor::Red : FColor::Green, TEXT(""));
+				// Keep returning the last known result until the trace completes
+				if (!bPending)
+				{
+					RequestAsyncTrace(Key, *pEntry, World, Start, End, Radius, Pawn, Target, Now);
+				}
+			}
+			else
+			{
+				pEntry->Start = Start;
+				pEntry->End = End;
+				pEntry->Time = Now;
+				pEntry->bPending = false;
+				pEntry->bHasLineOfSight = TraceLineOfSight(Brain, Start, End, Radius, Pawn, Target);
 			}
-#endif
 		}
+#if ENABLE_VISUAL_LOG
 		else
 		{
-			bHit = World->LineTraceSingleByChannel(Hit, Start, End, Channel, Params);
-#if ENABLE_VISUAL_LOG
-			UE_VLOG_ARROW(Brain->GetLogOwner(), LogSuss, Verbose, Start, End, bHit ? FColor::Red : FColor::Green, TEXT(""));
+			UE_VLOG_ARROW(Brain->GetLogOwner(), LogSuss, VeryVerbose, pEntry->Start, pEntry->End, pEntry->bHasLineOfSight ? FColor::Green : FColor::Red, TEXT("Cached"));
+		}
 #endif
+		pEntry->LastUsedTime = Now;
+
+		return pEntry->bHasLineOfSight ? 1 : 0;
+	}
+
+	return 0;
+}
+
+bool USussLineOfSightToTargetInputProvider::IsRecentlySeenBySightPerception(const USussBrainComponent* Brain,
+	const AActor* Target) const
+{
+	if (const auto Percept = Brain->GetPerceptionComponent())
+	{
+		if (const FActorPerceptionInfo* Info = Percept->GetActorInfo(*Target))
+		{
+			const FAISenseID SightID = UAISense::GetSenseID<UAISense_Sight>();
+			if (Info->LastSensedStimuli.IsValidIndex(SightID))
+			{
+				// Sight perception re-registers the stimulus while the target stays visible, and registers a failed
+				// stimulus when it's lost. Lost sight might just mean out of range, so that still needs a trace.
+				const FAIStimulus& Stim = Info->LastSensedStimuli[SightID];
+				return Stim.WasSuccessfullySensed() && !Stim.IsExpired() && Stim.GetAge() <= MaxSightStimulusAge;
+			}
 		}
+	}
+	return false;
+}
 
+bool USussLineOfSightToTargetInputProvider::TraceLineOfSight(const USussBrainComponent* Brain,
+	const FVector& Start,
+	const FVector& End,
+	float Radius,
+	const AActor* Self,
+	const AActor* Target) const
+{
+	UWorld* World = Self->GetWorld();
+	const ECollisionChannel Channel = USussUtility::GetLineOfSightTraceChannel();
+	FCollisionQueryParams Params(SCENE_QUERY_STAT(LineOfSight), true, Self);
+	Params.AddIgnoredActor(Target);
+	FHitResult Hit;
+	bool bHit = false;
+
+	if (Radius > 0)
+	{
+		bHit = World->SweepSingleByChannel(Hit, Start, End, FQuat::Identity, Channel, FCollisionShape::MakeSphere(Radius), Params);
 #if ENABLE_VISUAL_LOG
-		if (bHit)
+		// You'd think you could do UE_VLOG_CYLINDER with start/end but those are always vertical regardless
+		UE_VLOG_ARROW(Brain->GetLogOwner(), LogSuss, Verbose, Start, End, bHit ? FColor::Red : FColor::Green, TEXT(""));
+		// Display a sphere every X radii up to hit point
+		const FVector DebugEnd =  bHit ? Hit.Location : End;
+		int LogSphereCount = FVector::Distance(Start, DebugEnd) / (Radius * 4);
+		for (int c = 0; c <= LogSphereCount; ++c)
 		{
-			UE_VLOG_LOCATION(Brain->GetLogOwner(), LogSuss, Verbose, Hit.Location, 15, FColor::Red, TEXT(""));
+			const FVector Pos = FMath::Lerp(Start, DebugEnd, (float)c / LogSphereCount);
+			UE_VLOG_LOCATION(Brain->GetLogOwner(), LogSuss, Verbose, Pos, Radius, bHit ? FColor::Red : FColor::Green, TEXT(""));
 		}
 #endif
+	}
+	else
+	{
+		bHit = World->LineTraceSingleByChannel(Hit, Start, End, Channel, Params);
+#if ENABLE_VISUAL_LOG
+		UE_VLOG_ARROW(Brain->GetLogOwner(), LogSuss, Verbose, Start, End, bHit ? FColor::Red : FColor::Green, TEXT(""));
+#endif
+	}
 
-		return bHit ? 0 : 1;
+#if ENABLE_VISUAL_LOG
+	if (bHit)
+	{
+		UE_VLOG_LOCATION(Brain->GetLogOwner(), LogSuss, Verbose, Hit.Location, 15, FColor::Red, TEXT(""));
 	}
+#endif
 
-	return 0;
+	return !bHit;
+}
+
+void USussLineOfSightToTargetInputProvider::RequestAsyncTrace(const FLineOfSightCacheKey& Key,
+	FLineOfSightCacheEntry& Entry,
+	UWorld* World,
+	const FVector& Start,
+	const FVector& End,
+	float Radius,
+	const AActor* Self,
+	const AActor* Target,
+	double Now) const
+{
+	const ECollisionChannel Channel = USussUtility::GetLineOfSightTraceChannel();
+	FCollisionQueryParams Params(SCENE_QUERY_STAT(LineOfSight), true, Self);
+	Params.AddIgnoredActor(Target);
+
+	// We're the CDO and outlive the trace; the result is written back to the cache via the key
+	const FTraceDelegate Delegate = FTraceDelegate::CreateUObject(
+		const_cast<USussLineOfSightToTargetInputProvider*>(this),
+		&USussLineOfSightToTargetInputProvider::OnAsyncTraceFinished,
+		Key);
+
+	if (Radius > 0)
+	{
+		Entry.PendingTrace = World->AsyncSweepByChannel(EAsyncTraceType::Single,
+		                                                Start,
+		                                                End,
+		                                                FQuat::Identity,
+		                                                Channel,
+		                                                FCollisionShape::MakeSphere(Radius),
+		                                                Params,
+		                                                FCollisionResponseParams::DefaultResponseParam,
+		                                                &Delegate);
+	}
+	else
+	{
+		Entry.PendingTrace = World->AsyncLineTraceByChannel(EAsyncTraceType::Single,
+		                                                    Start,
+		                                                    End,
+		                                                    Channel,
+		                                                    Params,
+		                                                    FCollisionResponseParams::DefaultResponseParam,
+		                                                    &Delegate);
+	}
+
+	Entry.bPending = true;
+	Entry.PendingTime = Now;
+	// Movement is measured from the positions the pending trace is for, so that we don't request again while it's pending
+	Entry.Start = Start;
+	Entry.End = End;
+}
+
+void USussLineOfSightToTargetInputProvider::OnAsyncTraceFinished(const FTraceHandle& Handle,
+	FTraceDatum& Datum,
+	FLineOfSightCacheKey Key)
+{
+	if (FLineOfSightCacheEntry* pEntry = CachedResults.Find(Key))
+	{
+		// Ignore results of traces which were superseded
+		if (pEntry->bPending && pEntry->PendingTrace == Handle)
+		{
+			pEntry->bHasLineOfSight = !Datum.OutHits.ContainsByPredicate([](const FHitResult& Hit) { return Hit.bBlockingHit; });
+			pEntry->Time = pEntry->PendingTime;
+			pEntry->bPending = false;
+		}
+	}
+}
+
+bool USussLineOfSightToTargetInputProvider::IsCachedResultValid(const FLineOfSightCacheEntry& Entry,
+	const FVector& Start,
+	const FVector& End,
+	double Now) const
+{
+	const float Age = static_cast<float>(Now - Entry.Time);
+	if (Age < 0 || Age > CachedResultLifetime)
+	{
+		return false;
+	}
+
+	const float MaxMovementSq = FMath::Square(CachedResultMaxMovement);
+	return FVector::DistSquared(Entry.Start, Start) <= MaxMovementSq &&
+		FVector::DistSquared(Entry.End, End) <= MaxMovementSq;
+}
+
+void USussLineOfSightToTargetInputProvider::PurgeCache(double Now) const
+{
+	for (auto It = CachedResults.CreateIterator(); It; ++It)
+	{
+		const FLineOfSightCacheEntry& Entry = It.Value();
+		// Time going backwards means the world has changed
+		if (Now - Entry.LastUsedTime > UnusedCacheEntryLifetime ||
+			Now < Entry.LastUsedTime ||
+			!It.Key().Self.ResolveObjectPtr() ||
+			!It.Key().Target.ResolveObjectPtr())
+		{
+			It.RemoveCurrent();
+		}
+	}
+	LastCachePurgeTime = Now;
 }
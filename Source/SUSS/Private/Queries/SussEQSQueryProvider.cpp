@@ -7,37 +7,70 @@
 #include "EnvironmentQuery/Items/EnvQueryItemType_ActorBase.h"
 #include "EnvironmentQuery/Items/EnvQueryItemType_VectorBase.h"
 #include "Misc/TransactionObjectEvent.h"
-#include "Queries/SussEQSWorldSubsystem.h"
 
 TSharedPtr<FEnvQueryResult> USussEQSQueryProvider::RunEQSQuery(USussBrainComponent* Brain,
                                                                AActor* Self,
                                                                const TMap<FName, FSussParameter>& Params,
                                                                const FSussContext& Context)
 {
-	TArray<FEnvNamedValue> QueryParams = QueryConfig;
-	USussUtility::AddEQSParams(Params, QueryParams);
-
-	// unfortunately we have no place to store any extra EQS context values like current target
-	// we use this subsystem hack instead
-	bool bClearTargetContext = false;
-	if (bIsCorrelatedWithContext)
+	TArray<FEnvNamedValue> LocalQueryParams;
+	if (!bUseBatchQueryParams)
 	{
-		auto EQSSub = Self->GetWorld()->GetSubsystem<USussEQSWorldSubsystem>();
-		if (Context.Target.IsValid())
-		{
-			EQSSub->SetTargetInfo(Self, Context.Target.Get());
-			bClearTargetContext = true;
-		}
+		BuildQueryParams(Params, LocalQueryParams);
 	}
-	TSharedPtr<FEnvQueryResult> Ret = USussUtility::RunEQSQuery(Self, EQSQuery, QueryParams, QueryMode);
+	const TArray<FEnvNamedValue>& QueryParams = bUseBatchQueryParams ? BatchQueryParams : LocalQueryParams;
+
+	// The context is passed along with this request, for USussEnvQueryContext_Target etc
+	const bool bPassContext = bIsCorrelatedWithContext || Context.Target.IsValid();
+	return USussUtility::RunEQSQuery(Self, EQSQuery, QueryParams, QueryMode, bPassContext ? &Context : nullptr);
+}
+
+void USussEQSQueryProvider::BuildQueryParams(const TMap<FName, FSussParameter>& Params,
+                                             TArray<FEnvNamedValue>& OutQueryParams) const
+{
+	OutQueryParams = QueryConfig;
+	USussUtility::AddEQSParams(Params, OutQueryParams);
+}
 
-	// Clear temp context info
-	if (bClearTargetContext)
+bool USussEQSQueryProvider::ExecuteQueryAsync(USussBrainComponent* Brain,
+                                              AActor* Self,
+                                              const FSussQueryCacheKey& Key,
+                                              FSussCachedQueryResults& Entry)
+{
+	TArray<FEnvNamedValue> QueryParams;
+	BuildQueryParams(Key.Params, QueryParams);
+	const int32 QueryID = USussUtility::RunEQSQueryAsync(Self,
+	                                                     EQSQuery,
+	                                                     QueryParams,
+	                                                     QueryMode,
+	                                                     FQueryFinishedSignature::CreateUObject(
+		                                                     this,
+		                                                     &USussEQSQueryProvider::OnAsyncQueryFinished,
+		                                                     Key,
+		                                                     MakeWeakObjectPtr(Brain)));
+	if (QueryID == INDEX_NONE)
+		return false;
+
+	Entry.AsyncQueryID = QueryID;
+	if (!Entry.Results.IsValid())
 	{
-		auto EQSSub = Self->GetWorld()->GetSubsystem<USussEQSWorldSubsystem>();
-		EQSSub->ClearTargetInfo(Self);
+		// First run, so there's nothing to return until the query completes
+		BeginNewResults(Entry);
+		WriteEQSResults(nullptr, *Entry.Results);
 	}
-	return Ret;
+	return true;
+}
+
+void USussEQSQueryProvider::OnAsyncQueryFinished(TSharedPtr<FEnvQueryResult> Result,
+                                                 FSussQueryCacheKey Key,
+                                                 TWeakObjectPtr<USussBrainComponent> Brain)
+{
+	const int32 QueryID = Result.IsValid() ? Result->QueryID : INDEX_NONE;
+	const FEnvQueryResult* pResult = Result.IsValid() && Result->IsSuccessful() ? Result.Get() : nullptr;
+	CompleteAsyncQuery(Brain.Get(), Key, QueryID, [this, pResult](AActor* Self, TSussResultsArray& OutResults)
+	{
+		WriteEQSResults(pResult, OutResults);
+	});
 }
 
 bool USussEQSQueryProvider::ShouldIncludeResult(const FEnvQueryItem& Item) const
@@ -52,26 +85,35 @@ void USussEQSTargetQueryProvider::ExecuteQuery(USussBrainComponent* Brain,
                                                TArray<TWeakObjectPtr<AActor>>& OutResults)
 {
 	const auto Result = RunEQSQuery(Brain, Self, Params, Context);
-	if (Result && Result->ItemType->IsChildOf(UEnvQueryItemType_ActorBase::StaticClass()))
+	if (Result)
+	{
+		AppendEQSResults(*Result, OutResults);
+	}
+}
+
+void USussEQSTargetQueryProvider::AppendEQSResults(const FEnvQueryResult& Result,
+                                                   TArray<TWeakObjectPtr<AActor>>& OutResults) const
+{
+	if (Result.ItemType && Result.ItemType->IsChildOf(UEnvQueryItemType_ActorBase::StaticClass()))
 	{
-		const UEnvQueryItemType_ActorBase* DefTypeOb =  Result->ItemType->GetDefaultObject<UEnvQueryItemType_ActorBase>();
+		const UEnvQueryItemType_ActorBase* DefTypeOb =  Result.ItemType->GetDefaultObject<UEnvQueryItemType_ActorBase>();
 
 		if (QueryMode == EEnvQueryRunMode::AllMatching)
 		{
-			for (const auto& Item : Result->Items)
+			for (const auto& Item : Result.Items)
 			{
 				if (ShouldIncludeResult(Item))
 				{
-					OutResults.Add(DefTypeOb->GetActor(Result->RawData.GetData() + Item.DataOffset));
+					OutResults.Add(DefTypeOb->GetActor(Result.RawData.GetData() + Item.DataOffset));
 				}
 			}
 		}
 		else
 		{
 			// For Modes that aren't "all", we still have all the items, but the best one has been swapped to item 0
-			if (Result->Items.Num() > 0)
+			if (Result.Items.Num() > 0)
 			{
-				OutResults.Add(DefTypeOb->GetActor(Result->RawData.GetData() + Result->Items[0].DataOffset));
+				OutResults.Add(DefTypeOb->GetActor(Result.RawData.GetData() + Result.Items[0].DataOffset));
 			}
 		}
 	}
@@ -84,25 +126,33 @@ void USussEQSLocationQueryProvider::ExecuteQuery(USussBrainComponent* Brain,
                                                  TArray<FVector>& OutResults)
 {
 	const auto Result = RunEQSQuery(Brain, Self, Params, Context);
-	if (Result && Result->ItemType->IsChildOf(UEnvQueryItemType_VectorBase::StaticClass()))
+	if (Result)
+	{
+		AppendEQSResults(*Result, OutResults);
+	}
+}
+
+void USussEQSLocationQueryProvider::AppendEQSResults(const FEnvQueryResult& Result, TArray<FVector>& OutResults) const
+{
+	if (Result.ItemType && Result.ItemType->IsChildOf(UEnvQueryItemType_VectorBase::StaticClass()))
 	{
-		const UEnvQueryItemType_VectorBase* DefTypeOb =  Result->ItemType->GetDefaultObject<UEnvQueryItemType_VectorBase>();
+		const UEnvQueryItemType_VectorBase* DefTypeOb =  Result.ItemType->GetDefaultObject<UEnvQueryItemType_VectorBase>();
 		if (QueryMode == EEnvQueryRunMode::AllMatching)
 		{
-			for (const auto& Item : Result->Items)
+			for (const auto& Item : Result.Items)
 			{
 				if (ShouldIncludeResult(Item))
 				{
-					OutResults.Add(DefTypeOb->GetItemLocation(Result->RawData.GetData() + Item.DataOffset));
+					OutResults.Add(DefTypeOb->GetItemLocation(Result.RawData.GetData() + Item.DataOffset));
 				}
 			}
 		}
 		else
 		{
 			// For Modes that aren't "all", we still have all the items, but the best one has been swapped to item 0
-			if (Result->Items.Num() > 0)
+			if (Result.Items.Num() > 0)
 			{
-				OutResults.Add(DefTypeOb->GetItemLocation(Result->RawData.GetData() + Result->Items[0].DataOffset));
+				OutResults.Add(DefTypeOb->GetItemLocation(Result.RawData.GetData() + Result.Items[0].DataOffset));
 			}
 		}
 	}
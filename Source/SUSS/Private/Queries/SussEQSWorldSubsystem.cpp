@@ -1,24 +1,47 @@
 ﻿// 
 #include "Queries/SussEQSWorldSubsystem.h"
 
-void USussEQSWorldSubsystem::SetTargetInfo(const AActor* Owner, AActor* Target)
+#include "EnvironmentQuery/EnvQueryInstanceBlueprintWrapper.h"
+
+const FName USussEQSWorldSubsystem::ContextHandleParamName("SussContextHandle");
+
+int32 USussEQSWorldSubsystem::AddQueryContext(const FSussContext& Context)
+{
+	// Handles are passed as float params, so keep them within the range floats represent exactly
+	const int32 Handle = NextContextHandle;
+	NextContextHandle = NextContextHandle >= (1 << 24) ? 1 : NextContextHandle + 1;
+	QueryContexts.Add(Handle, Context);
+	return Handle;
+}
+
+int32 USussEQSWorldSubsystem::AddQueryContext(const FSussContext& Context, UEnvQueryInstanceBlueprintWrapper* Wrapper)
 {
-	const uint32 Key = GetTargetKey(Owner);
-	TargetContextMap.Add(Key, Target);
+	const int32 Handle = AddQueryContext(Context);
+	WrapperContextHandles.Add(Wrapper, Handle);
+	Wrapper->GetOnQueryFinishedEvent().AddUniqueDynamic(this, &USussEQSWorldSubsystem::OnWrapperQueryFinished);
+	return Handle;
 }
 
-void USussEQSWorldSubsystem::ClearTargetInfo(const AActor* Owner)
+void USussEQSWorldSubsystem::RemoveQueryContext(int32 Handle)
 {
-	const uint32 Key = GetTargetKey(Owner);
-	TargetContextMap.Remove(Key);
+	QueryContexts.Remove(Handle);
+}
+
+void USussEQSWorldSubsystem::OnWrapperQueryFinished(UEnvQueryInstanceBlueprintWrapper* Wrapper,
+	EEnvQueryStatus::Type QueryStatus)
+{
+	int32 Handle;
+	if (WrapperContextHandles.RemoveAndCopyValue(Wrapper, Handle))
+	{
+		RemoveQueryContext(Handle);
+	}
 }
 
-AActor* USussEQSWorldSubsystem::GetTargetInfo(AActor* Owner)
+const FSussContext* USussEQSWorldSubsystem::GetQueryContext(const FEnvQueryInstance& QueryInstance) const
 {
-	const uint32 Key = GetTargetKey(Owner);
-	if (auto pResult = TargetContextMap.Find(Key))
+	if (const float* pHandle = QueryInstance.NamedParams.Find(ContextHandleParamName))
 	{
-		return *pResult;
+		return QueryContexts.Find(FMath::RoundToInt(*pHandle));
 	}
 	return nullptr;
 }
@@ -0,0 +1,23 @@
+﻿// 
+
+
+#include "Queries/SussEnvQueryContext_Location.h"
+
+#include "EnvironmentQuery/EnvQueryTypes.h"
+#include "EnvironmentQuery/Items/EnvQueryItemType_Point.h"
+#include "Queries/SussEQSWorldSubsystem.h"
+
+void USussEnvQueryContext_Location::ProvideContext(FEnvQueryInstance& QueryInstance,
+                                                   FEnvQueryContextData& ContextData) const
+{
+	// Context is registered with the subsystem for the duration of the query, see USussEnvQueryContext_Target
+	AActor* QueryOwner = Cast<AActor>(QueryInstance.Owner.Get());
+	if (!QueryOwner)
+		return;
+
+	auto EQSSub = QueryOwner->GetWorld()->GetSubsystem<USussEQSWorldSubsystem>();
+	if (const FSussContext* Context = EQSSub->GetQueryContext(QueryInstance))
+	{
+		UEnvQueryItemType_Point::SetContextHelper(ContextData, Context->Location);
+	}
+}
@@ -11,11 +11,18 @@
 void USussEnvQueryContext_Target::ProvideContext(FEnvQueryInstance& QueryInstance,
                                                  FEnvQueryContextData& ContextData) const
 {
-	// SUSS allows multiple contexts, and a target per context. Since we have nowhere to store that on FEnvQueryInstance,
-	// we use this subsystem hack to temporarily associate an owner with a target while we're running this query
+	// SUSS allows multiple contexts, and a target per context. The context is registered with the subsystem for the
+	// duration of the query, with its handle passed as a named param
 	AActor* QueryOwner = Cast<AActor>(QueryInstance.Owner.Get());
+	if (!QueryOwner)
+		return;
+
+	AActor* Target = nullptr;
 	auto EQSSub = QueryOwner->GetWorld()->GetSubsystem<USussEQSWorldSubsystem>();
-	AActor* Target = EQSSub->GetTargetInfo(QueryOwner);
+	if (const FSussContext* Context = EQSSub->GetQueryContext(QueryInstance))
+	{
+		Target = Context->Target.Get();
+	}
 
 #if WITH_EDITOR
 	// This is just so that we can use it with the testing pawn
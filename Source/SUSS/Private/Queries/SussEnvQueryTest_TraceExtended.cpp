@@ -1,6 +1,11 @@
 ﻿
 #include "Queries/SussEnvQueryTest_TraceExtended.h"
 
+#include "SussCommon.h"
+#include "Async/ParallelFor.h"
+
+DECLARE_CYCLE_STAT(TEXT("SUSS EQS Trace Extended"), STAT_SUSS_EQSTraceExtended, STATGROUP_SUSS);
+
 bool USussEnvQueryTest_TraceExtended::DoLineTraceTo(const FVector& ItemPos, const FVector& ContextPos, AActor* ItemActor, UWorld* World, enum ECollisionChannel Channel, const FCollisionQueryParams& Params, const FVector& Extent)
 {
 	FCollisionQueryParams TraceParams(Params);
@@ -73,8 +78,28 @@ bool USussEnvQueryTest_TraceExtended::DoCapsuleTraceFrom(const FVector& ItemPos,
 	return bHit;
 }
 
+USussEnvQueryTest_TraceExtended::FTraceRequest USussEnvQueryTest_TraceExtended::MakeTraceRequest(const FVector& ItemLocation,
+	const FVector& ContextLocation,
+	AActor* ItemActor,
+	float ItemOffset,
+	float ContextOffset) const
+{
+	FTraceRequest Request { ItemLocation, ContextLocation, ItemActor };
+	// Offset the ends if needed
+	if (!FMath::IsNearlyZero(ContextOffset) || !FMath::IsNearlyZero(ItemOffset))
+	{
+		FVector ContextToItemVec =  ItemLocation - ContextLocation;
+		ContextToItemVec.Normalize();
+		Request.ContextLocation += ContextOffset * ContextToItemVec;
+		Request.ItemLocation -= ItemOffset * ContextToItemVec;
+	}
+	return Request;
+}
+
 void USussEnvQueryTest_TraceExtended::RunTest(FEnvQueryInstance& QueryInstance) const
 {
+	SCOPE_CYCLE_COUNTER(STAT_SUSS_EQSTraceExtended);
+
 	// Overridden, similar to old 5.3 version because has changed and lost the places we needed to modify to implement this
 	UObject* DataOwner = QueryInstance.Owner.Get();
 	BoolValue.BindData(DataOwner, QueryInstance.QueryID);
@@ -136,25 +161,70 @@ void USussEnvQueryTest_TraceExtended::RunTest(FEnvQueryInstance& QueryInstance)
 		ContextLocations[ContextIndex].Z += ContextZ;
 	}
 
-	for (FEnvQueryInstance::ItemIterator It(this, QueryInstance); It; ++It)
+	// Single result queries can stop at the first item which passes, so trace one item at a time like the base test
+	const bool bCanStopEarly = QueryInstance.Mode == EEnvQueryRunMode::SingleResult;
+	const int32 NumContexts = ContextLocations.Num();
+	const int32 ItemsPerBatch = bCanStopEarly ? 1 : FMath::Max(TraceBatchSize / FMath::Max(NumContexts, 1), 1);
+
+	TArray<FTraceRequest> Requests;
+	TArray<bool> Hits;
+	TArray<int32> FirstRequestByItem;
+	for (FEnvQueryInstance::ItemIterator It(this, QueryInstance); It; )
 	{
-		FVector ItemLocation = GetItemLocation(QueryInstance, It.GetIndex()) + FVector(0, 0, ItemZ);
-		AActor* ItemActor = GetItemActor(QueryInstance, It.GetIndex());
+		// Gather traces for the next batch of items from where the iterator is, which is part way through the items
+		// when a time sliced query resumes, so we only trace items the iterator is about to score
+		const int32 BatchStart = It.GetIndex();
+		int32 BatchEnd = BatchStart;
+		Requests.Reset();
+		FirstRequestByItem.Reset();
+		for (int32 NumBatchItems = 0; BatchEnd < QueryInstance.Items.Num() && NumBatchItems < ItemsPerBatch; ++BatchEnd)
+		{
+			if (!QueryInstance.Items[BatchEnd].IsValid())
+			{
+				FirstRequestByItem.Add(INDEX_NONE);
+				continue;
+			}
+
+			const FVector ItemLocation = GetItemLocation(QueryInstance, BatchEnd) + FVector(0, 0, ItemZ);
+			AActor* ItemActor = GetItemActor(QueryInstance, BatchEnd);
+			FirstRequestByItem.Add(Requests.Num());
+			for (int32 ContextIndex = 0; ContextIndex < NumContexts; ContextIndex++)
+			{
+				Requests.Add(MakeTraceRequest(ItemLocation, ContextLocations[ContextIndex], ItemActor, ItemOffsetVal, ContextOffsetVal));
+			}
+			++NumBatchItems;
+		}
+
+		Hits.Reset();
+		Hits.SetNumZeroed(Requests.Num());
+		const bool bParallel = bParallelTraces && Requests.Num() >= MinParallelTraces;
+		ParallelFor(Requests.Num(), [&](int32 i)
+		{
+			const FTraceRequest& Req = Requests[i];
+			Hits[i] = TraceFunc.Execute(Req.ItemLocation, Req.ContextLocation, Req.ItemActor, QueryInstance.World, TraceCollisionChannel, TraceParams, TraceExtent);
+		}, bParallel ? EParallelForFlags::None : EParallelForFlags::ForceSingleThread);
 
-		for (int32 ContextIndex = 0; ContextIndex < ContextLocations.Num(); ContextIndex++)
+		// Apply the batch. The iterator stops when it runs out of time or finds a single result, in which case the
+		// outer loop ends too and the next step starts a new batch from where it got to.
+		for (; It && It.GetIndex() < BatchEnd; ++It)
 		{
-			FVector ContextLocation = ContextLocations[ContextIndex];
-			// Offset the ends if needed
-			if (!FMath::IsNearlyZero(ContextOffsetVal) || !FMath::IsNearlyZero(ItemOffsetVal))
+			const int32 FirstRequest = FirstRequestByItem[It.GetIndex() - BatchStart];
+			for (int32 ContextIndex = 0; ContextIndex < NumContexts; ContextIndex++)
 			{
-				FVector ContextToItemVec =  ItemLocation - ContextLocation;
-				ContextToItemVec.Normalize();
-				ContextLocation += ContextOffsetVal * ContextToItemVec;
-				ItemLocation -= ItemOffsetVal * ContextToItemVec;
+				bool bHit;
+				if (FirstRequest != INDEX_NONE)
+				{
+					bHit = Hits[FirstRequest + ContextIndex];
+				}
+				else
+				{
+					// Not expected, the iterator only visits valid items, but don't score it without tracing
+					const FVector ItemLocation = GetItemLocation(QueryInstance, It.GetIndex()) + FVector(0, 0, ItemZ);
+					const FTraceRequest Req = MakeTraceRequest(ItemLocation, ContextLocations[ContextIndex], GetItemActor(QueryInstance, It.GetIndex()), ItemOffsetVal, ContextOffsetVal);
+					bHit = TraceFunc.Execute(Req.ItemLocation, Req.ContextLocation, Req.ItemActor, QueryInstance.World, TraceCollisionChannel, TraceParams, TraceExtent);
+				}
+				It.SetScore(TestPurpose, FilterType, bHit, bWantsHit);
 			}
-			
-			const bool bHit = TraceFunc.Execute(ItemLocation, ContextLocation, ItemActor, QueryInstance.World, TraceCollisionChannel, TraceParams, TraceExtent);
-			It.SetScore(TestPurpose, FilterType, bHit, bWantsHit);
 		}
 	}
 }
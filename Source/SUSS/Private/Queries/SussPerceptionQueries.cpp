@@ -1,6 +1,7 @@
 ﻿#include "Queries/SussPerceptionQueries.h"
 
 #include "SussBrainComponent.h"
+#include "SussTeamPerceptionWorldSubsystem.h"
 #include "SussUtility.h"
 #include "Perception/AISense_Damage.h"
 #include "Perception/AISense_Hearing.h"
@@ -9,12 +10,36 @@
 UE_DEFINE_GAMEPLAY_TAG_COMMENT(TAG_SussQueryPerceptionKnownTargets, "Suss.Query.Perception.Targets.AllKnown", "Query all targets known to this agent's perception system. Optional param 'Sense' to filter ('Sight', 'Hearing' etc)")
 UE_DEFINE_GAMEPLAY_TAG_COMMENT(TAG_SussQueryPerceptionKnownHostiles, "Suss.Query.Perception.Targets.HostilesKnown", "Query all hostiles known to this agent's perception system. Optional param 'Sense' to filter ('Sight', 'Hearing' etc)")
 UE_DEFINE_GAMEPLAY_TAG_COMMENT(TAG_SussQueryPerceptionKnownNonHostiles, "Suss.Query.Perception.Targets.NonHostilesKnown", "Query all non-hostiles known to this agent's perception system. Optional param 'Sense' to filter ('Sight', 'Hearing' etc)")
+UE_DEFINE_GAMEPLAY_TAG_COMMENT(TAG_SussQueryPerceptionTeamKnownHostiles, "Suss.Query.Perception.Targets.HostilesKnownToTeam", "Query all hostiles known to any agent on this agent's team. Optional param 'Sense' to filter ('Sight', 'Hearing' etc)")
 UE_DEFINE_GAMEPLAY_TAG_COMMENT(TAG_SussQueryPerceptionKnownHostilesExtended, "Suss.Query.Perception.Targets.HostilesKnown.Extended", "Query all hostiles known to this agent's perception system, return named value struct 'PerceptionInfo' of type FSussActorPerceptionInfo. Optional param 'Sense' to filter ('Sight', 'Hearing' etc)")
 
 
+namespace
+{
+	/// Collect actors from the brain's shared perception snapshot which pass a filter
+	template<typename PredicateType>
+	void GetSnapshotActors(const USussBrainComponent* Brain, TArray<AActor*>& OutActors, PredicateType&& Predicate)
+	{
+		const auto& Snapshot = Brain->GetPerceptionSnapshot();
+		OutActors.Reserve(OutActors.Num() + Snapshot.Num());
+		for (const auto& Entry : Snapshot)
+		{
+			if (Predicate(Entry))
+			{
+				if (AActor* Actor = Entry.Actor.Get())
+				{
+					OutActors.Add(Actor);
+				}
+			}
+		}
+	}
+}
+
 USussPerceptionKnownTargetsQueryProviderBase::USussPerceptionKnownTargetsQueryProviderBase()
 {
-	// Nothing to do here, not a concrete query
+	// Not a concrete query, but all perception queries are out of date when perception changes
+	bInvalidateOnPerceptionUpdated = true;
+	bInvalidateOnResultActorDestroyed = true;
 }
 
 TSubclassOf<UAISense> USussPerceptionKnownTargetsQueryProviderBase::GetSenseClass(
@@ -30,18 +55,44 @@ void USussPerceptionKnownTargetsQueryProviderBase::GetIgnoreTags(
 	USussUtility::GetIgnoreTagsFromParams(Params, OutTags);
 }
 
+void USussPerceptionKnownTargetsQueryProviderBase::AppendFilteredResults(const AActor* Self,
+	TArray<AActor*>& PerceptionResults,
+	const FGameplayTagContainer& IgnoreTags,
+	FSussQueryResultLimits& Limits,
+	TArray<TWeakObjectPtr<AActor>>& OutResults)
+{
+	if (!IgnoreTags.IsEmpty())
+	{
+		PerceptionResults.RemoveAll([&IgnoreTags](const AActor* Actor)
+		{
+			return USussUtility::ActorHasAnyTags(Actor, IgnoreTags);
+		});
+	}
+
+	// Apply limits on the raw pointers, so we only convert what we keep
+	ApplyResultLimits(Self, Limits, PerceptionResults);
+	Limits.bApplied = true;
+
+	OutResults.Reserve(OutResults.Num() + PerceptionResults.Num());
+	for (const auto Actor : PerceptionResults)
+	{
+		OutResults.Add(Actor);
+	}
+}
+
 USussPerceptionKnownTargetsQueryProvider::USussPerceptionKnownTargetsQueryProvider()
 {
 	QueryTag = TAG_SussQueryPerceptionKnownTargets;
 }
 
-void USussPerceptionKnownTargetsQueryProvider::ExecuteQuery(USussBrainComponent* Brain,
-                                                            AActor* Self,
-                                                            const TMap<FName, FSussParameter>& Params,
-                                                            const FSussContext& Context,
-                                                            TArray<TWeakObjectPtr<AActor>>& OutResults)
+void USussPerceptionKnownTargetsQueryProvider::ExecuteQueryWithLimits(USussBrainComponent* Brain,
+                                                                      AActor* Self,
+                                                                      const TMap<FName, FSussParameter>& Params,
+                                                                      const FSussContext& Context,
+                                                                      FSussQueryResultLimits& Limits,
+                                                                      TArray<TWeakObjectPtr<AActor>>& OutResults)
 {
-	if (const auto Perception = Brain->GetPerceptionComponent())
+	if (Brain->GetPerceptionComponent())
 	{
 		TArray<AActor*> PerceptionResults;
 		TSubclassOf<UAISense> SenseClass = GetSenseClass(Params);
@@ -51,22 +102,20 @@ void USussPerceptionKnownTargetsQueryProvider::ExecuteQuery(USussBrainComponent*
 		{
 			// Note that the "known" excludes forgotten actors but includes actors which are not *currently* perceived but
 			// still remembered
-			Perception->GetKnownPerceivedActors(SenseClass, PerceptionResults);
+			const FAISenseID SenseID = UAISense::GetSenseID(SenseClass);
+			GetSnapshotActors(Brain, PerceptionResults, [SenseID](const FSussPerceptionSnapshotEntry& Entry)
+			{
+				return Entry.HasKnownStimulusOfSense(SenseID);
+			});
 		}
 		else
 		{
-			Perception->GetFilteredActors([](const FActorPerceptionInfo& Info)
+			GetSnapshotActors(Brain, PerceptionResults, [](const FSussPerceptionSnapshotEntry& Entry)
 			{
-				return Info.HasAnyKnownStimulus();
-			}, PerceptionResults);
-		}
-		for (const auto Actor : PerceptionResults)
-		{
-			if (!USussUtility::ActorHasAnyTags(Actor, IgnoreTags))
-			{
-				OutResults.Add(Actor);
-			}
+				return Entry.HasAnyKnownStimulus();
+			});
 		}
+		AppendFilteredResults(Self, PerceptionResults, IgnoreTags, Limits, OutResults);
 	}
 }
 
@@ -75,13 +124,14 @@ USussPerceptionKnownHostilesQueryProvider::USussPerceptionKnownHostilesQueryProv
 	QueryTag = TAG_SussQueryPerceptionKnownHostiles;
 }
 
-void USussPerceptionKnownHostilesQueryProvider::ExecuteQuery(USussBrainComponent* Brain,
-                                                       AActor* Self,
-                                                       const TMap<FName, FSussParameter>& Params,
-                                                       const FSussContext& Context,
-                                                       TArray<TWeakObjectPtr<AActor>>& OutResults)
+void USussPerceptionKnownHostilesQueryProvider::ExecuteQueryWithLimits(USussBrainComponent* Brain,
+                                                                       AActor* Self,
+                                                                       const TMap<FName, FSussParameter>& Params,
+                                                                       const FSussContext& Context,
+                                                                       FSussQueryResultLimits& Limits,
+                                                                       TArray<TWeakObjectPtr<AActor>>& OutResults)
 {
-	if (const auto Perception = Brain->GetPerceptionComponent())
+	if (Brain->GetPerceptionComponent())
 	{
 		TArray<AActor*> PerceptionResults;
 		TSubclassOf<UAISense> SenseClass = GetSenseClass(Params);
@@ -90,20 +140,21 @@ void USussPerceptionKnownHostilesQueryProvider::ExecuteQuery(USussBrainComponent
 
 		if (SenseClass)
 		{
-			Perception->GetHostileActorsBySense(SenseClass, PerceptionResults);
+			const FAISenseID SenseID = UAISense::GetSenseID(SenseClass);
+			GetSnapshotActors(Brain, PerceptionResults, [SenseID](const FSussPerceptionSnapshotEntry& Entry)
+			{
+				return Entry.bIsHostile && Entry.HasKnownStimulusOfSense(SenseID);
+			});
 		}
 		else
 		{
-			Perception->GetHostileActors(PerceptionResults);
-		}
-
-		for (const auto Actor : PerceptionResults)
-		{
-			if (!USussUtility::ActorHasAnyTags(Actor, IgnoreTags))
+			GetSnapshotActors(Brain, PerceptionResults, [](const FSussPerceptionSnapshotEntry& Entry)
 			{
-				OutResults.Add(Actor);
-			}
+				return Entry.bIsHostile && Entry.HasAnyKnownStimulus();
+			});
 		}
+
+		AppendFilteredResults(Self, PerceptionResults, IgnoreTags, Limits, OutResults);
 	}
 }
 
@@ -112,13 +163,14 @@ USussPerceptionKnownNonHostilesQueryProvider::USussPerceptionKnownNonHostilesQue
 	QueryTag = TAG_SussQueryPerceptionKnownNonHostiles;
 }
 
-void USussPerceptionKnownNonHostilesQueryProvider::ExecuteQuery(USussBrainComponent* Brain,
+void USussPerceptionKnownNonHostilesQueryProvider::ExecuteQueryWithLimits(USussBrainComponent* Brain,
 													   AActor* Self,
 													   const TMap<FName, FSussParameter>& Params,
 													   const FSussContext& Context,
+													   FSussQueryResultLimits& Limits,
 													   TArray<TWeakObjectPtr<AActor>>& OutResults)
 {
-	if (const auto Perception = Brain->GetPerceptionComponent())
+	if (Brain->GetPerceptionComponent())
 	{
 		TArray<AActor*> PerceptionResults;
 		TSubclassOf<UAISense> SenseClass = GetSenseClass(Params);
@@ -127,39 +179,120 @@ void USussPerceptionKnownNonHostilesQueryProvider::ExecuteQuery(USussBrainCompon
 		if (SenseClass)
 		{
 			const FAISenseID SenseID = UAISense::GetSenseID(SenseClass);
-			Perception->GetFilteredActors([SenseID](const FActorPerceptionInfo& Info)
+			GetSnapshotActors(Brain, PerceptionResults, [SenseID](const FSussPerceptionSnapshotEntry& Entry)
 			{
-				return !Info.bIsHostile && Info.HasKnownStimulusOfSense(SenseID);
-			}, PerceptionResults);
+				return !Entry.bIsHostile && Entry.HasKnownStimulusOfSense(SenseID);
+			});
 		}
 		else
 		{
-			Perception->GetFilteredActors([](const FActorPerceptionInfo& Info)
+			GetSnapshotActors(Brain, PerceptionResults, [](const FSussPerceptionSnapshotEntry& Entry)
 			{
-				return !Info.bIsHostile;
-			}, PerceptionResults);
+				return !Entry.bIsHostile;
+			});
 		}
-		for (const auto Actor : PerceptionResults)
+		AppendFilteredResults(Self, PerceptionResults, IgnoreTags, Limits, OutResults);
+	}
+}
+
+USussPerceptionTeamKnownHostilesQueryProvider::USussPerceptionTeamKnownHostilesQueryProvider()
+{
+	QueryTag = TAG_SussQueryPerceptionTeamKnownHostiles;
+	// Other team members' perception changes results too, so rely on max frequency instead
+	bInvalidateOnPerceptionUpdated = false;
+}
+
+void USussPerceptionTeamKnownHostilesQueryProvider::ExecuteQueryWithLimits(USussBrainComponent* Brain,
+	AActor* Self,
+	const TMap<FName, FSussParameter>& Params,
+	const FSussContext& Context,
+	FSussQueryResultLimits& Limits,
+	TArray<TWeakObjectPtr<AActor>>& OutResults)
+{
+	TArray<AActor*> PerceptionResults;
+	TSubclassOf<UAISense> SenseClass = GetSenseClass(Params);
+	const FAISenseID SenseID = SenseClass ? UAISense::GetSenseID(SenseClass) : FAISenseID::InvalidID();
+	FGameplayTagContainer IgnoreTags;
+	GetIgnoreTags(Params, IgnoreTags);
+
+	const FGenericTeamId TeamId = USussUtility::GetTeamId(Brain->GetOwner());
+	auto TeamPerception = GetSussTeamPerceptionWorldSubsystem(Brain->GetWorld());
+	if (TeamPerception && TeamId != FGenericTeamId::NoTeam)
+	{
+		const FSussTeamPerception& Perception = TeamPerception->GetTeamPerception(TeamId);
+		PerceptionResults.Reserve(Perception.KnownHostiles.Num());
+		for (const auto& Hostile : Perception.KnownHostiles)
 		{
-			if (!USussUtility::ActorHasAnyTags(Actor, IgnoreTags))
+			if (!SenseClass || Hostile.HasKnownStimulusOfSense(SenseID))
 			{
-				OutResults.Add(Actor);
+				if (AActor* Actor = Hostile.Actor.Get())
+				{
+					PerceptionResults.Add(Actor);
+				}
 			}
 		}
 	}
+	else if (Brain->GetPerceptionComponent())
+	{
+		// No team to share with, so only our own perception
+		GetSnapshotActors(Brain, PerceptionResults, [&SenseClass, SenseID](const FSussPerceptionSnapshotEntry& Entry)
+		{
+			return Entry.bIsHostile && (SenseClass ? Entry.HasKnownStimulusOfSense(SenseID) : Entry.HasAnyKnownStimulus());
+		});
+	}
+
+	AppendFilteredResults(Self, PerceptionResults, IgnoreTags, Limits, OutResults);
 }
 
-FSussActorPerceptionInfo::FSussActorPerceptionInfo(const FActorPerceptionInfo& Info): bIsSeen(0),
+FSussActorPerceptionInfo::FSussActorPerceptionInfo(const FActorPerceptionInfo& Info, bool bCopyLastSensedStimuli): bIsSeen(0),
 	bIsHeard(0),
-	bIsHostile(Info.bIsHostile)
+	bIsHostile(0)
+{
+	Update(Info, bCopyLastSensedStimuli);
+}
+
+void FSussActorPerceptionInfo::Update(const FActorPerceptionInfo& Info, bool bCopyLastSensedStimuli)
 {
 	Target = Info.Target;
+	bIsHostile = Info.bIsHostile;
 	const FAISenseID SightID = GetDefault<UAISense_Sight>()->GetSenseID();
 	const FAISenseID HearingID = GetDefault<UAISense_Hearing>()->GetSenseID();
 	bIsSeen = Info.HasKnownStimulusOfSense(SightID);
 	bIsHeard = Info.HasKnownStimulusOfSense(HearingID);
 	LastLocation = Info.GetLastStimulusLocation();
-	LastSensedStimuli = Info.LastSensedStimuli;
+	if (bCopyLastSensedStimuli)
+	{
+		LastSensedStimuli = Info.LastSensedStimuli;
+	}
+	else
+	{
+		LastSensedStimuli.Reset();
+	}
+
+	// Only summarise senses which have registered something, the full array has a slot for every sense
+	Stimuli.Reset();
+	for (int SenseIdx = 0; SenseIdx < Info.LastSensedStimuli.Num(); ++SenseIdx)
+	{
+		const FAIStimulus& Stim = Info.LastSensedStimuli[SenseIdx];
+		if (Stim.GetAge() < FAIStimulus::NeverHappenedAge)
+		{
+			FSussStimulusSummary& Summary = Stimuli.AddDefaulted_GetRef();
+			Summary.SenseID = SenseIdx;
+			Summary.Location = Stim.StimulusLocation;
+			Summary.Age = Stim.GetAge();
+			Summary.Strength = Stim.Strength;
+			Summary.bSuccessfullySensed = Stim.WasSuccessfullySensed();
+			Summary.bExpired = Stim.IsExpired();
+		}
+	}
+}
+
+const FSussStimulusSummary* FSussActorPerceptionInfo::FindStimulus(FAISenseID SenseID) const
+{
+	return Stimuli.FindByPredicate([SenseID](const FSussStimulusSummary& Summary)
+	{
+		return Summary.SenseID == SenseID.Index;
+	});
 }
 
 FString FSussActorPerceptionInfo::ToString() const
@@ -174,6 +307,7 @@ USussPerceptionKnownHostilesExtendedQueryProvider::USussPerceptionKnownHostilesE
 	QueryTag = TAG_SussQueryPerceptionKnownHostilesExtended;
 	QueryValueName = SUSS::PerceptionInfoValueName;
 	QueryValueType = ESussContextValueType::Struct;
+	bInvalidateOnPerceptionUpdated = true;
 }
 
 TSubclassOf<UAISense> USussPerceptionKnownHostilesExtendedQueryProvider::GetSenseClass(
@@ -189,11 +323,12 @@ void USussPerceptionKnownHostilesExtendedQueryProvider::GetIgnoreTags(
 	USussUtility::GetIgnoreTagsFromParams(Params, OutTags);
 }
 
-void USussPerceptionKnownHostilesExtendedQueryProvider::ExecuteQuery(USussBrainComponent* Brain,
-                                                                     AActor* Self,
-                                                                     const TMap<FName, FSussParameter>& Params,
-                                                                     const FSussContext& Context,
-                                                                     TArray<FSussContextValue>& OutResults)
+void USussPerceptionKnownHostilesExtendedQueryProvider::ExecuteQueryWithLimits(USussBrainComponent* Brain,
+                                                                               AActor* Self,
+                                                                               const TMap<FName, FSussParameter>& Params,
+                                                                               const FSussContext& Context,
+                                                                               FSussQueryResultLimits& Limits,
+                                                                               TArray<FSussContextValue>& OutResults)
 {
 	if (const auto Perception = Brain->GetPerceptionComponent())
 	{
@@ -201,21 +336,54 @@ void USussPerceptionKnownHostilesExtendedQueryProvider::ExecuteQuery(USussBrainC
 		const FAISenseID SenseID = UAISense::GetSenseID(SenseClass);
 		FGameplayTagContainer IgnoreTags;
 		GetIgnoreTags(Params, IgnoreTags);
-		for (auto It = Perception->GetPerceptualDataConstIterator(); It; ++It)
+		TArray<const FSussPerceptionSnapshotEntry*, TInlineAllocator<32>> Candidates;
+		for (const auto& Entry : Brain->GetPerceptionSnapshot())
 		{
-			const FActorPerceptionInfo& Info = It->Value;
-
-			if (Info.bIsHostile && Info.HasAnyKnownStimulus())
+			if (Entry.bIsHostile && Entry.HasAnyKnownStimulus())
 			{
-				if (!SenseClass || Info.HasKnownStimulusOfSense(SenseID))
+				if (!SenseClass || Entry.HasKnownStimulusOfSense(SenseID))
 				{
-					if (!USussUtility::ActorHasAnyTags(Info.Target.Get(), IgnoreTags))
+					if (!USussUtility::ActorHasAnyTags(Entry.Actor.Get(), IgnoreTags))
 					{
-						OutResults.Add(FSussContextValue(MakeShared<FSussActorPerceptionInfo>(Info)));
+						Candidates.Add(&Entry);
 					}
 				}
 			}
 		}
-		
+
+		// Select before building the (relatively expensive) perception info structs
+		if (Limits.ResultSort != ESussQueryResultSort::None && IsValid(Self))
+		{
+			const FVector Origin = Self->GetActorLocation();
+			const float Sign = Limits.ResultSort == ESussQueryResultSort::NearestFirst ? 1.f : -1.f;
+			SelectResults(Candidates, Limits.MaxResults, [&Origin, Sign](const FSussPerceptionSnapshotEntry* Entry)
+			{
+				return Sign * FVector::DistSquared(Origin, Entry->LastLocation);
+			});
+		}
+		else if (Limits.MaxResults > 0 && Candidates.Num() > Limits.MaxResults)
+		{
+			Candidates.RemoveAt(Limits.MaxResults, Candidates.Num() - Limits.MaxResults);
+		}
+		Limits.bApplied = true;
+
+		// Fill the whole arena before taking pointers into it, so it doesn't reallocate underneath them
+		const TSharedPtr<FSussPerceptionInfoArena, ESPMode::NotThreadSafe> Arena = Brain->AcquirePerceptionInfoArena();
+		Arena->Infos.Reserve(Candidates.Num());
+		for (const auto Entry : Candidates)
+		{
+			const AActor* Actor = Entry->Actor.Get();
+			if (const FActorPerceptionInfo* Info = Actor ? Perception->GetActorInfo(*Actor) : nullptr)
+			{
+				Arena->AddLive().Update(*Info, false);
+			}
+		}
+
+		OutResults.Reserve(OutResults.Num() + Arena->NumLive);
+		for (int i = 0; i < Arena->NumLive; ++i)
+		{
+			// Aliases the arena's reference count, so the arena lives as long as any of its results
+			OutResults.Add(FSussContextValue(TSharedPtr<const FSussContextValueStructBase, ESPMode::NotThreadSafe>(Arena, &Arena->Infos[i])));
+		}
 	}
 }
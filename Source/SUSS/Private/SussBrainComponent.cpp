@@ -3,12 +3,15 @@
 #include "AbilitySystemComponent.h"
 #include "AbilitySystemGlobals.h"
 #include "AIController.h"
+#include "NavigationData.h"
 #include "SussAction.h"
 #include "SussBrainConfigAsset.h"
 #include "SussCommon.h"
+#include "SussDummyProviders.h"
 #include "SussGameSubsystem.h"
 #include "SussPoolSubsystem.h"
 #include "SussSettings.h"
+#include "SussTeamPerceptionWorldSubsystem.h"
 #include "SussUtility.h"
 #include "SussWorldSubsystem.h"
 #include "GameFramework/Character.h"
@@ -17,6 +20,9 @@
 #include "Perception/AIPerceptionComponent.h"
 #include "Queries/SussPerceptionQueries.h"
 
+DECLARE_DWORD_COUNTER_STAT(TEXT("SUSS Context Truncations"), STAT_SUSS_ContextTruncations, STATGROUP_SUSS);
+DECLARE_DWORD_COUNTER_STAT(TEXT("SUSS Contexts Dropped"), STAT_SUSS_ContextsDropped, STATGROUP_SUSS);
+
 
 // Sets default values for this component's properties
 USussBrainComponent::USussBrainComponent(): bQueuedForUpdate(false),
@@ -67,15 +73,28 @@ void USussBrainComponent::BeginPlay()
 	}
 
 
-	if (auto Settings = GetDefault<USussSettings>())
+	// Always listen, perception changes invalidate cached query results even if they don't trigger an update
+	if (PerceptionComp)
 	{
-		if (PerceptionComp && Settings->BrainUpdateOnPerceptionChanges)
+		PerceptionComp->OnPerceptionUpdated.AddDynamic(this, &USussBrainComponent::OnPerceptionUpdated);
+
+		if (auto TeamPerception = GetSussTeamPerceptionWorldSubsystem(GetWorld()))
 		{
-			PerceptionComp->OnPerceptionUpdated.AddDynamic(this, &USussBrainComponent::OnPerceptionUpdated);
+			TeamPerception->RegisterMember(this);
 		}
 	}
 }
 
+void USussBrainComponent::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	if (auto TeamPerception = GetSussTeamPerceptionWorldSubsystem(GetWorld()))
+	{
+		TeamPerception->UnregisterMember(this);
+	}
+
+	Super::EndPlay(EndPlayReason);
+}
+
 
 void USussBrainComponent::StartLogic()
 {
@@ -115,6 +134,17 @@ void USussBrainComponent::StartLogic()
 				}
 			}
 		}
+
+		if (!QueryInvalidationTags.IsEmpty())
+		{
+			if (auto Pawn = GetPawn())
+			{
+				if (auto ASC = UAbilitySystemGlobals::GetAbilitySystemComponentFromActor(Pawn))
+				{
+					QueryInvalidationTagDelegate = ASC->RegisterGenericGameplayTagEvent().AddUObject(this, &USussBrainComponent::OnQueryInvalidationTagEvent);
+				}
+			}
+		}
 	}
 	
 }
@@ -279,6 +309,18 @@ void USussBrainComponent::StopLogic(const FString& Reason)
 		TagDelegates.Empty();
 	}
 
+	if (QueryInvalidationTagDelegate.IsValid())
+	{
+		if (const auto Pawn = GetPawn())
+		{
+			if (const auto ASC = UAbilitySystemGlobals::GetAbilitySystemComponentFromActor(Pawn))
+			{
+				ASC->RegisterGenericGameplayTagEvent().Remove(QueryInvalidationTagDelegate);
+			}
+		}
+		QueryInvalidationTagDelegate.Reset();
+	}
+
 }
 
 void USussBrainComponent::RestartLogic()
@@ -327,6 +369,43 @@ void USussBrainComponent::InitActions()
 {
 	// Collate all the actions from referenced action sets, and actions only on this instance
 	CombinedActionsByPriority.Empty();
+	CombinedActionGroups.Empty();
+	CombinedActionGroupIndices.Empty();
+
+	auto SUSS = GetSUSS(GetWorld());
+	auto AddGroup = [this, SUSS](const FSussActionGroup& Group)
+	{
+		// Groups without queries are only ever evaluated in a Self context, so considerations which read anything
+		// else from the context would silently get default values
+		if (SUSS && Group.Queries.Num() == 0)
+		{
+			for (auto& Consideration : Group.Considerations)
+			{
+				const auto InputProvider = SUSS->GetInputProvider(Consideration.InputTag);
+				if (InputProvider && !InputProvider->IsA<USussDummyInputProvider>() && !IsSelfOnlyConsideration(Consideration, InputProvider))
+				{
+					UE_LOG(LogSuss, Warning, TEXT("Group %s has no queries, but consideration %s reads more than Self from the context, so will only be evaluated with Self. Add queries to the group, or set the input's ContextElements to Self"),
+					       *Group.Description,
+					       Consideration.Description.IsEmpty() ? *Consideration.InputTag.ToString() : *Consideration.Description);
+				}
+			}
+		}
+
+		// Keep only the shared parts of the group, action defs are combined with all the others
+		const int GroupIndex = CombinedActionGroups.Add(Group);
+		CombinedActionGroups[GroupIndex].ActionDefs.Empty();
+		for (auto& Action : Group.ActionDefs)
+		{
+			if (Group.Queries.Num() > 0 && Action.Queries.Num() > 0)
+			{
+				UE_LOG(LogSuss, Warning, TEXT("Action %s is in group %s which has queries, so the action's own queries will be ignored"),
+				       *Action.ActionTag.ToString(), *Group.Description);
+			}
+			CombinedActionsByPriority.Add(Action);
+			CombinedActionGroupIndices.Add(GroupIndex);
+		}
+	};
+	
 	for (auto ActionSet : BrainConfig.ActionSets)
 	{
 		// Guard against bad config
@@ -335,22 +414,78 @@ void USussBrainComponent::InitActions()
 			for (auto& Action : ActionSet->GetActions())
 			{
 				CombinedActionsByPriority.Add(Action);
+				CombinedActionGroupIndices.Add(INDEX_NONE);
+			}
+			for (auto& Group : ActionSet->GetActionGroups())
+			{
+				AddGroup(Group);
 			}
 		}
 	}
 	for (auto& Action : BrainConfig.ActionDefs)
 	{
 		CombinedActionsByPriority.Add(Action);
+		CombinedActionGroupIndices.Add(INDEX_NONE);
+	}
+	for (auto& Group : BrainConfig.ActionGroups)
+	{
+		AddGroup(Group);
 	}
 
-	// Sort by ascending priority
-	CombinedActionsByPriority.Sort([](const FSussActionDef& A, const FSussActionDef& B)
+	// Sort by ascending priority, keeping group indices in step
+	TArray<int> SortedIndices;
+	SortedIndices.Reserve(CombinedActionsByPriority.Num());
+	for (int i = 0; i < CombinedActionsByPriority.Num(); ++i)
 	{
-		return A.Priority < B.Priority;
+		SortedIndices.Add(i);
+	}
+	SortedIndices.StableSort([this](int A, int B)
+	{
+		return CombinedActionsByPriority[A].Priority < CombinedActionsByPriority[B].Priority;
 	});
+	TArray<FSussActionDef> SortedActions;
+	TArray<int> SortedGroupIndices;
+	SortedActions.Reserve(SortedIndices.Num());
+	SortedGroupIndices.Reserve(SortedIndices.Num());
+	for (const int Idx : SortedIndices)
+	{
+		SortedActions.Add(MoveTemp(CombinedActionsByPriority[Idx]));
+		SortedGroupIndices.Add(CombinedActionGroupIndices[Idx]);
+	}
+	CombinedActionsByPriority = MoveTemp(SortedActions);
+	CombinedActionGroupIndices = MoveTemp(SortedGroupIndices);
+
+	ActionGroupEvaluations.Reset();
+	ActionGroupEvaluations.SetNum(CombinedActionGroups.Num());
 
 	// Init history
 	ActionHistory.SetNum(CombinedActionsByPriority.Num());
+	// Cached inputs are keyed on action index so are no longer valid
+	ConsiderationInputCache.Empty();
+
+	// Collect the tags that our query providers want to invalidate cached results on
+	QueryInvalidationTags.Reset();
+	if (SUSS)
+	{
+		auto AddQueryTags = [this, SUSS](const TArray<FSussQuery>& Queries)
+		{
+			for (const auto& Query : Queries)
+			{
+				if (const auto QueryProvider = SUSS->GetQueryProvider(Query.QueryTag))
+				{
+					QueryInvalidationTags.AppendTags(QueryProvider->GetInvalidateOnTagsChanged());
+				}
+			}
+		};
+		for (const auto& Action : CombinedActionsByPriority)
+		{
+			AddQueryTags(Action.Queries);
+		}
+		for (const auto& Group : CombinedActionGroups)
+		{
+			AddQueryTags(Group.Queries);
+		}
+	}
 }
 
 ESussActionChoiceMethod USussBrainComponent::GetActionChoiceMethod(int Priority, int& OutTopN) const
@@ -375,6 +510,73 @@ void USussBrainComponent::RequestUpdate()
 	}
 }
 
+DECLARE_CYCLE_STAT(TEXT("SUSS Perception Snapshot"), STAT_SUSS_PerceptionSnapshot, STATGROUP_SUSS);
+
+const TArray<FSussPerceptionSnapshotEntry>& USussBrainComponent::GetPerceptionSnapshot() const
+{
+	if (PerceptionSnapshotFrame == GFrameCounter)
+	{
+		return PerceptionSnapshot;
+	}
+
+	SCOPE_CYCLE_COUNTER(STAT_SUSS_PerceptionSnapshot);
+
+	PerceptionSnapshotFrame = GFrameCounter;
+	PerceptionSnapshot.Reset();
+	if (IsValid(PerceptionComp))
+	{
+		for (auto It = PerceptionComp->GetPerceptualDataConstIterator(); It; ++It)
+		{
+			const FActorPerceptionInfo& Info = It->Value;
+			if (!Info.Target.IsValid())
+				continue;
+
+			FSussPerceptionSnapshotEntry& Entry = PerceptionSnapshot.AddDefaulted_GetRef();
+			Entry.Actor = Info.Target;
+			Entry.LastLocation = Info.GetLastStimulusLocation();
+			Entry.bIsHostile = Info.bIsHostile;
+			for (int SenseIdx = 0; SenseIdx < Info.LastSensedStimuli.Num() && SenseIdx < 32; ++SenseIdx)
+			{
+				const FAIStimulus& Stim = Info.LastSensedStimuli[SenseIdx];
+				if (Stim.GetAge() < FAIStimulus::NeverHappenedAge)
+				{
+					Entry.KnownSenses |= 1u << SenseIdx;
+				}
+				if (!Stim.IsValid())
+				{
+					continue;
+				}
+				if (Stim.WasSuccessfullySensed() || !Stim.IsExpired())
+				{
+					Entry.ActiveSenses |= 1u << SenseIdx;
+				}
+				if (Stim.WasSuccessfullySensed() && !Stim.IsExpired())
+				{
+					Entry.CurrentSenses |= 1u << SenseIdx;
+					Entry.Age = FMath::Min(Entry.Age, Stim.GetAge());
+				}
+			}
+		}
+	}
+
+	return PerceptionSnapshot;
+}
+
+TSharedPtr<FSussPerceptionInfoArena, ESPMode::NotThreadSafe> USussBrainComponent::AcquirePerceptionInfoArena()
+{
+	for (const auto& Arena : PerceptionInfoArenas)
+	{
+		// Only we refer to this one, so no results from it are held anywhere
+		if (Arena.GetSharedReferenceCount() == 1)
+		{
+			Arena->NumLive = 0;
+			return Arena;
+		}
+	}
+
+	return PerceptionInfoArenas.Add_GetRef(MakeShared<FSussPerceptionInfoArena, ESPMode::NotThreadSafe>());
+}
+
 void USussBrainComponent::GetPerceptionInfo(TArray<FSussActorPerceptionInfo>& OutPerceptionInfo,
                                             bool bIncludeKnownButNotCurrent,
                                             bool bHostileOnly,
@@ -384,23 +586,26 @@ void USussBrainComponent::GetPerceptionInfo(TArray<FSussActorPerceptionInfo>& Ou
 	if (IsValid(PerceptionComp))
 	{
 		const FAISenseID SenseID = SenseClass ? UAISense::GetSenseID(SenseClass) : FAISenseID::InvalidID();
-		for (auto It = PerceptionComp->GetPerceptualDataConstIterator(); It; ++It)
+		for (const auto& Entry : GetPerceptionSnapshot())
 		{
-			const FActorPerceptionInfo& Info = It->Value;
-
 			if (SenseClass)
 			{
-				if (bSenseClassInclude && !Info.HasKnownStimulusOfSense(SenseID))
+				if (bSenseClassInclude && !Entry.HasKnownStimulusOfSense(SenseID))
 					continue;
-				if (!bSenseClassInclude && Info.HasKnownStimulusOfSense(SenseID))
+				if (!bSenseClassInclude && Entry.HasKnownStimulusOfSense(SenseID))
 					continue;
 			}
-			if (bHostileOnly && !Info.bIsHostile)
+			if (bHostileOnly && !Entry.bIsHostile)
 				continue;
 			
-			if (bIncludeKnownButNotCurrent || Info.HasAnyCurrentStimulus())
+			if (bIncludeKnownButNotCurrent || Entry.HasAnyCurrentStimulus())
 			{
-				OutPerceptionInfo.Add(FSussActorPerceptionInfo(Info));
+				// Only go back to the full perception data for the entries we return
+				const AActor* Actor = Entry.Actor.Get();
+				if (const FActorPerceptionInfo* Info = Actor ? PerceptionComp->GetActorInfo(*Actor) : nullptr)
+				{
+					OutPerceptionInfo.Add(FSussActorPerceptionInfo(*Info));
+				}
 			}
 		}
 	}
@@ -422,41 +627,40 @@ FSussActorPerceptionInfo USussBrainComponent::GetMostRecentPerceptionInfo(bool&
                                                                           bool bSenseClassInclude)
 {
 	float BestAge = FAIStimulus::NeverHappenedAge;
-	const FActorPerceptionInfo* BestInfo = nullptr;
+	const FSussPerceptionSnapshotEntry* BestEntry = nullptr;
 	
 	if (IsValid(PerceptionComp))
 	{
 		const FAISenseID SenseID = SenseClass ? UAISense::GetSenseID(SenseClass) : FAISenseID::InvalidID();
-		for (auto It = PerceptionComp->GetPerceptualDataConstIterator(); It; ++It)
+		for (const auto& Entry : GetPerceptionSnapshot())
 		{
-			const FActorPerceptionInfo& Info = It->Value;
-
 			if (SenseClass)
 			{
-				if (bSenseClassInclude && !Info.HasKnownStimulusOfSense(SenseID))
+				if (bSenseClassInclude && !Entry.HasKnownStimulusOfSense(SenseID))
 					continue;
-				if (!bSenseClassInclude && Info.HasKnownStimulusOfSense(SenseID))
+				if (!bSenseClassInclude && Entry.HasKnownStimulusOfSense(SenseID))
 					continue;
 			}
-			if (bHostileOnly && !Info.bIsHostile)
+			if (bHostileOnly && !Entry.bIsHostile)
 				continue;
 
-			for (auto& Stim : Info.LastSensedStimuli)
+			// Age is already the best of this entry's current stimuli
+			if (Entry.HasAnyCurrentStimulus() && Entry.Age < BestAge)
 			{
-				if (Stim.WasSuccessfullySensed() && !Stim.IsExpired() && Stim.GetAge() < BestAge)
-				{
-					BestAge = Stim.GetAge();
-					BestInfo = &Info;
-					// Don't break, incase even better aged stimulus in this result
-				}
+				BestAge = Entry.Age;
+				BestEntry = &Entry;
 			}
 		}
-	}
 
-	if (BestInfo)
-	{
-		bIsValid = true;
-		return FSussActorPerceptionInfo(*BestInfo);
+		const AActor* BestActor = BestEntry ? BestEntry->Actor.Get() : nullptr;
+		if (BestActor)
+		{
+			if (const FActorPerceptionInfo* Info = PerceptionComp->GetActorInfo(*BestActor))
+			{
+				bIsValid = true;
+				return FSussActorPerceptionInfo(*Info);
+			}
+		}
 	}
 	bIsValid = false;
 	return FSussActorPerceptionInfo();
@@ -514,6 +718,15 @@ void USussBrainComponent::OnGameplayTagEvent(const FGameplayTag InTag, int32 New
 	}
 }
 
+void USussBrainComponent::OnQueryInvalidationTagEvent(const FGameplayTag InTag, int32 NewCount)
+{
+	// Generic event, fires for every tag added / removed
+	if (InTag.MatchesAny(QueryInvalidationTags))
+	{
+		++QueryInvalidationCounts.TagChanges;
+	}
+}
+
 void USussBrainComponent::TimerCallback()
 {
 	UpdateActionScoreAdjustments(CurrentUpdateInterval);
@@ -757,9 +970,15 @@ void USussBrainComponent::Update()
 #endif
 
 	auto SUSS = GetSUSS(GetWorld());
-	auto Pool = GetSussPool(GetWorld());
 	AActor* Self = GetSelf();
 
+	PruneConsiderationInputCache();
+	PruneScoringPaths();
+	for (auto& GroupEval : ActionGroupEvaluations)
+	{
+		GroupEval.bEvaluated = false;
+	}
+
 	const FSussActionDef* CurrentActionDef = IsActionInProgress() ? &CombinedActionsByPriority[CurrentActionResult.ActionDefIndex] : nullptr;
 	
 	int CurrentPriority = CombinedActionsByPriority[0].Priority;
@@ -804,61 +1023,107 @@ void USussBrainComponent::Update()
 		if (NextAction.BlockingTags.Num() > 0 && USussUtility::ActorHasAnyTags(GetOwner(), NextAction.BlockingTags))
 			continue;
 
+#if ENABLE_VISUAL_LOG
+		UE_VLOG(GetLogOwner(), LogSuss, Log, TEXT("Action: %s  Priority: %d Weight: %4.2f"),
+			NextAction.Description.IsEmpty() ? *NextAction.ActionTag.ToString() : *NextAction.Description,
+			NextAction.Priority,
+			NextAction.Weight);
+#endif
+
+		// Action groups are evaluated once per update, and if they score zero, none of their actions are considered
+		const int GroupIndex = CombinedActionGroupIndices[i];
+		const FSussActionGroupEvaluation* GroupEval = nullptr;
+		bool bUseGroupContexts = false;
+		if (GroupIndex != INDEX_NONE)
+		{
+			GroupEval = &EvaluateActionGroup(Self, GroupIndex);
+			if (GroupEval->Contexts.IsEmpty())
+			{
+#if ENABLE_VISUAL_LOG
+				UE_VLOG(GetLogOwner(), LogSuss, Log, TEXT(" - Skipped, action group scored zero"));
+#endif
+				continue;
+			}
+			bUseGroupContexts = CombinedActionGroups[GroupIndex].Queries.Num() > 0;
+		}
+
+		// Considerations which only read Self give the same result in every context, so evaluate them once up-front.
+		// If any of them scores zero, we can skip this action without generating any contexts
+		float SelfScore = NextAction.Weight;
+		if (GroupEval && !bUseGroupContexts)
+		{
+			// Group without queries has a single Self score
+			SelfScore *= GroupEval->Scores[0];
+		}
+		TBitArray<> SelfOnlyConsiderations(false, NextAction.Considerations.Num());
+		const FSussContext SelfContext { Self };
+		for (int c = 0; c < NextAction.Considerations.Num(); ++c)
+		{
+			const auto& Consideration = NextAction.Considerations[c];
+			const auto InputProvider = SUSS->GetInputProvider(Consideration.InputTag);
+			if (InputProvider && IsSelfOnlyConsideration(Consideration, InputProvider))
+			{
+				SelfOnlyConsiderations[c] = true;
+				SelfScore *= EvaluateConsideration(Self, i, c, Consideration, InputProvider, SelfContext);
+				if (FMath::IsNearlyZero(SelfScore))
+				{
+					break;
+				}
+			}
+		}
+		if (FMath::IsNearlyZero(SelfScore))
+		{
+#if ENABLE_VISUAL_LOG
+			UE_VLOG(GetLogOwner(), LogSuss, Log, TEXT(" - Skipped, Self considerations scored zero"));
+#endif
+			continue;
+		}
+
 		auto ArrayPool = GetSussPool(GetWorld());
 		
 		FSussScopeReservedArray ContextsScope = ArrayPool->ReserveArray<FSussContext>();
 		TArray<FSussContext>& Contexts = *ContextsScope.Get<FSussContext>();
-		GenerateContexts(Self, NextAction, Contexts);
+		if (bUseGroupContexts)
+		{
+			// Contexts come from the group, along with their partial scores
+			Contexts = GroupEval->Contexts;
+			ContextPartialScores = GroupEval->Scores;
+		}
+		else
+		{
+			GenerateContexts(Self, NextAction, Contexts);
+			ContextPartialScores.Reset();
+			ContextPartialScores.Init(1.0f, Contexts.Num());
+		}
 
 #if ENABLE_VISUAL_LOG
-		UE_VLOG(GetLogOwner(), LogSuss, Log, TEXT("Action: %s  Priority: %d Weight: %4.2f Contexts: %d"),
-			NextAction.Description.IsEmpty() ? *NextAction.ActionTag.ToString() : *NextAction.Description,
-			NextAction.Priority,
-			NextAction.Weight,
-			Contexts.Num());
+		UE_VLOG(GetLogOwner(), LogSuss, Log, TEXT(" Contexts: %d"), Contexts.Num());
 #endif
+
+		// Gate considerations are evaluated first across all contexts, and contexts which fail any gate are removed
+		// before any continuous considerations are evaluated on the survivors
+		TBitArray<> GateConsiderations(false, NextAction.Considerations.Num());
+		FilterContextsByGates(Self, i, NextAction, SelfOnlyConsiderations, GateConsiderations, Contexts);
 		
 		// Evaluate this action for every applicable context
-		for (const auto& Ctx : Contexts)
+		for (int CtxIdx = 0; CtxIdx < Contexts.Num(); ++CtxIdx)
 		{
+			const auto& Ctx = Contexts[CtxIdx];
 #if ENABLE_VISUAL_LOG
 			UE_VLOG(GetLogOwner(), LogSuss, Log, TEXT(" - %s"), *Ctx.ToString());
 #endif
-			float Score = NextAction.Weight;
-			for (const auto& Consideration : NextAction.Considerations)
+			float Score = SelfScore * ContextPartialScores[CtxIdx];
+			for (int c = 0; c < NextAction.Considerations.Num(); ++c)
 			{
+				// Already included in SelfScore or gate score
+				if (SelfOnlyConsiderations[c] || GateConsiderations[c])
+					continue;
+
+				const auto& Consideration = NextAction.Considerations[c];
 				if (const auto InputProvider = SUSS->GetInputProvider(Consideration.InputTag))
 				{
-					// Resolve parameters
-					FSussScopeReservedMap ResolvedQueryParamsScope = Pool->ReserveMap<FName, FSussParameter>();
-					TMap<FName, FSussParameter>& ResolvedParams = *ResolvedQueryParamsScope.Get<FName, FSussParameter>();
-					ResolveParameters(Self, Consideration.Parameters, ResolvedParams);
-
-					const float RawInputValue = InputProvider->Evaluate(this, Ctx, ResolvedParams);
-
-					// Normalise to bookends and clamp
-					const float NormalisedInput = FMath::Clamp(FMath::GetRangePct(
-						                                           ResolveParameter(
-							                                           Ctx,
-							                                           Consideration.BookendMin).FloatValue,
-						                                           ResolveParameter(
-							                                           Ctx,
-							                                           Consideration.BookendMax).FloatValue,
-						                                           RawInputValue),
-					                                           0.f,
-					                                           1.f);
-
-					// Transform through curve
-					const float ConScore = Consideration.EvaluateCurve(NormalisedInput);
-
-#if ENABLE_VISUAL_LOG
-					UE_VLOG(GetLogOwner(), LogSuss, Log, TEXT("  * Consideration: %s  Input: %4.2f  Normalised: %4.2f  Final: %4.2f"),
-						Consideration.Description.IsEmpty() ? *Consideration.InputTag.ToString() : *Consideration.Description,
-						RawInputValue, NormalisedInput, ConScore);
-#endif
-
 					// Accumulate with overall score
-					Score *= ConScore;
+					Score *= EvaluateConsideration(Self, i, c, Consideration, InputProvider, Ctx);
 
 					// Early-out if we've ended up at zero, nothing can change this now
 					if (FMath::IsNearlyZero(Score))
@@ -933,6 +1198,305 @@ void USussBrainComponent::Update()
 	
 }
 
+float USussBrainComponent::EvaluateConsideration(AActor* Self,
+                                                int ActionIndex,
+                                                int ConsiderationIndex,
+                                                const FSussConsideration& Consideration,
+                                                USussInputProvider* InputProvider,
+                                                const FSussContext& Ctx)
+{
+	const float RawInputValue = EvaluateConsiderationInput(Self, ActionIndex, ConsiderationIndex, Consideration, InputProvider, Ctx);
+
+	// Normalise to bookends and clamp
+	const float NormalisedInput = FMath::Clamp(FMath::GetRangePct(
+		                                           ResolveParameter(
+			                                           Ctx,
+			                                           Consideration.BookendMin).FloatValue,
+		                                           ResolveParameter(
+			                                           Ctx,
+			                                           Consideration.BookendMax).FloatValue,
+		                                           RawInputValue),
+	                                           0.f,
+	                                           1.f);
+
+	// Transform through curve
+	const float ConScore = Consideration.EvaluateCurve(NormalisedInput);
+
+#if ENABLE_VISUAL_LOG
+	UE_VLOG(GetLogOwner(), LogSuss, Log, TEXT("  * Consideration: %s  Input: %4.2f  Normalised: %4.2f  Final: %4.2f"),
+		Consideration.Description.IsEmpty() ? *Consideration.InputTag.ToString() : *Consideration.Description,
+		RawInputValue, NormalisedInput, ConScore);
+#endif
+
+	return ConScore;
+}
+
+const FSussActionGroupEvaluation& USussBrainComponent::EvaluateActionGroup(AActor* Self, int GroupIndex)
+{
+	auto& Eval = ActionGroupEvaluations[GroupIndex];
+	if (Eval.bEvaluated)
+		return Eval;
+
+	Eval.bEvaluated = true;
+	Eval.Contexts.Reset();
+	Eval.Scores.Reset();
+
+	const auto& Group = CombinedActionGroups[GroupIndex];
+	if (Group.Queries.Num() > 0)
+	{
+		GenerateContexts(Self, Group.Queries, FName(*Group.Description), 0, Eval.Contexts);
+	}
+	else
+	{
+		Eval.Contexts.Add(FSussContext { Self });
+	}
+
+#if ENABLE_VISUAL_LOG
+	UE_VLOG(GetLogOwner(), LogSuss, Log, TEXT(" Group: %s  Contexts: %d"), *Group.Description, Eval.Contexts.Num());
+#endif
+
+	// Groups don't have an action index, use negative indexes so cached inputs don't collide
+	const int GroupCacheIndex = -1 - GroupIndex;
+	auto SUSS = GetSUSS(GetWorld());
+	int OutIdx = 0;
+	for (int CtxIdx = 0; CtxIdx < Eval.Contexts.Num(); ++CtxIdx)
+	{
+		float Score = 1;
+		for (int c = 0; c < Group.Considerations.Num(); ++c)
+		{
+			const auto& Consideration = Group.Considerations[c];
+			if (const auto InputProvider = SUSS->GetInputProvider(Consideration.InputTag))
+			{
+				Score *= EvaluateConsideration(Self, GroupCacheIndex, c, Consideration, InputProvider, Eval.Contexts[CtxIdx]);
+				if (FMath::IsNearlyZero(Score))
+				{
+					break;
+				}
+			}
+		}
+
+		// Only keep contexts which scored > 0, compacting as we go
+		if (!FMath::IsNearlyZero(Score))
+		{
+			if (CtxIdx != OutIdx)
+			{
+				Eval.Contexts[OutIdx] = MoveTemp(Eval.Contexts[CtxIdx]);
+			}
+			Eval.Scores.Add(Score);
+			++OutIdx;
+		}
+	}
+	Eval.Contexts.SetNum(OutIdx, false);
+
+	return Eval;
+}
+
+void USussBrainComponent::FilterContextsByGates(AActor* Self,
+                                                int ActionIndex,
+                                                const FSussActionDef& Action,
+                                                const TBitArray<>& SelfOnlyConsiderations,
+                                                TBitArray<>& OutGateConsiderations,
+                                                TArray<FSussContext>& InOutContexts)
+{
+	// ContextPartialScores must already be initialised for each context
+	check(ContextPartialScores.Num() == InOutContexts.Num());
+
+	if (InOutContexts.IsEmpty())
+		return;
+
+	auto SUSS = GetSUSS(GetWorld());
+	TBitArray<> PassedContexts(true, InOutContexts.Num());
+	bool bAnyFailed = false;
+
+	for (int c = 0; c < Action.Considerations.Num(); ++c)
+	{
+		const auto& Consideration = Action.Considerations[c];
+		if (SelfOnlyConsiderations[c] || !Consideration.IsGate())
+			continue;
+
+		const auto InputProvider = SUSS->GetInputProvider(Consideration.InputTag);
+		if (!InputProvider)
+			continue;
+
+		OutGateConsiderations[c] = true;
+		// Only evaluate contexts which passed all previous gates
+		for (TConstSetBitIterator<> It(PassedContexts); It; ++It)
+		{
+			const int CtxIdx = It.GetIndex();
+			float& GateScore = ContextPartialScores[CtxIdx];
+			GateScore *= EvaluateConsideration(Self, ActionIndex, c, Consideration, InputProvider, InOutContexts[CtxIdx]);
+			if (FMath::IsNearlyZero(GateScore))
+			{
+				PassedContexts[CtxIdx] = false;
+				bAnyFailed = true;
+			}
+		}
+	}
+
+	if (bAnyFailed)
+	{
+		// Stable compaction of contexts & gate scores which passed
+		int OutIdx = 0;
+		for (TConstSetBitIterator<> It(PassedContexts); It; ++It, ++OutIdx)
+		{
+			const int InIdx = It.GetIndex();
+			if (InIdx != OutIdx)
+			{
+				InOutContexts[OutIdx] = MoveTemp(InOutContexts[InIdx]);
+				ContextPartialScores[OutIdx] = ContextPartialScores[InIdx];
+			}
+		}
+#if ENABLE_VISUAL_LOG
+		UE_VLOG(GetLogOwner(), LogSuss, Log, TEXT(" Gates removed %d contexts"), InOutContexts.Num() - OutIdx);
+#endif
+		InOutContexts.SetNum(OutIdx, false);
+		ContextPartialScores.SetNum(OutIdx, false);
+	}
+}
+
+bool USussBrainComponent::IsSelfOnlyConsideration(const FSussConsideration& Consideration,
+                                                  const USussInputProvider* InputProvider) const
+{
+	if (!InputProvider->IsSelfOnly())
+		return false;
+
+	// Bookends are resolved in the full context, so must also be independent of it
+	return IsSelfOnlyParameter(Consideration.BookendMin) && IsSelfOnlyParameter(Consideration.BookendMax);
+}
+
+bool USussBrainComponent::IsSelfOnlyParameter(const FSussParameter& Param) const
+{
+	if (Param.Type != ESussParamType::AutoParameter)
+		return true;
+
+	if (Param.InputOrParameterTag.MatchesTag(TAG_SussInputParentTag))
+	{
+		if (auto InputProvider = GetSUSS(GetWorld())->GetInputProvider(Param.InputOrParameterTag))
+		{
+			return InputProvider->IsSelfOnly();
+		}
+	}
+
+	// Parameter providers don't declare what they read so we have to assume the whole context
+	return false;
+}
+
+float USussBrainComponent::EvaluateConsiderationInput(AActor* Self,
+                                                     int ActionIndex,
+                                                     int ConsiderationIndex,
+                                                     const FSussConsideration& Consideration,
+                                                     USussInputProvider* InputProvider,
+                                                     const FSussContext& Ctx)
+{
+	const bool bUseCache = Consideration.MaxFrequency > 0;
+	const double Now = GetWorld()->GetTimeSeconds();
+	FSussConsiderationInputCacheKey Key;
+	if (bUseCache)
+	{
+		Key = FSussConsiderationInputCacheKey(ActionIndex, ConsiderationIndex, Ctx);
+		if (const auto pCached = ConsiderationInputCache.Find(Key))
+		{
+			if (Now < pCached->ExpiryTime)
+			{
+				return pCached->Value;
+			}
+		}
+	}
+
+	// Resolve parameters
+	auto Pool = GetSussPool(GetWorld());
+	FSussScopeReservedMap ResolvedQueryParamsScope = Pool->ReserveMap<FName, FSussParameter>();
+	TMap<FName, FSussParameter>& ResolvedParams = *ResolvedQueryParamsScope.Get<FName, FSussParameter>();
+	ResolveParameters(Self, Consideration.Parameters, ResolvedParams);
+
+	const float Value = InputProvider->Evaluate(this, Ctx, ResolvedParams);
+
+	if (bUseCache)
+	{
+		auto& Entry = ConsiderationInputCache.FindOrAdd(MoveTemp(Key));
+		Entry.Value = Value;
+		Entry.ExpiryTime = Now + Consideration.MaxFrequency;
+	}
+
+	return Value;
+}
+
+void USussBrainComponent::PruneConsiderationInputCache()
+{
+	if (ConsiderationInputCache.IsEmpty())
+		return;
+
+	// Remove expired entries so that values for contexts which no longer exist don't accumulate
+	const double Now = GetWorld()->GetTimeSeconds();
+	for (auto It = ConsiderationInputCache.CreateIterator(); It; ++It)
+	{
+		if (Now >= It.Value().ExpiryTime)
+		{
+			It.RemoveCurrent();
+		}
+	}
+}
+
+FIntVector USussBrainComponent::QuantiseScoringPathDestination(const FVector& Destination)
+{
+	const float CellSize = FMath::Max(GetDefault<USussSettings>()->PathDistanceCacheCellSize, 1.f);
+	return FIntVector(FMath::FloorToInt(Destination.X / CellSize),
+	                  FMath::FloorToInt(Destination.Y / CellSize),
+	                  FMath::FloorToInt(Destination.Z / CellSize));
+}
+
+void USussBrainComponent::RecordScoringPath(const FVector& Destination, FNavPathSharedPtr Path) const
+{
+	if (Path.IsValid() && Path->IsValid())
+	{
+		FSussScoringPath& Entry = ScoringPaths.FindOrAdd(QuantiseScoringPathDestination(Destination));
+		Entry.Destination = Destination;
+		Entry.Path = Path;
+		Entry.Time = GetWorld()->GetTimeSeconds();
+	}
+}
+
+FNavPathSharedPtr USussBrainComponent::GetScoringPathTo(const FVector& Destination, float Tolerance) const
+{
+	if (const FSussScoringPath* pEntry = ScoringPaths.Find(QuantiseScoringPathDestination(Destination)))
+	{
+		const double Now = GetWorld()->GetTimeSeconds();
+		if (Now - pEntry->Time <= MaxScoringPathAge &&
+			pEntry->Path.IsValid() &&
+			pEntry->Path->IsValid() &&
+			FVector::DistSquared(pEntry->Destination, Destination) <= FMath::Square(Tolerance))
+		{
+			// The path must still start near where we are, we may have moved since scoring. Compare in 2D since path
+			// points are on the navmesh rather than at the pawn's origin.
+			const APawn* Pawn = GetPawn();
+			const TArray<FNavPathPoint>& Points = pEntry->Path->GetPathPoints();
+			if (Pawn && Points.Num() > 0 &&
+				FVector::DistSquared2D(Points[0].Location, Pawn->GetActorLocation()) <= FMath::Square(Tolerance))
+			{
+				// Recorded paths can be shared with other agents & the path distance cache, and path following
+				// modifies the path it's given, so only ever hand out our own copy
+				return USussUtility::CopyPath(pEntry->Path);
+			}
+		}
+	}
+	return nullptr;
+}
+
+void USussBrainComponent::PruneScoringPaths()
+{
+	if (ScoringPaths.IsEmpty())
+		return;
+
+	const double Now = GetWorld()->GetTimeSeconds();
+	for (auto It = ScoringPaths.CreateIterator(); It; ++It)
+	{
+		if (Now - It.Value().Time > MaxScoringPathAge || Now < It.Value().Time)
+		{
+			It.RemoveCurrent();
+		}
+	}
+}
+
 void USussBrainComponent::ResolveParameters(AActor* Self,
 	const TMap<FName, FSussParameter>& InParams,
 	TMap<FName, FSussParameter>& OutParams)
@@ -983,17 +1547,29 @@ FSussParameter USussBrainComponent::ResolveParameter(const FSussContext& SelfCon
 }
 
 void USussBrainComponent::GenerateContexts(AActor* Self, const FSussActionDef& Action, TArray<FSussContext>& OutContexts)
+{
+	GenerateContexts(Self, Action.Queries, Action.ActionTag.GetTagName(), Action.MaxContexts, OutContexts);
+}
+
+void USussBrainComponent::GenerateContexts(AActor* Self,
+                                           const TArray<FSussQuery>& Queries,
+                                           FName DebugName,
+                                           int MaxContexts,
+                                           TArray<FSussContext>& OutContexts)
 {
 	auto SUSS = GetSUSS(GetWorld());
 
 	auto Pool = GetSussPool(GetWorld());
 
-	if (Action.Queries.Num() > 0)
+	if (Queries.Num() > 0)
 	{
+		// Seed sampling so that the same sample is taken each time if the query results haven't changed
+		const uint32 SampleSeed = MaxContexts > 0 ? HashCombine(GetTypeHash(Self ? Self->GetFName() : NAME_None), GetTypeHash(DebugName)) : 0;
+
 		TSet<ESussQueryContextElement> ContextElements;
 		TSet<FName> NamedQueryValues;
 
-		for (const auto& Query : Action.Queries)
+		for (const auto& Query : Queries)
 		{
 			auto QueryProvider = SUSS->GetQueryProvider(Query.QueryTag);
 			if (!QueryProvider)
@@ -1012,7 +1588,7 @@ void USussBrainComponent::GenerateContexts(AActor* Self, const FSussActionDef& A
 				UE_LOG(LogSuss,
 				       Warning,
 				       TEXT("Action %s has more than one query returning %s, ignoring extra one %s"),
-				       *Action.ActionTag.ToString(),
+				       *DebugName.ToString(),
 				       *StaticEnum<ESussQueryContextElement>()->GetValueAsString(Element),
 				       *Query.QueryTag.ToString())
 				continue;
@@ -1030,7 +1606,7 @@ void USussBrainComponent::GenerateContexts(AActor* Self, const FSussActionDef& A
 						UE_LOG(LogSuss,
 							   Warning,
 							   TEXT("Action %s has more than one query returning named value %s, ignoring extra one %s"),
-							   *Action.ActionTag.ToString(),
+							   *DebugName.ToString(),
 							   *ValueName.ToString(),
 							   *Query.QueryTag.ToString());
 						continue;
@@ -1045,7 +1621,7 @@ void USussBrainComponent::GenerateContexts(AActor* Self, const FSussActionDef& A
 			}
 			else
 			{
-				if (!AppendUncorrelatedContexts(Self, Query, QueryProvider, ResolvedParams, OutContexts))
+				if (!AppendUncorrelatedContexts(Self, Query, QueryProvider, ResolvedParams, MaxContexts, SampleSeed, DebugName, OutContexts))
 				{
 					// This query generated no results, therefore instead of NxM it's Nx0 == no results at all
 					OutContexts.Empty();
@@ -1054,6 +1630,22 @@ void USussBrainComponent::GenerateContexts(AActor* Self, const FSussActionDef& A
 			}
 			
 		}
+
+		// Correlated queries can still expand beyond the limit
+		if (MaxContexts > 0 && OutContexts.Num() > MaxContexts)
+		{
+			RecordContextsTruncated(DebugName, OutContexts.Num(), MaxContexts);
+			int OutIdx = 0;
+			SampleIndices(OutContexts.Num(), MaxContexts, SampleSeed, [&](int Index)
+			{
+				if (Index != OutIdx)
+				{
+					OutContexts[OutIdx] = MoveTemp(OutContexts[Index]);
+				}
+				++OutIdx;
+			});
+			OutContexts.SetNum(MaxContexts, false);
+		}
 	}
 	else
 	{
@@ -1071,89 +1663,64 @@ void USussBrainComponent::IntersectCorrelatedContexts(AActor* Self,
 {
 	// Correlated results run a query once for each existing context generated from previous queries, then combine the
 	// results with that one context, meaning that instead of C * N contexts, you get N(C1) + N(C2) + .. N(Cx) contexts
+	// The query is run for all source contexts in one batch, and the results are grouped per source context
 
 	auto Pool = GetSussPool(GetWorld());
 	const auto Element = QueryProvider->GetProvidedContextElement();
+	const TArrayView<const FSussContext> SourceContexts(InOutContexts);
 
-	int InContextCount = InOutContexts.Num();
-
-	for (int i = 0; i < InContextCount; ++i)
+	switch(Element)
 	{
-		FSussContext& SourceContext = InOutContexts[i];
-		int NumResults = 0;
-		switch(Element)
+	case ESussQueryContextElement::Target:
 		{
-		case ESussQueryContextElement::Target:
-			{
-				FSussScopeReservedArray Targets = Pool->ReserveArray<TWeakObjectPtr<AActor>>();
-				QueryProvider->GetResultsInContext<TWeakObjectPtr<AActor>>(this, Self, SourceContext, Params, *Targets.Get<TWeakObjectPtr<AActor>>());
-
-				NumResults = Targets.Get<TWeakObjectPtr<AActor>>()->Num();
-				if (NumResults > 0)
-				{
-					AppendCorrelatedContexts<TWeakObjectPtr<AActor>>(Self,
-					                                                 Targets,
-					                                                 SourceContext,
-					                                                 InOutContexts,
-					                                                 [](const TWeakObjectPtr<AActor>& Target,
-					                                                    FSussContext& Ctx)
-					                                                 {
-						                                                 Ctx.Target = Target;
-					                                                 });
-				}
-				break;
-			}
-		case ESussQueryContextElement::Location:
+			FSussScopeReservedArray Targets = Pool->ReserveArray<TWeakObjectPtr<AActor>>();
+			const auto TargetArray = Targets.Get<TWeakObjectPtr<AActor>>();
+			QueryProvider->GetResultsInContexts<TWeakObjectPtr<AActor>>(this, Self, SourceContexts, Query.MaxFrequency, Params, *TargetArray, CorrelatedResultCounts, Query.MaxResults, Query.ResultSort);
+			ExpandCorrelatedContexts<TWeakObjectPtr<AActor>>(*TargetArray,
+			                                                 CorrelatedResultCounts,
+			                                                 InOutContexts,
+			                                                 [](const TWeakObjectPtr<AActor>& Target, FSussContext& Ctx)
+			                                                 {
+				                                                 Ctx.Target = Target;
+			                                                 });
+			break;
+		}
+	case ESussQueryContextElement::Location:
+		{
+			FSussScopeReservedArray Locations = Pool->ReserveArray<FVector>();
+			const auto LocationArray = Locations.Get<FVector>();
+			QueryProvider->GetResultsInContexts<FVector>(this, Self, SourceContexts, Query.MaxFrequency, Params, *LocationArray, CorrelatedResultCounts, Query.MaxResults, Query.ResultSort);
+			ExpandCorrelatedContexts<FVector>(*LocationArray,
+			                                  CorrelatedResultCounts,
+			                                  InOutContexts,
+			                                  [](const FVector& Location, FSussContext& Ctx)
+			                                  {
+				                                  Ctx.Location = Location;
+			                                  });
+			break;
+		}
+	case ESussQueryContextElement::NamedValue:
+		{
+			if (auto NQP = Cast<USussNamedValueQueryProvider>(QueryProvider))
 			{
-				FSussScopeReservedArray Targets = Pool->ReserveArray<FVector>();
-				QueryProvider->GetResultsInContext<FVector>(this, Self, SourceContext, Params, *Targets.Get<FVector>());
-
-				NumResults = Targets.Get<FVector>()->Num();
-				if (NumResults > 0)
-				{
-					AppendCorrelatedContexts<FVector>(Self,
-													  Targets,
-													  SourceContext,
-													  InOutContexts,
-													  [](const FVector& Location, FSussContext& Ctx)
-													  {
-														  Ctx.Location = Location;
-													  });
-				}
-				break;
+				const FName ValueName = NQP->GetQueryValueName();
+				FSussScopeReservedArray NamedValues = Pool->ReserveArray<FSussContextValue>();
+				const auto ValArray = NamedValues.Get<FSussContextValue>();
+				QueryProvider->GetResultsInContexts<FSussContextValue>(this, Self, SourceContexts, Query.MaxFrequency, Params, *ValArray, CorrelatedResultCounts, Query.MaxResults, Query.ResultSort);
+				ExpandCorrelatedContexts<FSussContextValue>(*ValArray,
+				                                            CorrelatedResultCounts,
+				                                            InOutContexts,
+				                                            [ValueName](const FSussContextValue& Value, FSussContext& Ctx)
+				                                            {
+					                                            Ctx.NamedValues.Add(ValueName, Value);
+				                                            });
 			}
-		case ESussQueryContextElement::NamedValue:
+			else
 			{
-				if (auto NQP = Cast<USussNamedValueQueryProvider>(QueryProvider))
-				{
-					const FName ValueName = NQP->GetQueryValueName();
-					FSussScopeReservedArray NamedValues = Pool->ReserveArray<FSussContextValue>();
-					QueryProvider->GetResultsInContext<FSussContextValue>(this, Self, SourceContext, Params, *NamedValues.Get<FSussContextValue>());
-					NumResults = NamedValues.Get<FSussContextValue>()->Num();
-					if (NumResults > 0)
-					{
-						AppendCorrelatedContexts<FSussContextValue>(Self,
-																	NamedValues,
-																	SourceContext,
-																	InOutContexts,
-																	[ValueName](const FSussContextValue& Value,
-																				FSussContext& Ctx)
-																	{
-																		Ctx.NamedValues.Add(ValueName, Value);
-																	});
-					}
-				}
-				break;
+				// Not a valid named value provider, so no results for any context
+				InOutContexts.Empty();
 			}
-		}
-
-		if (NumResults == 0)
-		{
-			// Correlated queries require results from BOTH (intersection). If this query didn't return any
-			// results, it means that we must remove this incoming context because it's not valid
-			InOutContexts.RemoveAt(i);
-			--i;
-			--InContextCount;
+			break;
 		}
 	}
 }
@@ -1162,45 +1729,54 @@ bool USussBrainComponent::AppendUncorrelatedContexts(AActor* Self,
                                                      const FSussQuery& Query,
                                                      USussQueryProvider* QueryProvider,
                                                      const TMap<FName, FSussParameter>& Params,
+                                                     int MaxContexts,
+                                                     uint32 SampleSeed,
+                                                     FName DebugName,
                                                      TArray<FSussContext>& OutContexts)
 {
 	// Uncorrelated results run a query once, and combine the results in every combination with any existing
 
-	auto Pool = GetSussPool(GetWorld());
+	// Cached results are immutable, so we expand directly from a snapshot of them rather than taking a copy
+	const FSussQueryResultsSnapshot Snapshot = QueryProvider->GetResultsSnapshot(this,
+		Self,
+		Query.MaxFrequency,
+		Params,
+		Query.MaxResults,
+		Query.ResultSort);
 	const auto Element = QueryProvider->GetProvidedContextElement();
-	bool bAnyResults = false;
+	const int OldNum = FMath::Max(OutContexts.Num(), 1);
+	int NumResults = 0;
+	bool bTruncated = false;
 	switch (Element)
 	{
 	case ESussQueryContextElement::Target:
 		{
-			FSussScopeReservedArray Targets = Pool->ReserveArray<TWeakObjectPtr<AActor>>();
-			const auto TargetArray = Targets.Get<TWeakObjectPtr<AActor>>();
-			TargetArray->Append(
-				QueryProvider->GetResults<TWeakObjectPtr<AActor>>(this, Self, Query.MaxFrequency, Params));
-			AppendUncorrelatedContexts<TWeakObjectPtr<AActor>>(Self,
-			                                       Targets,
+			const auto& TargetArray = Snapshot.Get<TWeakObjectPtr<AActor>>();
+			bTruncated = AppendUncorrelatedContexts<TWeakObjectPtr<AActor>>(Self,
+			                                       TargetArray,
 			                                       OutContexts,
 			                                       [](const TWeakObjectPtr<AActor>& Target, FSussContext& Ctx)
 			                                       {
 				                                       Ctx.Target = Target;
-			                                       });
-			bAnyResults = TargetArray->Num() > 0;
+			                                       },
+			                                       MaxContexts,
+			                                       SampleSeed);
+			NumResults = TargetArray.Num();
 			break;
 		}
 	case ESussQueryContextElement::Location:
 		{
-			FSussScopeReservedArray Locations = Pool->ReserveArray<FVector>();
-			const auto LocationArray = Locations.Get<FVector>();
-			LocationArray->Append(
-				QueryProvider->GetResults<FVector>(this, Self, Query.MaxFrequency, Params));
-			AppendUncorrelatedContexts<FVector>(Self,
-			                        Locations,
+			const auto& LocationArray = Snapshot.Get<FVector>();
+			bTruncated = AppendUncorrelatedContexts<FVector>(Self,
+			                        LocationArray,
 			                        OutContexts,
 			                        [](const FVector& Loc, FSussContext& Ctx)
 			                        {
 				                        Ctx.Location = Loc;
-			                        });
-			bAnyResults = LocationArray->Num() > 0;
+			                        },
+			                        MaxContexts,
+			                        SampleSeed);
+			NumResults = LocationArray.Num();
 			break;
 		}
 	case ESussQueryContextElement::NamedValue:
@@ -1208,24 +1784,38 @@ bool USussBrainComponent::AppendUncorrelatedContexts(AActor* Self,
 			if (auto NQP = Cast<USussNamedValueQueryProvider>(QueryProvider))
 			{
 				const FName ValueName = NQP->GetQueryValueName();
-				FSussScopeReservedArray NamedValues = Pool->ReserveArray<FSussContextValue>();
-				const auto ValArray = NamedValues.Get<FSussContextValue>();
-				ValArray->Append(
-					QueryProvider->GetResults<FSussContextValue>(this, Self, Query.MaxFrequency, Params));
-				AppendUncorrelatedContexts<FSussContextValue>(Self,
-				                                  NamedValues,
+				const auto& ValArray = Snapshot.Get<FSussContextValue>();
+				bTruncated = AppendUncorrelatedContexts<FSussContextValue>(Self,
+				                                  ValArray,
 				                                  OutContexts,
 				                                  [ValueName](const FSussContextValue& Value, FSussContext& Ctx)
 				                                  {
 					                                  Ctx.NamedValues.Add(ValueName, Value);
-				                                  });
-				bAnyResults = ValArray->Num() > 0;
+				                                  },
+				                                  MaxContexts,
+				                                  SampleSeed);
+				NumResults = ValArray.Num();
 			}
 			break;
 		}
 	}
 
-	return bAnyResults;
+	if (bTruncated)
+	{
+		RecordContextsTruncated(DebugName, OldNum * NumResults, MaxContexts);
+	}
+
+	return NumResults > 0;
+}
+
+void USussBrainComponent::RecordContextsTruncated(FName DebugName, int Requested, int Kept)
+{
+	INC_DWORD_STAT(STAT_SUSS_ContextTruncations);
+	INC_DWORD_STAT_BY(STAT_SUSS_ContextsDropped, Requested - Kept);
+
+#if ENABLE_VISUAL_LOG
+	UE_VLOG(GetLogOwner(), LogSuss, Log, TEXT(" %s generated %d contexts, sampled down to MaxContexts %d"), *DebugName.ToString(), Requested, Kept);
+#endif
 }
 
 bool USussBrainComponent::IsActionSameAsCurrent(int NewActionIndex,
@@ -1370,7 +1960,17 @@ double USussBrainComponent::GetTimeSinceActionPerformed(FGameplayTag ActionTag)
 
 void USussBrainComponent::OnPerceptionUpdated(const TArray<AActor*>& Actors)
 {
-	if (DistanceCategory != ESussDistanceCategory::OutOfRange)
+	++QueryInvalidationCounts.PerceptionUpdates;
+	// Rebuild the perception snapshot next time it's needed, even within this frame
+	PerceptionSnapshotFrame = MAX_uint64;
+
+	if (auto TeamPerception = GetSussTeamPerceptionWorldSubsystem(GetWorld()))
+	{
+		TeamPerception->OnMemberPerceptionUpdated(this);
+	}
+
+	const auto Settings = GetDefault<USussSettings>();
+	if (Settings && Settings->BrainUpdateOnPerceptionChanges && DistanceCategory != ESussDistanceCategory::OutOfRange)
 	{
 		QueueForUpdate();
 	}
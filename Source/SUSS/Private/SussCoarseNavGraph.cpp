@@ -0,0 +1,249 @@
+﻿
+#include "SussCoarseNavGraph.h"
+
+#include "SussCommon.h"
+
+DECLARE_CYCLE_STAT(TEXT("SUSS Coarse Nav Graph Search"), STAT_SUSS_CoarseNavGraphSearch, STATGROUP_SUSS);
+DECLARE_DWORD_COUNTER_STAT(TEXT("SUSS Coarse Nav Graph Nodes Built"), STAT_SUSS_CoarseNavGraphNodesBuilt, STATGROUP_SUSS);
+DECLARE_DWORD_COUNTER_STAT(TEXT("SUSS Coarse Nav Graph Searches Deferred"), STAT_SUSS_CoarseNavGraphSearchesDeferred, STATGROUP_SUSS);
+
+/// Navmesh queries needed to build the links of a node in the worst case: projecting & raycasting to 26 neighbours
+static constexpr int SussCoarseNavGraphQueriesPerNode = 52;
+
+FSussCoarseNavGraph::FSussCoarseNavGraph(const ANavigationData* InNavData,
+                                         FSharedConstNavQueryFilter InFilter,
+                                         float InCellSize,
+                                         float InMaxSearchDistance,
+                                         int InMaxNavQueriesPerFrame)
+	: NavData(InNavData),
+	  Filter(InFilter),
+	  CellSize(FMath::Max(InCellSize, 1.f)),
+	  MaxSearchDistance(InMaxSearchDistance),
+	  MaxNavQueriesPerFrame(InMaxNavQueriesPerFrame)
+{
+}
+
+void FSussCoarseNavGraph::Reset()
+{
+	Nodes.Reset();
+	CellNodes.Reset();
+	DistanceFields.Empty();
+	IncompleteSearches.Reset();
+}
+
+void FSussCoarseNavGraph::RefreshBuildBudget()
+{
+	if (NavQueriesFrame != GFrameCounter)
+	{
+		NavQueriesFrame = GFrameCounter;
+		NavQueriesThisFrame = 0;
+	}
+}
+
+void FSussCoarseNavGraph::ConsumeBuildBudget(int NavQueries)
+{
+	RefreshBuildBudget();
+	NavQueriesThisFrame += NavQueries;
+}
+
+bool FSussCoarseNavGraph::HasBuildBudget()
+{
+	RefreshBuildBudget();
+	return MaxNavQueriesPerFrame <= 0 || NavQueriesThisFrame + SussCoarseNavGraphQueriesPerNode <= MaxNavQueriesPerFrame;
+}
+
+FIntVector FSussCoarseNavGraph::GetCell(const FVector& Location) const
+{
+	return FIntVector(FMath::FloorToInt(Location.X / CellSize),
+	                  FMath::FloorToInt(Location.Y / CellSize),
+	                  FMath::FloorToInt(Location.Z / CellSize));
+}
+
+int32 FSussCoarseNavGraph::GetNode(const FIntVector& Cell)
+{
+	if (const int32* pIndex = CellNodes.Find(Cell))
+	{
+		return *pIndex;
+	}
+
+	INC_DWORD_STAT(STAT_SUSS_CoarseNavGraphNodesBuilt);
+
+	const int32 Index = Nodes.AddDefaulted();
+	CellNodes.Add(Cell, Index);
+	FNode& Node = Nodes[Index];
+	Node.Cell = Cell;
+
+	// Project the centre of the cell, limited to the cell itself so that nodes don't overlap
+	const FVector Centre = (FVector(Cell) + FVector(0.5f)) * CellSize;
+	FNavLocation NavLoc;
+	ConsumeBuildBudget(1);
+	if (NavData.IsValid() && NavData->ProjectPoint(Centre, NavLoc, FVector(CellSize * 0.5f), Filter))
+	{
+		Node.Location = NavLoc.Location;
+		Node.bOnNavMesh = true;
+	}
+
+	return Index;
+}
+
+void FSussCoarseNavGraph::BuildLinks(int32 NodeIndex)
+{
+	const FIntVector Cell = Nodes[NodeIndex].Cell;
+	Nodes[NodeIndex].bLinksBuilt = true;
+
+	for (int Z = -1; Z <= 1; ++Z)
+	{
+		for (int Y = -1; Y <= 1; ++Y)
+		{
+			for (int X = -1; X <= 1; ++X)
+			{
+				if (X == 0 && Y == 0 && Z == 0)
+					continue;
+
+				// May reallocate Nodes, so don't hold references across this
+				const int32 Neighbour = GetNode(Cell + FIntVector(X, Y, Z));
+				if (!Nodes[Neighbour].bOnNavMesh)
+					continue;
+
+				const FVector Start = Nodes[NodeIndex].Location;
+				const FVector End = Nodes[Neighbour].Location;
+				FVector HitLocation;
+				ConsumeBuildBudget(1);
+				if (!NavData->Raycast(Start, End, HitLocation, Filter))
+				{
+					Nodes[NodeIndex].Links.Add(TPair<int32, float>(Neighbour, FVector::Distance(Start, End)));
+				}
+			}
+		}
+	}
+}
+
+const FSussCoarseNavGraph::FDistanceField& FSussCoarseNavGraph::GetDistanceField(int32 StartNode)
+{
+	FDistanceField* pField = DistanceFields.Find(StartNode);
+	if (!pField)
+	{
+		DistanceFields.EnforceLimits(MaxDistanceFields - 1, 0);
+		pField = &DistanceFields.Add(StartNode);
+		pField->Open.HeapPush(FOpenNode { StartNode, 0 });
+		IncompleteSearches.Add(StartNode);
+	}
+
+	if (!pField->bComplete)
+	{
+		ContinueSearch(*pField);
+	}
+	return *pField;
+}
+
+void FSussCoarseNavGraph::ContinueSearch(FDistanceField& Field)
+{
+	SCOPE_CYCLE_COUNTER(STAT_SUSS_CoarseNavGraphSearch);
+
+	while (Field.Open.Num() > 0)
+	{
+		const FOpenNode& Top = Field.Open.HeapTop();
+		if (Field.Distances.Contains(Top.Node))
+		{
+			Field.Open.HeapPopDiscard(false);
+			continue;
+		}
+
+		if (Top.Distance > MaxSearchDistance || Field.Distances.Num() >= MaxSearchNodes)
+		{
+			Field.Open.Empty();
+			break;
+		}
+
+		// Stop before building more of the graph than the budget allows, the search carries on from here later
+		if (!Nodes[Top.Node].bLinksBuilt && !HasBuildBudget())
+		{
+			INC_DWORD_STAT(STAT_SUSS_CoarseNavGraphSearchesDeferred);
+			return;
+		}
+
+		FOpenNode Current;
+		Field.Open.HeapPop(Current, false);
+		Field.Distances.Add(Current.Node, Current.Distance);
+
+		if (!Nodes[Current.Node].bLinksBuilt)
+		{
+			BuildLinks(Current.Node);
+		}
+		for (const auto& Link : Nodes[Current.Node].Links)
+		{
+			if (!Field.Distances.Contains(Link.Key))
+			{
+				Field.Open.HeapPush(FOpenNode { Link.Key, Current.Distance + Link.Value });
+			}
+		}
+	}
+
+	Field.bComplete = true;
+	Field.Open.Empty();
+}
+
+void FSussCoarseNavGraph::ContinueSearches()
+{
+	if (!NavData.IsValid())
+	{
+		return;
+	}
+
+	for (int i = 0; i < IncompleteSearches.Num() && HasBuildBudget(); ++i)
+	{
+		FDistanceField* pField = DistanceFields.FindNoTouch(IncompleteSearches[i]);
+		if (pField && !pField->bComplete)
+		{
+			ContinueSearch(*pField);
+		}
+		// Evicted fields are gone, so there's nothing to continue
+		if (!pField || pField->bComplete)
+		{
+			IncompleteSearches.RemoveAt(i--, 1, false);
+		}
+	}
+}
+
+bool FSussCoarseNavGraph::EstimateDistance(const FVector& FromLocation, const FVector& ToLocation, float& OutDistance)
+{
+	if (!NavData.IsValid())
+	{
+		return false;
+	}
+
+	if (Nodes.Num() > MaxNodes)
+	{
+		Reset();
+	}
+
+	const int32 StartNode = GetNode(GetCell(FromLocation));
+	const int32 EndNode = GetNode(GetCell(ToLocation));
+	if (!Nodes[StartNode].bOnNavMesh || !Nodes[EndNode].bOnNavMesh)
+	{
+		return false;
+	}
+
+	const float StraightDistance = FVector::Distance(FromLocation, ToLocation);
+	if (StartNode == EndNode)
+	{
+		OutDistance = StraightDistance;
+		return true;
+	}
+
+	const FDistanceField& Field = GetDistanceField(StartNode);
+	if (const float* pDist = Field.Distances.Find(EndNode))
+	{
+		// Graph distance is between node locations, add the legs from & to the actual locations. The path can never be
+		// shorter than a straight line.
+		const float Estimate = FVector::Distance(FromLocation, Nodes[StartNode].Location) +
+			*pDist +
+			FVector::Distance(Nodes[EndNode].Location, ToLocation);
+		OutDistance = FMath::Max(Estimate, StraightDistance);
+		return true;
+	}
+
+	// Either the search hasn't got here yet, it's not within range, or the coarse graph isn't connected here (e.g. a
+	// narrow gap between cells). The coarse graph can't prove that a location is unreachable, so don't guess.
+	return false;
+}
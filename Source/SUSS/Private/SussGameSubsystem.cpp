@@ -133,6 +133,8 @@ void USussGameSubsystem::RegisterNativeProviders()
 	RegisterInputProviderClass(USussLocationDistance2DInputProvider::StaticClass());
 	RegisterInputProviderClass(USussTargetDistancePathInputProvider::StaticClass());
 	RegisterInputProviderClass(USussLocationDistancePathInputProvider::StaticClass());
+	RegisterInputProviderClass(USussTargetDistancePathApproxInputProvider::StaticClass());
+	RegisterInputProviderClass(USussLocationDistancePathApproxInputProvider::StaticClass());
 	RegisterInputProviderClass(USussSelfSightRangeInputProvider::StaticClass());
 	RegisterInputProviderClass(USussSelfHearingRangeInputProvider::StaticClass());
 	RegisterInputProviderClass(USussLineOfSightToTargetInputProvider::StaticClass());
@@ -146,6 +148,7 @@ void USussGameSubsystem::RegisterNativeProviders()
 	RegisterQueryProviderClass(USussPerceptionKnownHostilesQueryProvider::StaticClass());
 	RegisterQueryProviderClass(USussPerceptionKnownNonHostilesQueryProvider::StaticClass());
 	RegisterQueryProviderClass(USussPerceptionKnownHostilesExtendedQueryProvider::StaticClass());
+	RegisterQueryProviderClass(USussPerceptionTeamKnownHostilesQueryProvider::StaticClass());
 
 }
 
@@ -259,6 +262,36 @@ void USussGameSubsystem::RegisterInputProviderClass(TSubclassOf<USussInputProvid
 	RegisterInputProvider(CDO);
 }
 
+void USussGameSubsystem::UnregisterInputProvider(USussInputProvider* Provider)
+{
+	const auto Tag = Provider->GetInputTag();
+	if (Tag.IsValid())
+	{
+		if (auto pExisting = InputProviders.Find(Tag))
+		{
+			if (*pExisting == Provider)
+			{
+				InputProviders.Remove(Tag);
+				return;
+			}
+		}
+	}
+
+	UE_LOG(LogSuss, Warning, TEXT("Possibly bad call to UnregisterInputProvider, %s was not registered"), *Provider->GetName());
+
+}
+
+void USussGameSubsystem::UnregisterInputProviderClass(TSubclassOf<USussInputProvider> ProviderClass)
+{
+	const auto CDO = ProviderClass.GetDefaultObject();
+
+	if (!CDO)
+	{
+		UE_LOG(LogSuss, Error, TEXT("Bad call to UnregisterInputProvider, invalid class %s (no CDO)"), *ProviderClass->GetName())
+	}
+	UnregisterInputProvider(CDO);
+}
+
 USussInputProvider* USussGameSubsystem::GetInputProvider(const FGameplayTag& Tag)
 {
 	if (auto pProvider = InputProviders.Find(Tag))
@@ -453,7 +486,7 @@ UWorld* USussGameSubsystem::GetTickableGameObjectWorld() const
 
 void USussGameSubsystem::Tick(float DeltaTime)
 {
-	// Tick the queries so they know when to invalidate results
+	// Tick the queries so they know when results expire, and can gradually evict unused results
 	for (auto& Pair : QueryProviders)
 	{
 		Pair.Value->Tick(DeltaTime);
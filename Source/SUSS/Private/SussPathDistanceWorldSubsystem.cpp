@@ -0,0 +1,368 @@
+﻿
+#include "SussPathDistanceWorldSubsystem.h"
+
+#include "AIController.h"
+#include "NavigationSystem.h"
+#include "SussCommon.h"
+#include "SussSettings.h"
+#include "SussUtility.h"
+
+DECLARE_CYCLE_STAT(TEXT("SUSS Path Distance"), STAT_SUSS_PathDistance, STATGROUP_SUSS);
+DECLARE_DWORD_COUNTER_STAT(TEXT("SUSS Path Distance Path Finds"), STAT_SUSS_PathDistancePathFinds, STATGROUP_SUSS);
+
+USussPathDistanceWorldSubsystem::USussPathDistanceWorldSubsystem()
+{
+	if (const auto Settings = GetDefault<USussSettings>())
+	{
+		CacheLifetime = Settings->PathDistanceCacheLifetime;
+		CacheCellSize = Settings->PathDistanceCacheCellSize;
+		bAsyncPathFinding = Settings->AsyncPathDistance;
+		ApproxCellSize = Settings->ApproxPathDistanceCellSize;
+		ApproxMaxSearchDistance = Settings->ApproxPathDistanceMaxSearchDistance;
+		ApproxMaxNavQueriesPerFrame = Settings->ApproxPathDistanceMaxNavQueriesPerFrame;
+	}
+}
+
+void USussPathDistanceWorldSubsystem::OnWorldBeginPlay(UWorld& InWorld)
+{
+	Super::OnWorldBeginPlay(InWorld);
+
+	if (UNavigationSystemV1* NavSys = FNavigationSystem::GetCurrent<UNavigationSystemV1>(&InWorld))
+	{
+		NavSys->OnNavigationGenerationFinishedDelegate.AddUniqueDynamic(this, &USussPathDistanceWorldSubsystem::OnNavigationGenerationFinished);
+	}
+}
+
+void USussPathDistanceWorldSubsystem::OnNavigationGenerationFinished(ANavigationData* NavData)
+{
+	// Coarse graphs were built on the old navmesh
+	for (auto& Pair : CoarseGraphs)
+	{
+		if (Pair.Key.Key == TObjectKey<ANavigationData>(NavData))
+		{
+			Pair.Value->Reset();
+		}
+	}
+}
+
+bool USussPathDistanceWorldSubsystem::DoesSupportWorldType(const EWorldType::Type WorldType) const
+{
+	return WorldType == EWorldType::Game || WorldType == EWorldType::PIE;
+}
+
+TStatId USussPathDistanceWorldSubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(USussPathDistanceWorldSubsystem, STATGROUP_Tickables);
+}
+
+void USussPathDistanceWorldSubsystem::Tick(float DeltaTime)
+{
+	const double Now = GetWorld()->GetTimeSeconds();
+	CachedDistances.EvictUnused(MaxCacheEvictionChecksPerTick, [this, Now](const FSussCachedPathDistance& Entry)
+	{
+		return Now - Entry.LastUsedTime > UnusedCacheEntryLifetime;
+	});
+	CachedDistances.EnforceLimits(MaxCacheEntries, 0);
+
+	// Carry on building coarse graphs with any budget which scoring didn't use this frame
+	for (auto& Pair : CoarseGraphs)
+	{
+		Pair.Value->ContinueSearches();
+	}
+}
+
+FIntVector USussPathDistanceWorldSubsystem::QuantiseLocation(const FVector& Location) const
+{
+	const float CellSize = FMath::Max(CacheCellSize, 1.f);
+	return FIntVector(FMath::FloorToInt(Location.X / CellSize),
+	                  FMath::FloorToInt(Location.Y / CellSize),
+	                  FMath::FloorToInt(Location.Z / CellSize));
+}
+
+float USussPathDistanceWorldSubsystem::GetPathDistance(AAIController* Agent,
+	const FVector& FromLocation,
+	const FVector& ToLocation,
+	bool bAllowPartialPath,
+	FNavPathSharedPtr* OutPath)
+{
+	SCOPE_CYCLE_COUNTER(STAT_SUSS_PathDistance);
+
+	if (!Agent)
+	{
+		return BIG_NUMBER;
+	}
+
+	if (CacheLifetime <= 0)
+	{
+		INC_DWORD_STAT(STAT_SUSS_PathDistancePathFinds);
+		const FNavPathSharedPtr Path = USussUtility::FindPathFromTo(Agent, FromLocation, ToLocation, bAllowPartialPath);
+		if (OutPath)
+		{
+			*OutPath = Path;
+		}
+		return Path.IsValid() ? Path->GetLength() : BIG_NUMBER;
+	}
+
+	const ANavigationData* NavData = USussUtility::GetNavDataForAgent(Agent);
+	if (!NavData)
+	{
+		return BIG_NUMBER;
+	}
+
+	const double Now = GetWorld()->GetTimeSeconds();
+	const FSussPathDistanceKey Key(NavData,
+	                               Agent->GetDefaultNavigationFilterClass().Get(),
+	                               QuantiseLocation(FromLocation),
+	                               QuantiseLocation(ToLocation),
+	                               bAllowPartialPath);
+
+	FSussCachedPathDistance* pEntry = CachedDistances.Find(Key);
+	if (!pEntry)
+	{
+		pEntry = &CachedDistances.Add(Key);
+		pEntry->Distance = FVector::Distance(FromLocation, ToLocation) * EstimatedPathDistanceScale;
+	}
+	else if (pEntry->bHasResult && Now - pEntry->Time <= CacheLifetime && Now >= pEntry->Time)
+	{
+		pEntry->LastUsedTime = Now;
+		if (OutPath)
+		{
+			*OutPath = pEntry->Path;
+		}
+		return pEntry->Distance;
+	}
+
+	pEntry->LastUsedTime = Now;
+	// Assume a path find that's taking far too long has been lost, rather than waiting forever
+	const bool bPending = pEntry->bPending && Now - pEntry->PendingTime <= PendingPathFindTimeout && Now >= pEntry->PendingTime;
+	if (!bPending)
+	{
+		RequestPathFind(Key, *pEntry, Agent, NavData, FromLocation, ToLocation, Now);
+	}
+
+	if (OutPath)
+	{
+		*OutPath = pEntry->Path;
+	}
+	return pEntry->Distance;
+}
+
+void USussPathDistanceWorldSubsystem::RequestPathFind(const FSussPathDistanceKey& Key,
+	FSussCachedPathDistance& Entry,
+	AAIController* Agent,
+	const ANavigationData* NavData,
+	const FVector& FromLocation,
+	const FVector& ToLocation,
+	double Now)
+{
+	UNavigationSystemV1* NavSys = FNavigationSystem::GetCurrent<UNavigationSystemV1>(GetWorld());
+	if (!NavSys)
+	{
+		return;
+	}
+
+	INC_DWORD_STAT(STAT_SUSS_PathDistancePathFinds);
+
+	FSharedConstNavQueryFilter NavFilter = UNavigationQueryFilter::GetQueryFilter(*NavData, Agent->GetDefaultNavigationFilterClass());
+	FPathFindingQuery Query(Agent, *NavData, FromLocation, ToLocation, NavFilter);
+	Query.SetAllowPartialPaths(Key.bAllowPartialPath);
+
+	if (bAsyncPathFinding)
+	{
+		const INavAgentInterface* NavAgent = Cast<INavAgentInterface>(Agent);
+		const FNavAgentProperties& AgentProps = NavAgent ? NavAgent->GetNavAgentPropertiesRef() : FNavAgentProperties::DefaultProperties;
+		Entry.PendingQueryID = NavSys->FindPathAsync(AgentProps,
+		                                             Query,
+		                                             FNavPathQueryDelegate::CreateUObject(this, &USussPathDistanceWorldSubsystem::OnPathFound, Key),
+		                                             EPathFindingMode::Regular);
+		Entry.PendingTime = Now;
+		Entry.bPending = true;
+	}
+	else
+	{
+		const FPathFindingResult Result = NavSys->FindPathSync(Query);
+		Entry.Path = Result.IsSuccessful() ? Result.Path : nullptr;
+		Entry.Distance = Entry.Path.IsValid() ? Entry.Path->GetLength() : BIG_NUMBER;
+		Entry.Time = Now;
+		Entry.bHasResult = true;
+		Entry.bPending = false;
+	}
+}
+
+void USussPathDistanceWorldSubsystem::OnPathFound(uint32 QueryID,
+	ENavigationQueryResult::Type Result,
+	FNavPathSharedPtr Path,
+	FSussPathDistanceKey Key)
+{
+	if (FSussCachedPathDistance* pEntry = CachedDistances.FindNoTouch(Key))
+	{
+		// Ignore results of path finds which were superseded
+		if (pEntry->bPending && pEntry->PendingQueryID == QueryID)
+		{
+			pEntry->Path = (Result == ENavigationQueryResult::Success) ? Path : nullptr;
+			pEntry->Distance = pEntry->Path.IsValid() ? pEntry->Path->GetLength() : BIG_NUMBER;
+			pEntry->Time = pEntry->PendingTime;
+			pEntry->bHasResult = true;
+			pEntry->bPending = false;
+		}
+	}
+}
+
+DECLARE_CYCLE_STAT(TEXT("SUSS Approx Path Distance"), STAT_SUSS_ApproxPathDistance, STATGROUP_SUSS);
+
+float USussPathDistanceWorldSubsystem::GetApproxPathDistance(AAIController* Agent,
+	const FVector& FromLocation,
+	const FVector& ToLocation)
+{
+	SCOPE_CYCLE_COUNTER(STAT_SUSS_ApproxPathDistance);
+
+	float Distance;
+	if (EstimateWithCoarseGraph(Agent, FromLocation, ToLocation, Distance))
+	{
+		return Distance;
+	}
+	return FVector::Distance(FromLocation, ToLocation) * EstimatedPathDistanceScale;
+}
+
+bool USussPathDistanceWorldSubsystem::EstimateWithCoarseGraph(AAIController* Agent,
+	const FVector& FromLocation,
+	const FVector& ToLocation,
+	float& OutDistance)
+{
+	if (const ANavigationData* NavData = Agent ? USussUtility::GetNavDataForAgent(Agent) : nullptr)
+	{
+		const UClass* FilterClass = Agent->GetDefaultNavigationFilterClass().Get();
+		TUniquePtr<FSussCoarseNavGraph>& Graph = CoarseGraphs.FindOrAdd(MakeTuple(TObjectKey<ANavigationData>(NavData), TObjectKey<UClass>(FilterClass)));
+		if (!Graph.IsValid())
+		{
+			Graph = MakeUnique<FSussCoarseNavGraph>(NavData,
+			                                        UNavigationQueryFilter::GetQueryFilter(*NavData, FilterClass),
+			                                        ApproxCellSize,
+			                                        ApproxMaxSearchDistance,
+			                                        ApproxMaxNavQueriesPerFrame);
+		}
+
+		return Graph->EstimateDistance(FromLocation, ToLocation, OutDistance);
+	}
+	return false;
+}
+
+FSussPathDistanceBenchmarkResult USussPathDistanceWorldSubsystem::BenchmarkApproxPathDistance(AAIController* Agent,
+	int NumSamples,
+	float Radius)
+{
+	FSussPathDistanceBenchmarkResult Ret;
+
+	UNavigationSystemV1* NavSys = FNavigationSystem::GetCurrent<UNavigationSystemV1>(GetWorld());
+	const ANavigationData* NavData = USussUtility::GetNavDataForAgent(Agent);
+	if (!NavSys || !NavData || !Agent->GetPawn())
+	{
+		UE_LOG(LogSuss, Warning, TEXT("BenchmarkApproxPathDistance: agent has no pawn or navigation data"));
+		return Ret;
+	}
+
+	const FVector Start = Agent->GetPawn()->GetActorLocation();
+	TArray<FVector> Locations;
+	for (int i = 0; i < NumSamples; ++i)
+	{
+		FNavLocation NavLoc;
+		if (NavSys->GetRandomReachablePointInRadius(Start, Radius, NavLoc, NavData))
+		{
+			Locations.Add(NavLoc.Location);
+		}
+	}
+
+	TArray<float> Exact, Approx;
+	TBitArray<> Estimated(false, Locations.Num());
+	Exact.SetNumUninitialized(Locations.Num());
+	Approx.SetNumUninitialized(Locations.Num());
+
+	double StartTime = FPlatformTime::Seconds();
+	for (int i = 0; i < Locations.Num(); ++i)
+	{
+		Exact[i] = USussUtility::GetPathDistanceFromTo(Agent, Start, Locations[i]);
+	}
+	const double ExactTime = FPlatformTime::Seconds() - StartTime;
+
+	// Start from an empty graph so that the cold timing includes building it. Lift the build budget meanwhile, so that
+	// estimates are compared rather than fallbacks.
+	CoarseGraphs.Remove(MakeTuple(TObjectKey<ANavigationData>(NavData), TObjectKey<UClass>(Agent->GetDefaultNavigationFilterClass().Get())));
+	const int SavedMaxNavQueriesPerFrame = ApproxMaxNavQueriesPerFrame;
+	ApproxMaxNavQueriesPerFrame = 0;
+	StartTime = FPlatformTime::Seconds();
+	for (int i = 0; i < Locations.Num(); ++i)
+	{
+		Approx[i] = GetApproxPathDistance(Agent, Start, Locations[i]);
+	}
+	const double ApproxColdTime = FPlatformTime::Seconds() - StartTime;
+
+	StartTime = FPlatformTime::Seconds();
+	for (int i = 0; i < Locations.Num(); ++i)
+	{
+		Approx[i] = GetApproxPathDistance(Agent, Start, Locations[i]);
+	}
+	const double ApproxWarmTime = FPlatformTime::Seconds() - StartTime;
+
+	for (int i = 0; i < Locations.Num(); ++i)
+	{
+		float Dummy;
+		Estimated[i] = EstimateWithCoarseGraph(Agent, Start, Locations[i], Dummy);
+	}
+	ApproxMaxNavQueriesPerFrame = SavedMaxNavQueriesPerFrame;
+	if (const auto pGraph = CoarseGraphs.Find(MakeTuple(TObjectKey<ANavigationData>(NavData), TObjectKey<UClass>(Agent->GetDefaultNavigationFilterClass().Get()))))
+	{
+		(*pGraph)->SetMaxNavQueriesPerFrame(SavedMaxNavQueriesPerFrame);
+	}
+
+	// Only compare locations which an exact path was found to
+	TArray<int> Valid;
+	double TotalRelError = 0;
+	for (int i = 0; i < Locations.Num(); ++i)
+	{
+		if (Exact[i] < BIG_NUMBER && Exact[i] > UE_KINDA_SMALL_NUMBER)
+		{
+			Valid.Add(i);
+			TotalRelError += FMath::Abs(Approx[i] - Exact[i]) / Exact[i];
+			if (!Estimated[i])
+			{
+				++Ret.Fallbacks;
+			}
+		}
+	}
+
+	int Pairs = 0, Agreed = 0;
+	for (int a = 0; a < Valid.Num(); ++a)
+	{
+		for (int b = a + 1; b < Valid.Num(); ++b)
+		{
+			++Pairs;
+			if ((Exact[Valid[a]] < Exact[Valid[b]]) == (Approx[Valid[a]] < Approx[Valid[b]]))
+			{
+				++Agreed;
+			}
+		}
+	}
+
+	Ret.Samples = Valid.Num();
+	if (Locations.Num() > 0)
+	{
+		Ret.MeanRelativeError = Valid.Num() > 0 ? TotalRelError / Valid.Num() : 0;
+		Ret.RankAgreement = Pairs > 0 ? static_cast<float>(Agreed) / Pairs : 1;
+		Ret.ExactMicroseconds = ExactTime * 1000000.0 / Locations.Num();
+		Ret.ApproxColdMicroseconds = ApproxColdTime * 1000000.0 / Locations.Num();
+		Ret.ApproxWarmMicroseconds = ApproxWarmTime * 1000000.0 / Locations.Num();
+	}
+
+	UE_LOG(LogSuss,
+	       Log,
+	       TEXT("Approx path distance benchmark: %d samples, %d fallbacks, mean relative error %.1f%%, rank agreement %.1f%%, exact %.1fus, approx %.1fus cold / %.2fus warm"),
+	       Ret.Samples,
+	       Ret.Fallbacks,
+	       Ret.MeanRelativeError * 100.f,
+	       Ret.RankAgreement * 100.f,
+	       Ret.ExactMicroseconds,
+	       Ret.ApproxColdMicroseconds,
+	       Ret.ApproxWarmMicroseconds);
+
+	return Ret;
+}
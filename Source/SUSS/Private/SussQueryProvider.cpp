@@ -1,30 +1,43 @@
 ﻿#include "SussQueryProvider.h"
 
+#include "SussBrainComponent.h"
 #include "SussCommon.h"
+#include "SussUtility.h"
 
+DEFINE_STAT(STAT_SUSS_QueryCacheHits);
+DEFINE_STAT(STAT_SUSS_QueryCacheMisses);
+DEFINE_STAT(STAT_SUSS_QueryCacheEvictions);
+DEFINE_STAT(STAT_SUSS_QueryCacheMemory);
 
-uint32 USussQueryProvider::HashQueryRequest(AActor* Self, const TMap<FName, FSussParameter>& Params)
+FSussQueryCacheKey::FSussQueryCacheKey(const AActor* InSelf,
+                                       const TMap<FName, FSussParameter>& InParams,
+                                       int InMaxResults,
+                                       ESussQueryResultSort InResultSort,
+                                       const FIntVector& InLocationCell,
+                                       uint8 InTeamId) :
+	Self(InSelf),
+	Params(InParams),
+	MaxResults(InMaxResults),
+	ResultSort(InResultSort),
+	LocationCell(InLocationCell),
+	TeamId(InTeamId)
 {
-	uint32 Hash = 0;
-
-	if (bSelfIsRelevant)
-		Hash = GetTypeHash(Self);
-	
+	Hash = HashCombine(GetTypeHash(Self), HashCombine(GetTypeHash(MaxResults), GetTypeHash(static_cast<uint8>(ResultSort))));
+	Hash = HashCombine(Hash, HashCombine(GetTypeHash(LocationCell), GetTypeHash(TeamId)));
 	for (const auto& Pair : Params)
 	{
-		Hash = HashCombine(Hash, GetTypeHash(Pair.Key));
-		Hash = HashCombine(Hash, GetTypeHash(Pair.Value));
+		// Order-independent, to match ParamsMatch
+		Hash ^= HashCombine(GetTypeHash(Pair.Key), GetTypeHash(Pair.Value));
 	}
-	return Hash;
 }
 
-bool USussQueryProvider::ParamsMatch(const TMap<FName, FSussParameter>& Params1,
-                                     const TMap<FName, FSussParameter>& Params2) const
+bool FSussQueryCacheKey::ParamsMatch(const TMap<FName, FSussParameter>& Params1,
+                                     const TMap<FName, FSussParameter>& Params2)
 {
 	if (Params1.Num() != Params2.Num())
 		return false;
 	
-	for (auto ParamEntry: Params1)
+	for (const auto& ParamEntry: Params1)
 	{
 		if (auto pParam2 = Params2.Find(ParamEntry.Key))
 		{
@@ -41,6 +54,56 @@ bool USussQueryProvider::ParamsMatch(const TMap<FName, FSussParameter>& Params1,
 	return true;
 }
 
+FSussCorrelatedQueryCacheKey::FSussCorrelatedQueryCacheKey(const FSussQueryCacheKey& InRequest,
+                                                           const FSussContext& InSourceContext) :
+	Request(InRequest),
+	SourceContext(InSourceContext)
+{
+	// The source context always refers to the requesting agent; if the request doesn't depend on which agent that
+	// is, the results don't either, so they can be shared
+	if (!Request.Self)
+	{
+		SourceContext.ControlledActor = nullptr;
+	}
+	Hash = HashCombine(Request.Hash, GetTypeHash(SourceContext));
+}
+
+
+bool USussQueryProvider::ParamsMatch(const TMap<FName, FSussParameter>& Params1,
+                                     const TMap<FName, FSussParameter>& Params2) const
+{
+	return FSussQueryCacheKey::ParamsMatch(Params1, Params2);
+}
+
+bool FSussCorrelatedQueryCacheKey::SourceContextsMatch(const FSussContext& Context1, const FSussContext& Context2)
+{
+	if (Context1.ControlledActor != Context2.ControlledActor ||
+		Context1.Target != Context2.Target ||
+		!Context1.Location.Equals(Context2.Location) ||
+		Context1.NamedValues.Num() != Context2.NamedValues.Num())
+	{
+		return false;
+	}
+
+	for (const auto& Pair : Context1.NamedValues)
+	{
+		const auto pOther = Context2.NamedValues.Find(Pair.Key);
+		if (!pOther)
+			return false;
+
+		if (Pair.Value.Type == ESussContextValueType::Struct)
+		{
+			if (pOther->Type != ESussContextValueType::Struct || Pair.Value.GetStructValue() != pOther->GetStructValue())
+				return false;
+		}
+		else if (Pair.Value != *pOther)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
 void USussTargetQueryProvider::ExecuteQuery(USussBrainComponent* Brain,
                                             AActor* Self,
                                             const TMap<FName, FSussParameter>& Params,
@@ -89,5 +152,147 @@ void USussNamedValueQueryProvider::ExecuteQuery(USussBrainComponent* Brain,
 	ExecuteQueryBP(Brain, Self, Params, Context);
 }
 
+void USussQueryProvider::QueueDeferredRefresh(const FSussQueryCacheKey& Key,
+	FSussCachedQueryResults& Entry,
+	USussBrainComponent* Brain)
+{
+	Entry.RefreshBrain = Brain;
+	if (!Entry.bRefreshPending)
+	{
+		Entry.bRefreshPending = true;
+		PendingRefreshes.Add(Key);
+	}
+}
+
+DECLARE_CYCLE_STAT(TEXT("SUSS Deferred Query Refresh"), STAT_SUSS_DeferredQueryRefresh, STATGROUP_SUSS);
+DECLARE_DWORD_COUNTER_STAT(TEXT("SUSS Deferred Query Refreshes"), STAT_SUSS_DeferredQueryRefreshes, STATGROUP_SUSS);
+
+void USussQueryProvider::RunDeferredRefreshes()
+{
+	SCOPE_CYCLE_COUNTER(STAT_SUSS_DeferredQueryRefresh);
+
+	const double StartTime = FPlatformTime::Seconds();
+	const double Budget = DeferredRefreshBudgetMs * 0.001;
+	int NumProcessed = 0;
+	for (; NumProcessed < PendingRefreshes.Num(); ++NumProcessed)
+	{
+		// Always make some progress
+		if (NumProcessed > 0 && FPlatformTime::Seconds() - StartTime > Budget)
+			break;
+
+		const FSussQueryCacheKey& Key = PendingRefreshes[NumProcessed];
+		// Entry may have been evicted or re-run inline since it was queued
+		FSussCachedQueryResults* pEntry = CachedResults.FindNoTouch(Key);
+		if (!pEntry || !pEntry->bRefreshPending)
+			continue;
 
+		pEntry->bRefreshPending = false;
+		USussBrainComponent* Brain = pEntry->RefreshBrain.Get();
+		AActor* Self = pEntry->ControlledActor.Get();
+		if (!Brain || !Self)
+			continue;
 
+		// Run with the key's copy of the params, ExecuteQuery overwrites the entry's
+		ExecuteQuery(Brain, Self, Key.Params, Key.MaxResults, Key.ResultSort, *pEntry);
+		CachedResults.SetEntrySize(Key, EstimateCacheEntrySize(Key, *pEntry, *pEntry->Results));
+		INC_DWORD_STAT(STAT_SUSS_DeferredQueryRefreshes);
+	}
+	PendingRefreshes.RemoveAt(0, NumProcessed, false);
+}
+
+FSussQueryInvalidationCounts USussQueryProvider::GetInvalidationCounts(const USussBrainComponent* Brain)
+{
+	if (IsValid(Brain))
+	{
+		return Brain->GetQueryInvalidationCounts();
+	}
+	return FSussQueryInvalidationCounts();
+}
+
+bool USussQueryProvider::HasDestroyedActors(const TSussResultsArray& Results)
+{
+	if (const auto pActors = Results.TryGet<TArray<TWeakObjectPtr<AActor>>>())
+	{
+		for (const auto& Actor : *pActors)
+		{
+			if (!Actor.IsValid())
+				return true;
+		}
+	}
+	else if (const auto pValues = Results.TryGet<TArray<FSussContextValue>>())
+	{
+		for (const auto& Value : *pValues)
+		{
+			if (Value.Type == ESussContextValueType::Actor && !Value.Value.Get<TWeakObjectPtr<AActor>>().IsValid())
+				return true;
+		}
+	}
+	return false;
+}
+
+bool USussQueryProvider::IsInvalidated(const FSussQueryInvalidationCounts& Counts,
+	const TSussResultsArray* Results,
+	const USussBrainComponent* Brain) const
+{
+	if (IsValid(Brain))
+	{
+		const FSussQueryInvalidationCounts& Current = Brain->GetQueryInvalidationCounts();
+		if (bInvalidateOnPerceptionUpdated && Current.PerceptionUpdates != Counts.PerceptionUpdates)
+			return true;
+		if (!InvalidateOnTagsChanged.IsEmpty() && Current.TagChanges != Counts.TagChanges)
+			return true;
+	}
+
+	return bInvalidateOnResultActorDestroyed && Results && HasDestroyedActors(*Results);
+}
+
+FSussQueryCacheKey USussQueryProvider::MakeCacheKey(AActor* Self,
+	const TMap<FName, FSussParameter>& Params,
+	int MaxResults,
+	ESussQueryResultSort ResultSort) const
+{
+	if (bShareResultsByLocation && bSelfIsRelevant && IsValid(Self))
+	{
+		const FVector Cell = Self->GetActorLocation() / FMath::Max(SharedResultsCellSize, 1.f);
+		const FIntVector LocationCell(FMath::FloorToInt(Cell.X), FMath::FloorToInt(Cell.Y), FMath::FloorToInt(Cell.Z));
+
+		const FGenericTeamId TeamId = bShareResultsOnlyWithinTeam ? USussUtility::GetTeamId(Self) : FGenericTeamId::NoTeam;
+		return FSussQueryCacheKey(nullptr, Params, MaxResults, ResultSort, LocationCell, TeamId.GetId());
+	}
+
+	return FSussQueryCacheKey(bSelfIsRelevant ? Self : nullptr, Params, MaxResults, ResultSort);
+}
+
+DECLARE_DWORD_COUNTER_STAT(TEXT("SUSS Async Queries Completed"), STAT_SUSS_AsyncQueriesCompleted, STATGROUP_SUSS);
+
+void USussQueryProvider::CompleteAsyncQuery(USussBrainComponent* Brain,
+	const FSussQueryCacheKey& Key,
+	int32 QueryID,
+	TFunctionRef<void(AActor* Self, TSussResultsArray&)> WriteResults)
+{
+	FScopeLock Lock(&Guard);
+
+	// Entry may have been evicted while the query was running, and maybe re-added with a newer query pending
+	FSussCachedQueryResults* pEntry = CachedResults.FindNoTouch(Key);
+	if (!pEntry || !pEntry->bAsyncPending || pEntry->AsyncQueryID != QueryID)
+		return;
+
+	pEntry->bAsyncPending = false;
+	pEntry->AsyncQueryID = INDEX_NONE;
+	AActor* Self = pEntry->ControlledActor.Get();
+	if (!Self)
+		return;
+
+	pEntry->LastRunTime = CacheTime;
+	BeginNewResults(*pEntry);
+	WriteResults(Self, *pEntry->Results);
+	FinishResultLimits(Self, FSussQueryResultLimits(Key.MaxResults, Key.ResultSort), *pEntry->Results);
+	CachedResults.SetEntrySize(Key, EstimateCacheEntrySize(Key, *pEntry, *pEntry->Results));
+	INC_DWORD_STAT(STAT_SUSS_AsyncQueriesCompleted);
+
+	// The brain has been making do with the previous results, so let it re-score with the new ones
+	if (IsValid(Brain))
+	{
+		Brain->RequestUpdate();
+	}
+}
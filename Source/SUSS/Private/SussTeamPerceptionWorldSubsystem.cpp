@@ -0,0 +1,168 @@
+﻿
+#include "SussTeamPerceptionWorldSubsystem.h"
+
+#include "SussBrainComponent.h"
+#include "SussCommon.h"
+#include "SussSettings.h"
+#include "SussUtility.h"
+
+DECLARE_CYCLE_STAT(TEXT("SUSS Team Perception"), STAT_SUSS_TeamPerception, STATGROUP_SUSS);
+
+USussTeamPerceptionWorldSubsystem::USussTeamPerceptionWorldSubsystem()
+{
+	if (const auto Settings = GetDefault<USussSettings>())
+	{
+		UpdateInterval = Settings->TeamPerceptionUpdateInterval;
+	}
+}
+
+bool USussTeamPerceptionWorldSubsystem::DoesSupportWorldType(const EWorldType::Type WorldType) const
+{
+	return WorldType == EWorldType::Game || WorldType == EWorldType::PIE;
+}
+
+void USussTeamPerceptionWorldSubsystem::RegisterMember(USussBrainComponent* Brain)
+{
+	if (!IsValid(Brain) || MemberTeams.Contains(Brain))
+		return;
+
+	const uint8 TeamId = USussUtility::GetTeamId(Brain->GetOwner()).GetId();
+	MemberTeams.Add(Brain, TeamId);
+	AddToTeam(Brain, TeamId);
+}
+
+void USussTeamPerceptionWorldSubsystem::UnregisterMember(USussBrainComponent* Brain)
+{
+	uint8 TeamId;
+	if (MemberTeams.RemoveAndCopyValue(Brain, TeamId))
+	{
+		RemoveFromTeam(Brain, TeamId);
+	}
+}
+
+void USussTeamPerceptionWorldSubsystem::OnMemberPerceptionUpdated(USussBrainComponent* Brain)
+{
+	uint8* pTeamId = MemberTeams.Find(Brain);
+	if (!pTeamId)
+		return;
+
+	// Teams can change at runtime
+	const uint8 TeamId = USussUtility::GetTeamId(Brain->GetOwner()).GetId();
+	if (TeamId != *pTeamId)
+	{
+		RemoveFromTeam(Brain, *pTeamId);
+		*pTeamId = TeamId;
+		AddToTeam(Brain, TeamId);
+	}
+	else if (FTeam* pTeam = Teams.Find(TeamId))
+	{
+		pTeam->bDirty = true;
+	}
+}
+
+void USussTeamPerceptionWorldSubsystem::AddToTeam(USussBrainComponent* Brain, uint8 TeamId)
+{
+	if (TeamId == FGenericTeamId::NoTeam)
+		return;
+
+	FTeam& Team = Teams.FindOrAdd(TeamId);
+	Team.Members.Add(Brain);
+	Team.bDirty = true;
+}
+
+void USussTeamPerceptionWorldSubsystem::RemoveFromTeam(USussBrainComponent* Brain, uint8 TeamId)
+{
+	if (FTeam* pTeam = Teams.Find(TeamId))
+	{
+		pTeam->Members.RemoveSingleSwap(Brain, false);
+		pTeam->bDirty = true;
+	}
+}
+
+const FSussTeamPerception& USussTeamPerceptionWorldSubsystem::GetTeamPerception(FGenericTeamId TeamId) const
+{
+	if (const FTeam* pTeam = Teams.Find(TeamId.GetId()))
+	{
+		return pTeam->Perception;
+	}
+
+	static const FSussTeamPerception Empty;
+	return Empty;
+}
+
+TStatId USussTeamPerceptionWorldSubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(USussTeamPerceptionWorldSubsystem, STATGROUP_Tickables);
+}
+
+void USussTeamPerceptionWorldSubsystem::Tick(float DeltaTime)
+{
+	const double Now = GetWorld()->GetTimeSeconds();
+	for (auto& Pair : Teams)
+	{
+		FTeam& Team = Pair.Value;
+		if (Team.bDirty && Now - Team.Perception.UpdateTime >= UpdateInterval)
+		{
+			UpdateTeamPerception(Team, Now);
+		}
+	}
+}
+
+void USussTeamPerceptionWorldSubsystem::UpdateTeamPerception(FTeam& Team, double Now)
+{
+	SCOPE_CYCLE_COUNTER(STAT_SUSS_TeamPerception);
+
+	FSussTeamPerception& Perception = Team.Perception;
+	Team.bDirty = false;
+	Perception.UpdateTime = Now;
+
+	// Re-use allocations from last time
+	Perception.KnownHostiles.Reset();
+	Perception.HostileIndices.Reset();
+	Perception.NumMembers = 0;
+
+	for (int i = 0; i < Team.Members.Num(); ++i)
+	{
+		const USussBrainComponent* Brain = Team.Members[i].Get();
+		if (!Brain)
+		{
+			// Brains unregister themselves when they end play, so this should be rare
+			Team.Members.RemoveAtSwap(i--, 1, false);
+			continue;
+		}
+
+		++Perception.NumMembers;
+		for (const auto& Entry : Brain->GetPerceptionSnapshot())
+		{
+			if (!Entry.bIsHostile || !Entry.HasAnyKnownStimulus())
+			{
+				continue;
+			}
+
+			const TObjectKey<AActor> ActorKey(Entry.Actor.Get());
+			if (const int* pIndex = Perception.HostileIndices.Find(ActorKey))
+			{
+				FSussTeamKnownHostile& Hostile = Perception.KnownHostiles[*pIndex];
+				if (Entry.Age < Hostile.Age)
+				{
+					Hostile.Age = Entry.Age;
+					Hostile.LastLocation = Entry.LastLocation;
+				}
+				Hostile.KnownSenses |= Entry.KnownSenses;
+				Hostile.CurrentSenses |= Entry.CurrentSenses;
+				++Hostile.NumKnownBy;
+			}
+			else
+			{
+				Perception.HostileIndices.Add(ActorKey, Perception.KnownHostiles.Num());
+				FSussTeamKnownHostile& Hostile = Perception.KnownHostiles.AddDefaulted_GetRef();
+				Hostile.Actor = Entry.Actor;
+				Hostile.LastLocation = Entry.LastLocation;
+				Hostile.Age = Entry.Age;
+				Hostile.KnownSenses = Entry.KnownSenses;
+				Hostile.CurrentSenses = Entry.CurrentSenses;
+				Hostile.NumKnownBy = 1;
+			}
+		}
+	}
+}
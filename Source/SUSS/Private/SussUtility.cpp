@@ -8,6 +8,7 @@
 #include "AIController.h"
 #include "EnvironmentQuery/EnvQueryManager.h"
 #include "NavFilters/NavigationQueryFilter.h"
+#include "NavMesh/NavMeshPath.h"
 #include "Perception/AISense_Damage.h"
 #include "Perception/AISense_Hearing.h"
 #include "Perception/AISense_Sight.h"
@@ -115,7 +116,8 @@ void USussUtility::AddEQSParams(const TMap<FName, FSussParameter>& Params, TArra
 TSharedPtr<FEnvQueryResult> USussUtility::RunEQSQuery(UObject* WorldContextObject,
                                                       UEnvQuery* EQSQuery,
                                                       const TArray<FEnvNamedValue>& QueryParams,
-                                                      EEnvQueryRunMode::Type QueryMode)
+                                                      EEnvQueryRunMode::Type QueryMode,
+                                                      const FSussContext* Context)
 {
 	UWorld* World = GEngine->GetWorldFromContextObject(WorldContextObject, EGetWorldErrorMode::LogAndReturnNull);
 
@@ -124,19 +126,67 @@ TSharedPtr<FEnvQueryResult> USussUtility::RunEQSQuery(UObject* WorldContextObjec
 
 	if (UEnvQueryManager* EQS = UEnvQueryManager::GetCurrent(World))
 	{
-		// We *could* allow EQS to be run in steps over many frames here
-		// See ExecuteOneStep inside this function, or EQSTestingPawn
-		// Or we could use RunQuery with callback.
-		// For now, run synchronous for simplicity, and limit time between AIs
+		// Synchronous; see RunEQSQueryAsync for letting EQS time-slice the query
 		FEnvQueryRequest QueryRequest(EQSQuery, WorldContextObject);
 		QueryRequest.SetNamedParams(QueryParams);
-		
-		return EQS->RunInstantQuery(QueryRequest, QueryMode);
+
+		USussEQSWorldSubsystem* EQSSub = nullptr;
+		int32 ContextHandle = INDEX_NONE;
+		if (Context)
+		{
+			EQSSub = World->GetSubsystem<USussEQSWorldSubsystem>();
+			ContextHandle = EQSSub->AddQueryContext(*Context);
+			QueryRequest.SetFloatParam(USussEQSWorldSubsystem::ContextHandleParamName, ContextHandle);
+		}
+
+		TSharedPtr<FEnvQueryResult> Ret = EQS->RunInstantQuery(QueryRequest, QueryMode);
+
+		if (EQSSub)
+		{
+			EQSSub->RemoveQueryContext(ContextHandle);
+		}
+		return Ret;
 	}
 
 	return nullptr;
 }
 
+int32 USussUtility::RunEQSQueryAsync(UObject* Querier,
+                                     UEnvQuery* EQSQuery,
+                                     const TArray<FEnvNamedValue>& QueryParams,
+                                     EEnvQueryRunMode::Type QueryMode,
+                                     const FQueryFinishedSignature& OnFinished,
+                                     const FSussContext* Context)
+{
+	UWorld* World = GEngine->GetWorldFromContextObject(Querier, EGetWorldErrorMode::LogAndReturnNull);
+
+	if (!EQSQuery || !World || !UEnvQueryManager::GetCurrent(World))
+		return INDEX_NONE;
+
+	FEnvQueryRequest QueryRequest(EQSQuery, Querier);
+	QueryRequest.SetNamedParams(QueryParams);
+	if (!Context)
+	{
+		return QueryRequest.Execute(QueryMode, OnFinished);
+	}
+
+	// Context has to stay registered until the query finishes
+	USussEQSWorldSubsystem* EQSSub = World->GetSubsystem<USussEQSWorldSubsystem>();
+	const int32 ContextHandle = EQSSub->AddQueryContext(*Context);
+	QueryRequest.SetFloatParam(USussEQSWorldSubsystem::ContextHandleParamName, ContextHandle);
+	const int32 QueryID = QueryRequest.Execute(QueryMode,
+		FQueryFinishedSignature::CreateWeakLambda(EQSSub, [EQSSub, ContextHandle, OnFinished](TSharedPtr<FEnvQueryResult> Result)
+		{
+			EQSSub->RemoveQueryContext(ContextHandle);
+			OnFinished.ExecuteIfBound(Result);
+		}));
+	if (QueryID == INDEX_NONE)
+	{
+		EQSSub->RemoveQueryContext(ContextHandle);
+	}
+	return QueryID;
+}
+
 UEnvQueryInstanceBlueprintWrapper* USussUtility::RunEQSQueryBP(AActor* Querier,
 	UEnvQuery* EQSQuery,
 	const TArray<FEnvNamedValue>& QueryParams,
@@ -169,26 +219,16 @@ TSharedPtr<FEnvQueryResult> USussUtility::RunEQSQueryWithTargetContext(AActor* Q
                                                                        const TMap<FName, FSussParameter>& Params,
                                                                        TEnumAsByte<EEnvQueryRunMode::Type> QueryMode)
 {
-	// unfortunately we have no place to store any extra EQS context values like current target
-	// we use this subsystem hack instead
-	bool bClearTargetContext = false;
-	if (IsValid(Target))
-	{
-		auto EQSSub = Querier->GetWorld()->GetSubsystem<USussEQSWorldSubsystem>();
-		EQSSub->SetTargetInfo(Querier, Target);
-		bClearTargetContext = true;
-	}
 	TArray<FEnvNamedValue> QueryParams;
 	USussUtility::AddEQSParams(Params, QueryParams);
-	TSharedPtr<FEnvQueryResult> Ret = RunEQSQuery(Querier, EQSQuery, QueryParams, QueryMode);
-
-	// Clear temp context info
-	if (bClearTargetContext)
+	if (IsValid(Target))
 	{
-		auto EQSSub = Querier->GetWorld()->GetSubsystem<USussEQSWorldSubsystem>();
-		EQSSub->ClearTargetInfo(Querier);
+		FSussContext Context;
+		Context.ControlledActor = Querier;
+		Context.Target = Target;
+		return RunEQSQuery(Querier, EQSQuery, QueryParams, QueryMode, &Context);
 	}
-	return Ret;
+	return RunEQSQuery(Querier, EQSQuery, QueryParams, QueryMode);
 }
 
 UEnvQueryInstanceBlueprintWrapper* USussUtility::RunEQSQueryWithTargetContextBP(AActor* Querier,
@@ -201,19 +241,8 @@ UEnvQueryInstanceBlueprintWrapper* USussUtility::RunEQSQueryWithTargetContextBP(
 
 	if (IsValid(Querier) && EQSQuery)
 	{
-		// unfortunately we have no place to store any extra EQS context values like current target
-		// we use this subsystem hack instead
-		auto EQSSub = Querier->GetWorld()->GetSubsystem<USussEQSWorldSubsystem>();
-		if (Target)
-		{
-			EQSSub->SetTargetInfo(Querier, Target);
-		}
 		TArray<FEnvNamedValue> QueryParams;
 		USussUtility::AddEQSParams(Params, QueryParams);
-		auto Ret = RunEQSQuery(Querier, EQSQuery, QueryParams, QueryMode);
-
-		// Clear temp context info
-		EQSSub->ClearTargetInfo(Querier);
 
 		Wrapper = NewObject<UEnvQueryInstanceBlueprintWrapper>(UEnvQueryManager::GetCurrent(Querier), UEnvQueryInstanceBlueprintWrapper::StaticClass());
 		check(Wrapper);
@@ -221,6 +250,15 @@ UEnvQueryInstanceBlueprintWrapper* USussUtility::RunEQSQueryWithTargetContextBP(
 
 		FEnvQueryRequest QueryRequest(EQSQuery, Querier);
 		QueryRequest.SetNamedParams(QueryParams);
+		if (Target)
+		{
+			// Query runs asynchronously, the context is removed when the wrapper's query finishes
+			FSussContext Context;
+			Context.ControlledActor = Querier;
+			Context.Target = Target;
+			auto EQSSub = Querier->GetWorld()->GetSubsystem<USussEQSWorldSubsystem>();
+			QueryRequest.SetFloatParam(USussEQSWorldSubsystem::ContextHandleParamName, EQSSub->AddQueryContext(Context, Wrapper));
+		}
 		Wrapper->RunQuery(QueryMode, QueryRequest);
 		
 	}
@@ -591,33 +629,45 @@ const TArray<FVector>& USussUtility::RunLocationQuery(AActor* Querier, FGameplay
 	return DummyResults;
 }
 
-const TArray<FVector>& USussUtility::RunLocationQueryWithTargetContext(AActor* Querier,
+TArray<FVector> USussUtility::RunLocationQueryWithTargetContext(AActor* Querier,
 	FGameplayTag Tag,
 	AActor* Target,
 	const TMap<FName, FSussParameter>& Params,
 	float UseCachedResultsFor)
 {
-	if (IsValid(Querier))
+	// Results are gathered from the per-context cache, so are copied out rather than referenced
+	TArray<FVector> Results;
+	
+	if (IsValid(Querier) && IsValid(Target))
 	{
-		// unfortunately we have no place to store any extra EQS context values like current target
-		// we use this subsystem hack instead
-		auto EQSSub = Querier->GetWorld()->GetSubsystem<USussEQSWorldSubsystem>();
-		if (Target)
+		if (auto SUSS = GetSUSS(Querier->GetWorld()))
 		{
-			EQSSub->SetTargetInfo(Querier, Target);
+			if (const auto Provider = SUSS->GetQueryProvider(Tag))
+			{
+				if (Provider->GetProvidedContextElement() == ESussQueryContextElement::Location)
+				{
+					// The target is passed to the query in the context, results are cached per context
+					FSussContext Context;
+					Context.ControlledActor = Querier;
+					Context.Target = Target;
+					TArray<int32> ResultCounts;
+					Provider->GetResultsInContexts<FVector>(nullptr,
+					                                        Querier,
+					                                        MakeArrayView(&Context, 1),
+					                                        UseCachedResultsFor,
+					                                        Params,
+					                                        Results,
+					                                        ResultCounts);
+				}
+			}
 		}
-
-		const TArray<FVector>& Ret =RunLocationQuery(Querier, Tag, Params, UseCachedResultsFor);
-
-		// Clear temp context info
-		EQSSub->ClearTargetInfo(Querier);
-
-		return Ret;
+	}
+	else if (IsValid(Querier))
+	{
+		Results = RunLocationQuery(Querier, Tag, Params, UseCachedResultsFor);
 	}
 
-	static TArray<FVector> DummyResults;
-	return DummyResults;
-
+	return Results;
 }
 
 TArray<AActor*> USussUtility::RunTargetQuery(AActor* Querier,
@@ -716,32 +766,30 @@ float USussUtility::GetPathDistanceTo(AAIController* Agent, const FVector& Locat
 {
 	if (Agent && Agent->GetPawn())
 	{
-		return GetPathDistanceFromTo(Agent, Agent->GetPawn()->GetActorLocation(), Location, false);
+		return GetPathDistanceFromTo(Agent, Agent->GetPawn()->GetActorLocation(), Location, bAllowPartialPaths);
 	}
 	return BIG_NUMBER;
 }
 
 float USussUtility::GetPathDistanceFromTo(AAIController* Agent, const FVector& FromLocation, const FVector& ToLocation, bool
                                           bAllowPartialPath)
+{
+	const FNavPathSharedPtr Path = FindPathFromTo(Agent, FromLocation, ToLocation, bAllowPartialPath);
+	return Path.IsValid() ? Path->GetLength() : BIG_NUMBER;
+}
+
+FNavPathSharedPtr USussUtility::FindPathFromTo(AAIController* Agent,
+	const FVector& FromLocation,
+	const FVector& ToLocation,
+	bool bAllowPartialPath)
 {
 	if (!Agent)
 	{
-		return BIG_NUMBER;
+		return nullptr;
 	}
 	if (UNavigationSystemV1* NavSys = FNavigationSystem::GetCurrent<UNavigationSystemV1>(Agent->GetWorld()))
 	{
-		const ANavigationData* NavData;
-		INavAgentInterface* NavAgent = Cast<INavAgentInterface>(Agent);
-		if (NavAgent)
-		{
-			NavData = NavSys->GetNavDataForProps(NavAgent->GetNavAgentPropertiesRef(), NavAgent->GetNavAgentLocation());
-		}
-		else
-		{
-			NavData = NavSys->GetDefaultNavDataInstance(FNavigationSystem::DontCreate);
-		}
-	
-		if (NavData)
+		if (const ANavigationData* NavData = GetNavDataForAgent(Agent))
 		{
 			FSharedConstNavQueryFilter NavFilter = UNavigationQueryFilter::GetQueryFilter(*NavData, Agent->GetDefaultNavigationFilterClass());
 			FPathFindingQuery Query(Agent, *NavData, FromLocation, ToLocation, NavFilter);
@@ -750,12 +798,64 @@ float USussUtility::GetPathDistanceFromTo(AAIController* Agent, const FVector& F
 
 			if (Result.IsSuccessful())
 			{
-				return Result.Path->GetLength();
+				return Result.Path;
 			}
 		}
 	}
 
-	return BIG_NUMBER;
+	return nullptr;
+}
+
+FNavPathSharedPtr USussUtility::CopyPath(const FNavPathSharedPtr& Path)
+{
+	if (!Path.IsValid())
+	{
+		return nullptr;
+	}
+
+	// Navmesh paths carry their corridor, which path following uses, so copy the whole thing
+	FNavPathSharedPtr Copy;
+	if (const FNavMeshPath* NavMeshPath = Path->CastPath<FNavMeshPath>())
+	{
+		Copy = MakeShareable(new FNavMeshPath(*NavMeshPath));
+	}
+	else
+	{
+		Copy = MakeShareable(new FNavigationPath(*Path));
+	}
+	// Observers belong to whoever was following the original
+	Copy->GetObserver().Clear();
+	return Copy;
+}
+
+const ANavigationData* USussUtility::GetNavDataForAgent(AAIController* Agent)
+{
+	if (Agent)
+	{
+		if (UNavigationSystemV1* NavSys = FNavigationSystem::GetCurrent<UNavigationSystemV1>(Agent->GetWorld()))
+		{
+			if (INavAgentInterface* NavAgent = Cast<INavAgentInterface>(Agent))
+			{
+				return NavSys->GetNavDataForProps(NavAgent->GetNavAgentPropertiesRef(), NavAgent->GetNavAgentLocation());
+			}
+			return NavSys->GetDefaultNavDataInstance(FNavigationSystem::DontCreate);
+		}
+	}
+	return nullptr;
+}
+
+FGenericTeamId USussUtility::GetTeamId(const AActor* Actor)
+{
+	FGenericTeamId TeamId = FGenericTeamId::GetTeamIdentifier(Actor);
+	if (TeamId == FGenericTeamId::NoTeam)
+	{
+		// Team is usually on the controller
+		if (const APawn* Pawn = Cast<APawn>(Actor))
+		{
+			TeamId = FGenericTeamId::GetTeamIdentifier(Pawn->GetController());
+		}
+	}
+	return TeamId;
 }
 
 ECollisionChannel USussUtility::GetLineOfSightTraceChannel()
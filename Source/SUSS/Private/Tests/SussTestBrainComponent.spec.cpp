@@ -1,5 +1,6 @@
 ﻿#include "SussBrainComponent.h"
 #include "SussGameSubsystem.h"
+#include "SussTestInputProviders.h"
 #include "SussTestQueryProviders.h"
 #include "SussTestWorldFixture.h"
 #if WITH_AUTOMATION_TESTS
@@ -28,10 +29,12 @@ void FSussBrainTestContextsSpec::Define()
 	{
 		WorldFixture = MakeUnique<FSussTestWorldFixture>();
 		RegisterTestQueryProviders(WorldFixture->GetWorld());
+		RegisterTestInputProviders(WorldFixture->GetWorld());
 
 	});
 	AfterEach([this]()
 	{
+		UnregisterTestInputProviders(WorldFixture->GetWorld());
 		UnregisterTestQueryProviders(WorldFixture->GetWorld());
 		WorldFixture.Reset();
 	});
@@ -533,6 +536,138 @@ void FSussBrainTestContextsSpec::Define()
 			}
 		});		
 
+		It("MaxContexts samples combinations deterministically", [this]()
+		{
+			AActor* Self = WorldFixture->GetWorld()->SpawnActor<AActor>();
+			auto Brain = Cast<USussBrainComponent>(
+				Self->AddComponentByClass(USussBrainComponent::StaticClass(), false, FTransform::Identity, false));
+
+			FSussActionDef Action;
+			Action.Queries.Add(FSussQuery {FGameplayTag::RequestGameplayTag(USussTestNamedFloatValueQueryProvider::TagName) }); // 2 items
+			Action.Queries.Add(FSussQuery {FGameplayTag::RequestGameplayTag(USussTestMultipleLocationQueryProvider::TagName) }); // 3 items
+			Action.MaxContexts = 4;
+			TArray<FSussContext> Contexts;
+			Brain->GenerateContexts(Self, Action, Contexts);
+
+			if (TestEqual("Number of contexts", Contexts.Num(), 4))
+			{
+				for (int i = 0; i < Contexts.Num(); ++i)
+				{
+					TestEqual("Self reference", Contexts[i].ControlledActor, Self);
+					TestTrue("Named Range", Contexts[i].NamedValues.Contains("Range"));
+					for (int j = i + 1; j < Contexts.Num(); ++j)
+					{
+						TestFalse("Sampled contexts are distinct", Contexts[i] == Contexts[j]);
+					}
+				}
+
+				// Same sample again
+				TArray<FSussContext> Contexts2;
+				Brain->GenerateContexts(Self, Action, Contexts2);
+				if (TestEqual("Number of contexts, second run", Contexts2.Num(), 4))
+				{
+					for (int i = 0; i < Contexts.Num(); ++i)
+					{
+						TestTrue("Sample is deterministic", Contexts[i] == Contexts2[i]);
+					}
+				}
+			}
+		});
+
+		It("MaxResults truncates query results", [this]()
+		{
+			AActor* Self = WorldFixture->GetWorld()->SpawnActor<AActor>();
+			auto Brain = Cast<USussBrainComponent>(Self->AddComponentByClass(USussBrainComponent::StaticClass(), false, FTransform::Identity, false));
+
+			FSussActionDef Action;
+			Action.Queries.Add(FSussQuery {FGameplayTag::RequestGameplayTag(USussTestMultipleLocationQueryProvider::TagName) }); // 3 items
+			Action.Queries[0].MaxResults = 2;
+			TArray<FSussContext> Contexts;
+			Brain->GenerateContexts(Self, Action, Contexts);
+
+			// No sort, so the first results in query order are kept
+			if (TestEqual("Number of contexts", Contexts.Num(), 2))
+			{
+				TestEqual("Location 0", Contexts[0].Location, FVector(10, -20, 50));
+				TestEqual("Location 1", Contexts[1].Location, FVector(20, 100, -2));
+			}
+		});
+
+		It("Query results can be sorted nearest or furthest first", [this]()
+		{
+			// Plain actors have no root component, so no location
+			AActor* Self = WorldFixture->GetWorld()->SpawnActor<AActor>();
+			Self->SetRootComponent(NewObject<USceneComponent>(Self));
+			Self->SetActorLocation(FVector(-40, 220, 700));
+			auto Brain = Cast<USussBrainComponent>(Self->AddComponentByClass(USussBrainComponent::StaticClass(), false, FTransform::Identity, false));
+
+			FSussActionDef Action;
+			Action.Queries.Add(FSussQuery {FGameplayTag::RequestGameplayTag(USussTestMultipleLocationQueryProvider::TagName) }); // 3 items
+			Action.Queries[0].ResultSort = ESussQueryResultSort::NearestFirst;
+			TArray<FSussContext> Contexts;
+			Brain->GenerateContexts(Self, Action, Contexts);
+			if (TestEqual("Number of contexts, nearest", Contexts.Num(), 3))
+			{
+				TestEqual("Nearest 0", Contexts[0].Location, FVector(-40, 220, 750));
+				TestEqual("Nearest 1", Contexts[1].Location, FVector(10, -20, 50));
+				TestEqual("Nearest 2", Contexts[2].Location, FVector(20, 100, -2));
+			}
+
+			Action.Queries[0].ResultSort = ESussQueryResultSort::FurthestFirst;
+			Action.Queries[0].MaxResults = 2;
+			Contexts.Empty();
+			Brain->GenerateContexts(Self, Action, Contexts);
+			if (TestEqual("Number of contexts, furthest", Contexts.Num(), 2))
+			{
+				TestEqual("Furthest 0", Contexts[0].Location, FVector(20, 100, -2));
+				TestEqual("Furthest 1", Contexts[1].Location, FVector(10, -20, 50));
+			}
+		});
+
+		It("Result limits applied by the provider aren't applied again", [this]()
+		{
+			AActor* Self = WorldFixture->GetWorld()->SpawnActor<AActor>();
+			Self->SetRootComponent(NewObject<USceneComponent>(Self));
+			auto Brain = Cast<USussBrainComponent>(Self->AddComponentByClass(USussBrainComponent::StaticClass(), false, FTransform::Identity, false));
+			USussTestLimitsLocationQueryProvider* Q = USussTestLimitsLocationQueryProvider::StaticClass()->GetDefaultObject<USussTestLimitsLocationQueryProvider>();
+			Q->bApplyLimits = true;
+
+			FSussActionDef Action;
+			Action.Queries.Add(FSussQuery {FGameplayTag::RequestGameplayTag(USussTestLimitsLocationQueryProvider::TagName) });
+			Action.Queries[0].MaxResults = 2;
+			Action.Queries[0].ResultSort = ESussQueryResultSort::NearestFirst;
+			TArray<FSussContext> Contexts;
+			Brain->GenerateContexts(Self, Action, Contexts);
+			TestEqual("Provider was given MaxResults", Q->LastLimits.MaxResults, 2);
+			TestTrue("Provider was given ResultSort", Q->LastLimits.ResultSort == ESussQueryResultSort::NearestFirst);
+			// The provider's own (furthest first) order is kept
+			if (TestEqual("Number of contexts", Contexts.Num(), 2))
+			{
+				TestEqual("Location 0", Contexts[0].Location, FVector(-40, 220, 750));
+				TestEqual("Location 1", Contexts[1].Location, FVector(20, 100, -2));
+			}
+
+			Q->bApplyLimits = false;
+		});
+
+		It("Result limits are kept apart for nested requests to the same provider", [this]()
+		{
+			AActor* Self = WorldFixture->GetWorld()->SpawnActor<AActor>();
+			auto Brain = Cast<USussBrainComponent>(Self->AddComponentByClass(USussBrainComponent::StaticClass(), false, FTransform::Identity, false));
+			USussTestLimitsLocationQueryProvider* Q = USussTestLimitsLocationQueryProvider::StaticClass()->GetDefaultObject<USussTestLimitsLocationQueryProvider>();
+			Q->bApplyLimits = false;
+
+			TMap<FName, FSussParameter> Params;
+			Params.Add("Nested", FSussParameter(1.0f));
+			TArray<FVector> Results;
+			Q->GetResultsInContext(Brain, Self, FSussContext { Self }, Params, Results, 1);
+			TestEqual("Outer limits seen after nested request", Q->LastLimits.MaxResults, 1);
+			if (TestEqual("Outer limits applied after nested request", Results.Num(), 1))
+			{
+				TestEqual("Location", Results[0], FVector(10, -20, 50));
+			}
+		});
+
 		It("Query caching works as intended", [this]()
 		{
 		   	AActor* Self = WorldFixture->GetWorld()->SpawnActor<AActor>();
@@ -605,6 +740,506 @@ void FSussBrainTestContextsSpec::Define()
 			
 		});
 
+		It("Query cache keeps requests with different name params apart", [this]()
+		{
+			AActor* Self = WorldFixture->GetWorld()->SpawnActor<AActor>();
+			auto Brain = Cast<USussBrainComponent>(Self->AddComponentByClass(USussBrainComponent::StaticClass(), false, FTransform::Identity, false));
+			USussTestSingleLocationQueryProvider* Q = USussTestSingleLocationQueryProvider::StaticClass()->GetDefaultObject<USussTestSingleLocationQueryProvider>();
+			Q->NumTimesRun = 0;
+			const FSussQueryCacheStats StartStats = Q->GetCacheStats();
+
+			FSussActionDef Action;
+			Action.Queries.Add(FSussQuery {FGameplayTag::RequestGameplayTag(USussTestSingleLocationQueryProvider::TagName) });
+			Action.Queries[0].Params.Add("Sense", FSussParameter(FName("Sight")));
+			TArray<FSussContext> Contexts;
+			Brain->GenerateContexts(Self, Action, Contexts);
+			TestEqual("Query run count", Q->NumTimesRun, 1);
+
+			Action.Queries[0].Params["Sense"] = FSussParameter(FName("Hearing"));
+			Contexts.Empty();
+			Brain->GenerateContexts(Self, Action, Contexts);
+			TestEqual("Query should run for different name param", Q->NumTimesRun, 2);
+
+			Action.Queries[0].Params["Sense"] = FSussParameter(FName("Sight"));
+			Contexts.Empty();
+			Brain->GenerateContexts(Self, Action, Contexts);
+			TestEqual("Query should have re-used first results", Q->NumTimesRun, 2);
+
+			const FSussQueryCacheStats Stats = Q->GetCacheStats();
+			TestEqual("Cache hits", Stats.Hits - StartStats.Hits, 1u);
+			TestEqual("Cache misses", Stats.Misses - StartStats.Misses, 2u);
+		});
+
+		It("Stale query results can be served while refreshing later", [this]()
+		{
+			AActor* Self = WorldFixture->GetWorld()->SpawnActor<AActor>();
+			auto Brain = Cast<USussBrainComponent>(Self->AddComponentByClass(USussBrainComponent::StaticClass(), false, FTransform::Identity, false));
+			USussTestSingleLocationQueryProvider* Q = USussTestSingleLocationQueryProvider::StaticClass()->GetDefaultObject<USussTestSingleLocationQueryProvider>();
+			Q->NumTimesRun = 0;
+			Q->SetRefreshStaleResultsDeferred(true);
+
+			FSussActionDef Action;
+			Action.Queries.Add(FSussQuery {FGameplayTag::RequestGameplayTag(USussTestSingleLocationQueryProvider::TagName) });
+			TArray<FSussContext> Contexts;
+			Brain->GenerateContexts(Self, Action, Contexts);
+			TestEqual("Query run count", Q->NumTimesRun, 1);
+
+			// Past the 0.5s max frequency, but within the stale age
+			GetSUSS(WorldFixture->GetWorld())->Tick(0.6f);
+			Contexts.Empty();
+			Brain->GenerateContexts(Self, Action, Contexts);
+			TestEqual("Stale results should have been served", Q->NumTimesRun, 1);
+			TestEqual("Number of contexts", Contexts.Num(), 1);
+
+			// Refresh happens on the next tick
+			GetSUSS(WorldFixture->GetWorld())->Tick(0.1f);
+			TestEqual("Query should have been refreshed in tick", Q->NumTimesRun, 2);
+			Contexts.Empty();
+			Brain->GenerateContexts(Self, Action, Contexts);
+			TestEqual("Refreshed results should be re-used", Q->NumTimesRun, 2);
+
+			// Too stale to serve, so runs inline
+			GetSUSS(WorldFixture->GetWorld())->Tick(3);
+			Contexts.Empty();
+			Brain->GenerateContexts(Self, Action, Contexts);
+			TestEqual("Query should have run inline", Q->NumTimesRun, 3);
+
+			Q->SetRefreshStaleResultsDeferred(false);
+		});
+
+		It("Cached query results are invalidated by perception updates", [this]()
+		{
+			AActor* Self = WorldFixture->GetWorld()->SpawnActor<AActor>();
+			auto Brain = Cast<USussBrainComponent>(Self->AddComponentByClass(USussBrainComponent::StaticClass(), false, FTransform::Identity, false));
+			USussTestSingleLocationQueryProvider* Q = USussTestSingleLocationQueryProvider::StaticClass()->GetDefaultObject<USussTestSingleLocationQueryProvider>();
+			Q->NumTimesRun = 0;
+			Q->SetInvalidateOnPerceptionUpdated(true);
+
+			FSussActionDef Action;
+			Action.Queries.Add(FSussQuery {FGameplayTag::RequestGameplayTag(USussTestSingleLocationQueryProvider::TagName) });
+			TArray<FSussContext> Contexts;
+			Brain->GenerateContexts(Self, Action, Contexts);
+			TestEqual("Query run count", Q->NumTimesRun, 1);
+
+			Contexts.Empty();
+			Brain->GenerateContexts(Self, Action, Contexts);
+			TestEqual("Query should have re-used results", Q->NumTimesRun, 1);
+
+			Brain->OnPerceptionUpdated(TArray<AActor*>());
+			Contexts.Empty();
+			Brain->GenerateContexts(Self, Action, Contexts);
+			TestEqual("Query should have run again because of perception", Q->NumTimesRun, 2);
+
+			Contexts.Empty();
+			Brain->GenerateContexts(Self, Action, Contexts);
+			TestEqual("Query should have re-used new results", Q->NumTimesRun, 2);
+
+			Q->SetInvalidateOnPerceptionUpdated(false);
+		});
+
+		It("Query results can be shared by nearby agents", [this]()
+		{
+			UWorld* World = WorldFixture->GetWorld();
+			auto SpawnAt = [World](const FVector& Location)
+			{
+				// Plain actors have no root component, so no location
+				AActor* Actor = World->SpawnActor<AActor>();
+				Actor->SetRootComponent(NewObject<USceneComponent>(Actor));
+				Actor->SetActorLocation(Location);
+				return Actor;
+			};
+			AActor* Self = SpawnAt(FVector(100, 100, 0));
+			auto Brain = Cast<USussBrainComponent>(Self->AddComponentByClass(USussBrainComponent::StaticClass(), false, FTransform::Identity, false));
+			AActor* Near = SpawnAt(FVector(200, 150, 0));
+			auto NearBrain = Cast<USussBrainComponent>(Near->AddComponentByClass(USussBrainComponent::StaticClass(), false, FTransform::Identity, false));
+			AActor* Far = SpawnAt(FVector(5000, 100, 0));
+			auto FarBrain = Cast<USussBrainComponent>(Far->AddComponentByClass(USussBrainComponent::StaticClass(), false, FTransform::Identity, false));
+
+			USussTestSingleLocationQueryProvider* Q = USussTestSingleLocationQueryProvider::StaticClass()->GetDefaultObject<USussTestSingleLocationQueryProvider>();
+			Q->NumTimesRun = 0;
+			Q->SetShareResultsByLocation(true, 500);
+
+			FSussActionDef Action;
+			Action.Queries.Add(FSussQuery {FGameplayTag::RequestGameplayTag(USussTestSingleLocationQueryProvider::TagName) });
+			TArray<FSussContext> Contexts;
+			Brain->GenerateContexts(Self, Action, Contexts);
+			TestEqual("Query run count", Q->NumTimesRun, 1);
+
+			Contexts.Empty();
+			NearBrain->GenerateContexts(Near, Action, Contexts);
+			TestEqual("Nearby agent should have re-used results", Q->NumTimesRun, 1);
+			if (TestEqual("Number of contexts", Contexts.Num(), 1))
+			{
+				TestEqual("Self reference should be the nearby agent", Contexts[0].ControlledActor, Near);
+			}
+
+			Contexts.Empty();
+			FarBrain->GenerateContexts(Far, Action, Contexts);
+			TestEqual("Distant agent should have run the query", Q->NumTimesRun, 2);
+
+			Q->SetShareResultsByLocation(false, 500);
+
+			// Correlated results are shared too
+			USussTestCorrelatedNamedFloatValueQueryProvider* CQ = USussTestCorrelatedNamedFloatValueQueryProvider::StaticClass()->GetDefaultObject<USussTestCorrelatedNamedFloatValueQueryProvider>();
+			CQ->NumTimesRun = 0;
+			CQ->SetShareResultsByLocation(true, 500);
+			CQ->SetInvalidateOnPerceptionUpdated(true);
+
+			FSussActionDef CorrelatedAction;
+			CorrelatedAction.Queries.Add(FSussQuery {FGameplayTag::RequestGameplayTag(USussTestMultipleLocationQueryProvider::TagName) });
+			CorrelatedAction.Queries.Add(FSussQuery {FGameplayTag::RequestGameplayTag(USussTestCorrelatedNamedFloatValueQueryProvider::TagName) });
+			Contexts.Empty();
+			Brain->GenerateContexts(Self, CorrelatedAction, Contexts);
+			// Once per location
+			TestEqual("Correlated query run count", CQ->NumTimesRun, 3);
+
+			// Events on the nearby agent's brain don't invalidate results generated for another agent
+			NearBrain->OnPerceptionUpdated(TArray<AActor*>());
+			Contexts.Empty();
+			NearBrain->GenerateContexts(Near, CorrelatedAction, Contexts);
+			TestEqual("Nearby agent should have re-used correlated results", CQ->NumTimesRun, 3);
+			if (TestEqual("Number of correlated contexts", Contexts.Num(), 4))
+			{
+				TestEqual("Correlated self reference should be the nearby agent", Contexts[0].ControlledActor, Near);
+			}
+
+			// Events on the brain the results were generated for still do
+			Brain->OnPerceptionUpdated(TArray<AActor*>());
+			Contexts.Empty();
+			Brain->GenerateContexts(Self, CorrelatedAction, Contexts);
+			TestEqual("Correlated query should have run again because of perception", CQ->NumTimesRun, 6);
+
+			Contexts.Empty();
+			FarBrain->GenerateContexts(Far, CorrelatedAction, Contexts);
+			TestEqual("Distant agent should have run the correlated query", CQ->NumTimesRun, 9);
+
+			CQ->SetShareResultsByLocation(false, 500);
+			CQ->SetInvalidateOnPerceptionUpdated(false);
+		});
+
+		It("Correlated query caching works per source context", [this]()
+		{
+			AActor* Self = WorldFixture->GetWorld()->SpawnActor<AActor>();
+			auto Brain = Cast<USussBrainComponent>(Self->AddComponentByClass(USussBrainComponent::StaticClass(), false, FTransform::Identity, false));
+			USussTestCorrelatedNamedFloatValueQueryProvider* Q = USussTestCorrelatedNamedFloatValueQueryProvider::StaticClass()->GetDefaultObject<USussTestCorrelatedNamedFloatValueQueryProvider>();
+			Q->NumTimesRun = 0;
+
+			FSussActionDef Action;
+			Action.Queries.Add(FSussQuery {FGameplayTag::RequestGameplayTag(USussTestMultipleLocationQueryProvider::TagName) });
+			Action.Queries.Add(FSussQuery {FGameplayTag::RequestGameplayTag(USussTestCorrelatedNamedFloatValueQueryProvider::TagName) });
+			TArray<FSussContext> Contexts;
+			Brain->GenerateContexts(Self, Action, Contexts);
+			// Once per location
+			TestEqual("Query run count", Q->NumTimesRun, 3);
+			TestEqual("Number of contexts", Contexts.Num(), 4);
+
+			Contexts.Empty();
+			Brain->GenerateContexts(Self, Action, Contexts);
+			TestEqual("Query should have re-used results", Q->NumTimesRun, 3);
+			TestEqual("Number of contexts from cache", Contexts.Num(), 4);
+
+			GetSUSS(WorldFixture->GetWorld())->Tick(1);
+
+			Contexts.Empty();
+			Brain->GenerateContexts(Self, Action, Contexts);
+			TestEqual("Query should have run again because of time", Q->NumTimesRun, 6);
+
+			// No caching
+			Action.Queries[1].MaxFrequency = 0;
+			Contexts.Empty();
+			Brain->GenerateContexts(Self, Action, Contexts);
+			TestEqual("Query should always run with zero frequency", Q->NumTimesRun, 9);
+		});
+
+		It("Query result snapshots are unaffected by re-running the query", [this]()
+		{
+			AActor* Self = WorldFixture->GetWorld()->SpawnActor<AActor>();
+			auto Brain = Cast<USussBrainComponent>(Self->AddComponentByClass(USussBrainComponent::StaticClass(), false, FTransform::Identity, false));
+			USussTestSingleLocationQueryProvider* Q = USussTestSingleLocationQueryProvider::StaticClass()->GetDefaultObject<USussTestSingleLocationQueryProvider>();
+			Q->NumTimesRun = 0;
+
+			const TMap<FName, FSussParameter> Params;
+			const FSussQueryResultsSnapshot Snapshot1 = Q->GetResultsSnapshot(Brain, Self, 0.5f, Params);
+			TestEqual("Query run count", Q->NumTimesRun, 1);
+
+			// Cached, should be the same results
+			const FSussQueryResultsSnapshot Snapshot2 = Q->GetResultsSnapshot(Brain, Self, 0.5f, Params);
+			TestEqual("Query should have re-used results", Q->NumTimesRun, 1);
+			TestEqual("Same version", Snapshot1.Version, Snapshot2.Version);
+			TestTrue("Same results", Snapshot1.Results == Snapshot2.Results);
+
+			GetSUSS(WorldFixture->GetWorld())->Tick(1);
+
+			const FSussQueryResultsSnapshot Snapshot3 = Q->GetResultsSnapshot(Brain, Self, 0.5f, Params);
+			TestEqual("Query should have run again because of time", Q->NumTimesRun, 2);
+			TestNotEqual("New version", Snapshot1.Version, Snapshot3.Version);
+			TestFalse("Held snapshot not overwritten", Snapshot1.Results == Snapshot3.Results);
+			if (TestEqual("Old snapshot still valid", Snapshot1.Get<FVector>().Num(), 1))
+			{
+				TestEqual("Old snapshot location", Snapshot1.Get<FVector>()[0], FVector(10, -20, 50));
+			}
+		});
+
+		It("Consideration inputs with a MaxFrequency are re-used within it", [this]()
+		{
+			UWorld* World = WorldFixture->GetWorld();
+			AActor* Self = World->SpawnActor<AActor>();
+			auto Brain = Cast<USussBrainComponent>(Self->AddComponentByClass(USussBrainComponent::StaticClass(), false, FTransform::Identity, false));
+			USussTestCountingInputProvider* Input = USussTestCountingInputProvider::StaticClass()->GetDefaultObject<USussTestCountingInputProvider>();
+			Input->NumTimesEvaluated = 0;
+
+			FSussConsideration Consideration;
+			Consideration.InputTag = FSussTestQueryTagHolder::Instance.GetTag(USussTestCountingInputProvider::TagName);
+			Consideration.MaxFrequency = 1;
+			FSussContext Ctx1 { Self };
+			Ctx1.Location = FVector(10, -20, 50);
+			FSussContext Ctx2 { Self };
+			Ctx2.Location = FVector(20, 100, -2);
+
+			Brain->EvaluateConsiderationInput(Self, 0, 0, Consideration, Input, Ctx1);
+			TestEqual("Input evaluated", Input->NumTimesEvaluated, 1);
+			Brain->EvaluateConsiderationInput(Self, 0, 0, Consideration, Input, Ctx1);
+			TestEqual("Input should have been re-used", Input->NumTimesEvaluated, 1);
+
+			// Each context, consideration and action has its own value
+			Brain->EvaluateConsiderationInput(Self, 0, 0, Consideration, Input, Ctx2);
+			TestEqual("Input evaluated for another context", Input->NumTimesEvaluated, 2);
+			Brain->EvaluateConsiderationInput(Self, 0, 1, Consideration, Input, Ctx1);
+			TestEqual("Input evaluated for another consideration", Input->NumTimesEvaluated, 3);
+			Brain->EvaluateConsiderationInput(Self, 1, 0, Consideration, Input, Ctx1);
+			TestEqual("Input evaluated for another action", Input->NumTimesEvaluated, 4);
+
+			Brain->EvaluateConsiderationInput(Self, 0, 0, Consideration, Input, Ctx2);
+			Brain->EvaluateConsiderationInput(Self, 0, 1, Consideration, Input, Ctx1);
+			Brain->EvaluateConsiderationInput(Self, 1, 0, Consideration, Input, Ctx1);
+			TestEqual("Inputs should all have been re-used", Input->NumTimesEvaluated, 4);
+
+			// Move time on past MaxFrequency
+			World->TimeSeconds += 1.5;
+			Brain->EvaluateConsiderationInput(Self, 0, 0, Consideration, Input, Ctx1);
+			TestEqual("Input should have been evaluated again because of time", Input->NumTimesEvaluated, 5);
+			Brain->EvaluateConsiderationInput(Self, 0, 0, Consideration, Input, Ctx1);
+			TestEqual("Input should have re-used the new value", Input->NumTimesEvaluated, 5);
+
+			// No caching
+			Consideration.MaxFrequency = 0;
+			Brain->EvaluateConsiderationInput(Self, 0, 0, Consideration, Input, Ctx1);
+			Brain->EvaluateConsiderationInput(Self, 0, 0, Consideration, Input, Ctx1);
+			TestEqual("Input should always be evaluated with zero frequency", Input->NumTimesEvaluated, 7);
+		});
+
+		It("Self-only considerations are evaluated once per action, before generating contexts", [this]()
+		{
+			AActor* Self = WorldFixture->GetWorld()->SpawnActor<AActor>();
+			auto Brain = Cast<USussBrainComponent>(Self->AddComponentByClass(USussBrainComponent::StaticClass(), false, FTransform::Identity, false));
+			USussTestSelfValueInputProvider* SelfInput = USussTestSelfValueInputProvider::StaticClass()->GetDefaultObject<USussTestSelfValueInputProvider>();
+			SelfInput->Value = 0;
+			SelfInput->NumTimesEvaluated = 0;
+			USussTestCountingInputProvider* ContextInput = USussTestCountingInputProvider::StaticClass()->GetDefaultObject<USussTestCountingInputProvider>();
+			ContextInput->Value = 0.5f;
+			ContextInput->NumTimesEvaluated = 0;
+			USussTestMultipleLocationQueryProvider* Q = USussTestMultipleLocationQueryProvider::StaticClass()->GetDefaultObject<USussTestMultipleLocationQueryProvider>();
+			Q->NumTimesRun = 0;
+
+			// There's no action class registered for the test tag
+			AddExpectedError(TEXT("Action Class for tag"), EAutomationExpectedErrorFlags::Contains, 0);
+			AddExpectedError(TEXT("No action class for tag"), EAutomationExpectedErrorFlags::Contains, 0);
+
+			FSussActionDef Action;
+			Action.ActionTag = FSussTestQueryTagHolder::Instance.GetTag("Suss.Action.Test.SelfOnly");
+			FSussQuery Query {FGameplayTag::RequestGameplayTag(USussTestMultipleLocationQueryProvider::TagName) }; // 3 items
+			// Always run, so we can tell when it does
+			Query.MaxFrequency = 0;
+			Action.Queries.Add(Query);
+			// Listed first, to show that Self-only considerations are still evaluated first
+			FSussConsideration ContextConsideration;
+			ContextConsideration.InputTag = FSussTestQueryTagHolder::Instance.GetTag(USussTestCountingInputProvider::TagName);
+			Action.Considerations.Add(ContextConsideration);
+			FSussConsideration SelfConsideration;
+			SelfConsideration.InputTag = FSussTestQueryTagHolder::Instance.GetTag(USussTestSelfValueInputProvider::TagName);
+			Action.Considerations.Add(SelfConsideration);
+			FSussBrainConfig Config;
+			Config.ActionDefs.Add(Action);
+			Brain->SetBrainConfig(Config);
+
+			Brain->Update();
+			TestEqual("Self consideration evaluated", SelfInput->NumTimesEvaluated, 1);
+			TestEqual("Query should not have run when Self scored zero", Q->NumTimesRun, 0);
+			TestEqual("Context consideration should not have been evaluated", ContextInput->NumTimesEvaluated, 0);
+			TestEqual("No candidates", Brain->CandidateActions.Num(), 0);
+
+			SelfInput->Value = 0.5f;
+			Brain->Update();
+			TestEqual("Self consideration evaluated once for all contexts", SelfInput->NumTimesEvaluated, 2);
+			TestEqual("Query should have run", Q->NumTimesRun, 1);
+			TestEqual("Context consideration evaluated per context", ContextInput->NumTimesEvaluated, 3);
+			if (TestEqual("One candidate per context", Brain->CandidateActions.Num(), 3))
+			{
+				for (const auto& Candidate : Brain->CandidateActions)
+				{
+					TestEqual("Candidate score includes Self score", Candidate.Score, 0.25f);
+				}
+			}
+
+			SelfInput->Value = 1;
+			ContextInput->Value = 1;
+		});
+
+		It("Contexts failing gate considerations are removed before continuous considerations", [this]()
+		{
+			UWorld* World = WorldFixture->GetWorld();
+			USussTestCountingInputProvider* ContinuousInput = USussTestCountingInputProvider::StaticClass()->GetDefaultObject<USussTestCountingInputProvider>();
+			ContinuousInput->Value = 0.5f;
+
+			// There's no action class registered for the test tag
+			AddExpectedError(TEXT("Action Class for tag"), EAutomationExpectedErrorFlags::Contains, 0);
+			AddExpectedError(TEXT("No action class for tag"), EAutomationExpectedErrorFlags::Contains, 0);
+
+			FSussActionDef Action;
+			Action.ActionTag = FSussTestQueryTagHolder::Instance.GetTag("Suss.Action.Test.Gated");
+			Action.Queries.Add(FSussQuery {FGameplayTag::RequestGameplayTag(USussTestMultipleLocationQueryProvider::TagName) }); // 3 items
+			// Listed first, so without gating it's evaluated in every context
+			FSussConsideration ContinuousConsideration;
+			ContinuousConsideration.InputTag = FSussTestQueryTagHolder::Instance.GetTag(USussTestCountingInputProvider::TagName);
+			Action.Considerations.Add(ContinuousConsideration);
+			// Location X of 10 & 20 score 0.1 & 0.2, -40 scores zero
+			FSussConsideration GateConsideration;
+			GateConsideration.InputTag = FSussTestQueryTagHolder::Instance.GetTag(USussTestLocationXInputProvider::TagName);
+			GateConsideration.BookendMax = FSussParameter(100.0f);
+			Action.Considerations.Add(GateConsideration);
+
+			// Separate brains, so that the first choice doesn't become the current action of the second
+			auto EvaluateWithGate = [World, &Action, ContinuousInput](bool bIsGate)
+			{
+				AActor* Self = World->SpawnActor<AActor>();
+				auto Brain = Cast<USussBrainComponent>(Self->AddComponentByClass(USussBrainComponent::StaticClass(), false, FTransform::Identity, false));
+				Action.Considerations[1].bIsGate = bIsGate;
+				FSussBrainConfig Config;
+				Config.ActionDefs.Add(Action);
+				Brain->SetBrainConfig(Config);
+				ContinuousInput->NumTimesEvaluated = 0;
+				Brain->Update();
+				return Brain;
+			};
+
+			const auto UngatedBrain = EvaluateWithGate(false);
+			TestEqual("Continuous consideration evaluated in every context without a gate", ContinuousInput->NumTimesEvaluated, 3);
+
+			const auto GatedBrain = EvaluateWithGate(true);
+			TestEqual("Continuous consideration only evaluated in contexts passing the gate", ContinuousInput->NumTimesEvaluated, 2);
+
+			if (TestEqual("Candidates without a gate", UngatedBrain->CandidateActions.Num(), 2) &&
+				TestEqual("Candidates with a gate", GatedBrain->CandidateActions.Num(), 2))
+			{
+				for (int i = 0; i < 2; ++i)
+				{
+					TestEqual("Candidate location", GatedBrain->CandidateActions[i].Context.Location, UngatedBrain->CandidateActions[i].Context.Location);
+					TestEqual("Candidate score should be unaffected by gating", GatedBrain->CandidateActions[i].Score, UngatedBrain->CandidateActions[i].Score);
+				}
+				TestEqual("Candidate 0 score", GatedBrain->CandidateActions[0].Score, 0.1f);
+				TestEqual("Candidate 1 score", GatedBrain->CandidateActions[1].Score, 0.05f);
+			}
+
+			ContinuousInput->Value = 1;
+		});
+
+		It("Action groups which score zero gate their actions", [this]()
+		{
+			AActor* Self = WorldFixture->GetWorld()->SpawnActor<AActor>();
+			auto Brain = Cast<USussBrainComponent>(Self->AddComponentByClass(USussBrainComponent::StaticClass(), false, FTransform::Identity, false));
+			USussTestSelfValueInputProvider* Input = USussTestSelfValueInputProvider::StaticClass()->GetDefaultObject<USussTestSelfValueInputProvider>();
+			Input->Value = 0;
+
+			// There's no action class registered for the test tag
+			AddExpectedError(TEXT("Action Class for tag"), EAutomationExpectedErrorFlags::Contains, 0);
+			AddExpectedError(TEXT("No action class for tag"), EAutomationExpectedErrorFlags::Contains, 0);
+
+			FSussActionGroup Group;
+			Group.Description = "Gate";
+			FSussConsideration Consideration;
+			Consideration.InputTag = FSussTestQueryTagHolder::Instance.GetTag(USussTestSelfValueInputProvider::TagName);
+			Group.Considerations.Add(Consideration);
+			FSussActionDef Action;
+			Action.ActionTag = FSussTestQueryTagHolder::Instance.GetTag("Suss.Action.Test.Grouped");
+			Group.ActionDefs.Add(Action);
+			FSussBrainConfig Config;
+			Config.ActionGroups.Add(Group);
+			Brain->SetBrainConfig(Config);
+
+			Brain->Update();
+			TestEqual("Group scored zero, no candidates", Brain->CandidateActions.Num(), 0);
+
+			Input->Value = 0.5f;
+			Brain->Update();
+			if (TestEqual("Group scored, one candidate", Brain->CandidateActions.Num(), 1))
+			{
+				TestEqual("Candidate score includes group score", Brain->CandidateActions[0].Score, 0.5f);
+				TestEqual("Group context is Self", Brain->CandidateActions[0].Context.ControlledActor, Self);
+			}
+
+			Input->Value = 1;
+		});
+
+		It("Action group queries override member actions' queries", [this]()
+		{
+			AActor* Self = WorldFixture->GetWorld()->SpawnActor<AActor>();
+			auto Brain = Cast<USussBrainComponent>(Self->AddComponentByClass(USussBrainComponent::StaticClass(), false, FTransform::Identity, false));
+			USussTestSingleLocationQueryProvider* Q = USussTestSingleLocationQueryProvider::StaticClass()->GetDefaultObject<USussTestSingleLocationQueryProvider>();
+			Q->NumTimesRun = 0;
+
+			AddExpectedError(TEXT("own queries will be ignored"), EAutomationExpectedErrorFlags::Contains, 1);
+			AddExpectedError(TEXT("Action Class for tag"), EAutomationExpectedErrorFlags::Contains, 0);
+			AddExpectedError(TEXT("No action class for tag"), EAutomationExpectedErrorFlags::Contains, 0);
+
+			FSussActionGroup Group;
+			Group.Description = "Locations";
+			Group.Queries.Add(FSussQuery {FGameplayTag::RequestGameplayTag(USussTestMultipleLocationQueryProvider::TagName) }); // 3 items
+			FSussConsideration Consideration;
+			Consideration.InputTag = FSussTestQueryTagHolder::Instance.GetTag(USussTestLocationXInputProvider::TagName);
+			Consideration.BookendMax = FSussParameter(100.0f);
+			Group.Considerations.Add(Consideration);
+			FSussActionDef Action;
+			Action.ActionTag = FSussTestQueryTagHolder::Instance.GetTag("Suss.Action.Test.Grouped");
+			// Should be ignored in favour of the group query
+			Action.Queries.Add(FSussQuery {FGameplayTag::RequestGameplayTag(USussTestSingleLocationQueryProvider::TagName) });
+			Group.ActionDefs.Add(Action);
+			FSussBrainConfig Config;
+			Config.ActionGroups.Add(Group);
+			Brain->SetBrainConfig(Config);
+
+			Brain->Update();
+			TestEqual("Action's own query should not have run", Q->NumTimesRun, 0);
+			// Location X of 10 & 20 score 0.1 & 0.2, -40 scores zero in the group and is dropped
+			if (TestEqual("Candidates from group contexts", Brain->CandidateActions.Num(), 2))
+			{
+				// Candidates are sorted highest score first
+				TestEqual("Candidate 0 location", Brain->CandidateActions[0].Context.Location, FVector(20, 100, -2));
+				TestEqual("Candidate 0 score", Brain->CandidateActions[0].Score, 0.2f);
+				TestEqual("Candidate 1 location", Brain->CandidateActions[1].Context.Location, FVector(10, -20, 50));
+				TestEqual("Candidate 1 score", Brain->CandidateActions[1].Score, 0.1f);
+			}
+		});
+
+		It("Action groups without queries warn about considerations which need a context", [this]()
+		{
+			AActor* Self = WorldFixture->GetWorld()->SpawnActor<AActor>();
+			auto Brain = Cast<USussBrainComponent>(Self->AddComponentByClass(USussBrainComponent::StaticClass(), false, FTransform::Identity, false));
+
+			AddExpectedError(TEXT("has no queries, but consideration"), EAutomationExpectedErrorFlags::Contains, 1);
+
+			FSussActionGroup Group;
+			Group.Description = "NoQueries";
+			FSussConsideration SelfConsideration;
+			SelfConsideration.InputTag = FSussTestQueryTagHolder::Instance.GetTag(USussTestSelfValueInputProvider::TagName);
+			Group.Considerations.Add(SelfConsideration);
+			FSussConsideration LocationConsideration;
+			LocationConsideration.InputTag = FSussTestQueryTagHolder::Instance.GetTag(USussTestLocationXInputProvider::TagName);
+			Group.Considerations.Add(LocationConsideration);
+			FSussBrainConfig Config;
+			Config.ActionGroups.Add(Group);
+			Brain->SetBrainConfig(Config);
+		});
+
 	});
 }
 
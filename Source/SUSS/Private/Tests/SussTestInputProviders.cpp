@@ -0,0 +1,5 @@
+﻿#include "SussTestInputProviders.h"
+
+const FName USussTestSelfValueInputProvider::TagName("Suss.Input.Test.SelfValue");
+const FName USussTestLocationXInputProvider::TagName("Suss.Input.Test.LocationX");
+const FName USussTestCountingInputProvider::TagName("Suss.Input.Test.Counting");
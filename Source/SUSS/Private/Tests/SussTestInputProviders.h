@@ -0,0 +1,116 @@
+﻿#pragma once
+
+#include "CoreMinimal.h"
+#include "SussInputProvider.h"
+#include "SussTestQueryProviders.h"
+#include "SussTestInputProviders.generated.h"
+
+/// Input which only reads Self, and returns a value set by the test
+UCLASS()
+class USussTestSelfValueInputProvider : public USussInputProvider
+{
+	GENERATED_BODY()
+public:
+	static const FName TagName;
+
+	float Value = 1;
+	mutable int NumTimesEvaluated = 0;
+
+	USussTestSelfValueInputProvider()
+	{
+		ContextElements = static_cast<int32>(ESussInputContextElements::Self);
+	}
+
+	// Because we're using temp tags we can't store this in InputTag at startup (StaticClass is too early)
+	virtual FGameplayTag GetInputTag() const override
+	{
+		return FSussTestQueryTagHolder::Instance.GetTag(TagName);
+	}
+
+	virtual float Evaluate_Implementation(const class USussBrainComponent* Brain,
+		const FSussContext& Context,
+		const TMap<FName, FSussParameter>& Parameters) const override
+	{
+		++NumTimesEvaluated;
+		return Value;
+	}
+};
+
+/// Input which returns the X component of the context location
+UCLASS()
+class USussTestLocationXInputProvider : public USussInputProvider
+{
+	GENERATED_BODY()
+public:
+	static const FName TagName;
+
+	USussTestLocationXInputProvider()
+	{
+		ContextElements = static_cast<int32>(ESussInputContextElements::Location);
+	}
+
+	// Because we're using temp tags we can't store this in InputTag at startup (StaticClass is too early)
+	virtual FGameplayTag GetInputTag() const override
+	{
+		return FSussTestQueryTagHolder::Instance.GetTag(TagName);
+	}
+
+	virtual float Evaluate_Implementation(const class USussBrainComponent* Brain,
+		const FSussContext& Context,
+		const TMap<FName, FSussParameter>& Parameters) const override
+	{
+		return Context.Location.X;
+	}
+};
+
+/// Input which depends on the context location, returns a value set by the test, and counts how often it's evaluated
+UCLASS()
+class USussTestCountingInputProvider : public USussInputProvider
+{
+	GENERATED_BODY()
+public:
+	static const FName TagName;
+
+	float Value = 1;
+	mutable int NumTimesEvaluated = 0;
+
+	USussTestCountingInputProvider()
+	{
+		ContextElements = static_cast<int32>(ESussInputContextElements::Location);
+	}
+
+	// Because we're using temp tags we can't store this in InputTag at startup (StaticClass is too early)
+	virtual FGameplayTag GetInputTag() const override
+	{
+		return FSussTestQueryTagHolder::Instance.GetTag(TagName);
+	}
+
+	virtual float Evaluate_Implementation(const class USussBrainComponent* Brain,
+		const FSussContext& Context,
+		const TMap<FName, FSussParameter>& Parameters) const override
+	{
+		++NumTimesEvaluated;
+		return Value;
+	}
+};
+
+inline void RegisterTestInputProviders(UWorld* World)
+{
+	if (auto SUSS = GetSUSS(World))
+	{
+		SUSS->RegisterInputProviderClass(USussTestSelfValueInputProvider::StaticClass());
+		SUSS->RegisterInputProviderClass(USussTestLocationXInputProvider::StaticClass());
+		SUSS->RegisterInputProviderClass(USussTestCountingInputProvider::StaticClass());
+	}
+}
+
+/// Must be called before UnregisterTestQueryProviders, which deletes the test tags
+inline void UnregisterTestInputProviders(UWorld* World)
+{
+	if (auto SUSS = GetSUSS(World))
+	{
+		SUSS->UnregisterInputProviderClass(USussTestSelfValueInputProvider::StaticClass());
+		SUSS->UnregisterInputProviderClass(USussTestLocationXInputProvider::StaticClass());
+		SUSS->UnregisterInputProviderClass(USussTestCountingInputProvider::StaticClass());
+	}
+}
@@ -8,6 +8,7 @@ const FName USussTestNamedStructSharedValueQueryProvider::TagName("Suss.Query.Te
 const FName USussTestNamedStructRawPointerQueryProvider::TagName("Suss.Query.Test.Named.Struct.NonShared");
 const FName USussTestCorrelatedNamedFloatValueQueryProvider::TagName("Suss.Query.Test.Named.Float.Correlated");
 const FName USussTestZeroTargetsQueryProvider::TagName("Suss.Query.Test.Targets.None");
+const FName USussTestLimitsLocationQueryProvider::TagName("Suss.Query.Location.Test.Limits");
 
 FSussTestQueryTagHolder FSussTestQueryTagHolder::Instance;
 
@@ -43,6 +43,14 @@ public:
 	}
 
 	int NumTimesRun = 0;
+
+	void SetRefreshStaleResultsDeferred(bool bDeferred) { bRefreshStaleResultsDeferred = bDeferred; }
+	void SetInvalidateOnPerceptionUpdated(bool bInvalidate) { bInvalidateOnPerceptionUpdated = bInvalidate; }
+	void SetShareResultsByLocation(bool bShare, float CellSize)
+	{
+		bShareResultsByLocation = bShare;
+		SharedResultsCellSize = CellSize;
+	}
 protected:
 	
 
@@ -76,6 +84,7 @@ class USussTestMultipleLocationQueryProvider : public USussLocationQueryProvider
 	GENERATED_BODY()
 public:
 	static const FName TagName;
+	int NumTimesRun = 0;
 
 	USussTestMultipleLocationQueryProvider()
 	{
@@ -96,10 +105,72 @@ protected:
 		OutResults.Add(FVector(10, -20, 50));
 		OutResults.Add(FVector(20, 100, -2));
 		OutResults.Add(FVector(-40, 220, 750));
+
+		++NumTimesRun;
 	}
 };
 
 
+/// Location query which can apply result limits itself, and can make a nested request to itself while executing
+UCLASS()
+class USussTestLimitsLocationQueryProvider : public USussLocationQueryProvider
+{
+	GENERATED_BODY()
+public:
+	static const FName TagName;
+
+	/// If true, limits are applied while generating results; results are then always furthest first, whatever sort
+	/// was requested, so we can tell whether they were applied again afterwards
+	bool bApplyLimits = false;
+	/// The limits given to the last execution
+	FSussQueryResultLimits LastLimits;
+
+	USussTestLimitsLocationQueryProvider()
+	{
+		bUseCachedResults = false;
+	}
+	// Because we're using temp tags we can't store this in QueryTag at startup (StaticClass is too early)
+	virtual FGameplayTag GetQueryTag() const override
+	{
+		return FSussTestQueryTagHolder::Instance.GetTag(TagName);
+	}
+protected:
+
+	virtual void ExecuteQueryWithLimits(USussBrainComponent* Brain,
+		AActor* Self,
+		const TMap<FName, FSussParameter>& Params,
+		const FSussContext& Context,
+		FSussQueryResultLimits& Limits,
+		TArray<FVector>& OutResults) override
+	{
+		if (Params.Contains("Nested"))
+		{
+			// Re-entrant request with no limits, which mustn't affect ours
+			TArray<FVector> NestedResults;
+			GetResultsInContext(Brain, Self, Context, TMap<FName, FSussParameter>(), NestedResults);
+		}
+		LastLimits = Limits;
+
+		if (bApplyLimits)
+		{
+			OutResults.Add(FVector(-40, 220, 750));
+			OutResults.Add(FVector(20, 100, -2));
+			OutResults.Add(FVector(10, -20, 50));
+			if (Limits.MaxResults > 0 && OutResults.Num() > Limits.MaxResults)
+			{
+				OutResults.SetNum(Limits.MaxResults);
+			}
+			Limits.bApplied = true;
+		}
+		else
+		{
+			OutResults.Add(FVector(10, -20, 50));
+			OutResults.Add(FVector(20, 100, -2));
+			OutResults.Add(FVector(-40, 220, 750));
+		}
+	}
+};
+
 UCLASS()
 class USussTestZeroTargetsQueryProvider : public USussTargetQueryProvider
 {
@@ -284,6 +355,7 @@ class USussTestCorrelatedNamedFloatValueQueryProvider : public USussNamedValueQu
 	GENERATED_BODY()
 public:
 	static const FName TagName;
+	int NumTimesRun = 0;
 
 	USussTestCorrelatedNamedFloatValueQueryProvider()
 	{
@@ -296,6 +368,13 @@ public:
 	{
 		return FSussTestQueryTagHolder::Instance.GetTag(TagName);
 	}
+
+	void SetInvalidateOnPerceptionUpdated(bool bInvalidate) { bInvalidateOnPerceptionUpdated = bInvalidate; }
+	void SetShareResultsByLocation(bool bShare, float CellSize)
+	{
+		bShareResultsByLocation = bShare;
+		SharedResultsCellSize = CellSize;
+	}
 protected:
 	virtual void ExecuteQuery(USussBrainComponent* Brain,
 		AActor* Self,
@@ -321,7 +400,8 @@ protected:
 			OutResults.Add(static_cast<float>(Context.Location.Z));
 			
 		}
-		
+
+		++NumTimesRun;
 	}
 };
 
@@ -338,6 +418,7 @@ inline void RegisterTestQueryProviders(UWorld* World)
 		SUSS->RegisterQueryProviderClass(USussTestNamedStructRawPointerQueryProvider::StaticClass());
 		SUSS->RegisterQueryProviderClass(USussTestCorrelatedNamedFloatValueQueryProvider::StaticClass());
 		SUSS->RegisterQueryProviderClass(USussTestZeroTargetsQueryProvider::StaticClass());
+		SUSS->RegisterQueryProviderClass(USussTestLimitsLocationQueryProvider::StaticClass());
 	}
 }
 
@@ -353,6 +434,7 @@ inline void UnregisterTestQueryProviders(UWorld* World)
 		SUSS->UnregisterQueryProviderClass(USussTestNamedStructRawPointerQueryProvider::StaticClass());
 		SUSS->UnregisterQueryProviderClass(USussTestCorrelatedNamedFloatValueQueryProvider::StaticClass());
 		SUSS->UnregisterQueryProviderClass(USussTestZeroTargetsQueryProvider::StaticClass());
+		SUSS->UnregisterQueryProviderClass(USussTestLimitsLocationQueryProvider::StaticClass());
 	}
 
 	FSussTestQueryTagHolder::Instance.UnregisterTags();
@@ -13,6 +13,8 @@ UE_DECLARE_GAMEPLAY_TAG_EXTERN(TAG_SussInputTargetDistance2D);
 UE_DECLARE_GAMEPLAY_TAG_EXTERN(TAG_SussInputLocationDistance2D);
 UE_DECLARE_GAMEPLAY_TAG_EXTERN(TAG_SussInputTargetDistancePath);
 UE_DECLARE_GAMEPLAY_TAG_EXTERN(TAG_SussInputLocationDistancePath);
+UE_DECLARE_GAMEPLAY_TAG_EXTERN(TAG_SussInputTargetDistancePathApprox);
+UE_DECLARE_GAMEPLAY_TAG_EXTERN(TAG_SussInputLocationDistancePathApprox);
 
 /**
  * Input that provides the distance from the AI to a given target 
@@ -78,6 +80,8 @@ public:
  * Input that provides the distance from the AI to a given target along available paths.
  * Parameters allowed:
  *  - AllowPartialPath (bool, default false)
+ * Path distances are cached and found asynchronously by USussPathDistanceWorldSubsystem, see the path distance
+ * settings.
  */
 UCLASS()
 class SUSS_API USussTargetDistancePathInputProvider : public USussInputProvider
@@ -95,6 +99,8 @@ public:
  * Input that provides the distance from the AI to a given location along available paths
  * Parameters allowed:
  *  - AllowPartialPath (bool, default false)
+ * Path distances are cached and found asynchronously by USussPathDistanceWorldSubsystem, see the path distance
+ * settings.
  */
 UCLASS()
 class SUSS_API USussLocationDistancePathInputProvider : public USussInputProvider
@@ -107,3 +113,36 @@ public:
 		const FSussContext& Context,
 		const TMap<FName, FSussParameter>& Parameters) const override;
 };
+
+/**
+ * Input that provides an approximate distance from the AI to a given target along available paths, using a coarse
+ * graph over the navmesh. Far cheaper than Suss.Input.Distance.ToTargetPath and fine for ranking targets, but not exact.
+ */
+UCLASS()
+class SUSS_API USussTargetDistancePathApproxInputProvider : public USussInputProvider
+{
+	GENERATED_BODY()
+
+public:
+	USussTargetDistancePathApproxInputProvider();
+	virtual float Evaluate_Implementation(const class USussBrainComponent* Brain,
+		const FSussContext& Context,
+		const TMap<FName, FSussParameter>& Parameters) const override;
+};
+
+/**
+ * Input that provides an approximate distance from the AI to a given location along available paths, using a coarse
+ * graph over the navmesh. Far cheaper than Suss.Input.Distance.ToLocationPath and fine for ranking candidate locations,
+ * but not exact.
+ */
+UCLASS()
+class SUSS_API USussLocationDistancePathApproxInputProvider : public USussInputProvider
+{
+	GENERATED_BODY()
+
+public:
+	USussLocationDistancePathApproxInputProvider();
+	virtual float Evaluate_Implementation(const class USussBrainComponent* Brain,
+		const FSussContext& Context,
+		const TMap<FName, FSussParameter>& Parameters) const override;
+};
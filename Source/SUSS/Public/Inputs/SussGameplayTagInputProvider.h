@@ -56,6 +56,8 @@ class SUSS_API USussGameplayTagSelfInputProvider : public USussGameplayTagInputP
 {
 	GENERATED_BODY()
 public:
+	USussGameplayTagSelfInputProvider();
+
 	virtual float Evaluate_Implementation(const class USussBrainComponent* Brain, const FSussContext& Context,
 		const TMap<FName, FSussParameter>& Parameters) const override;
 };
@@ -68,6 +70,8 @@ class SUSS_API USussGameplayTagTargetInputProvider : public USussGameplayTagInpu
 {
 	GENERATED_BODY()
 public:
+	USussGameplayTagTargetInputProvider();
+
 	virtual float Evaluate_Implementation(const class USussBrainComponent* Brain, const FSussContext& Context,
 		const TMap<FName, FSussParameter>& Parameters) const override;
 };
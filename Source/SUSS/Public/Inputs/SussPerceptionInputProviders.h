@@ -5,6 +5,7 @@
 #include "CoreMinimal.h"
 #include "NativeGameplayTags.h"
 #include "SussInputProvider.h"
+#include "WorldCollision.h"
 #include "SussPerceptionInputProviders.generated.h"
 
 UE_DECLARE_GAMEPLAY_TAG_EXTERN(TAG_SussInputSelfSightRange);
@@ -39,12 +40,109 @@ public:
 };
 
 /**
- * Input providing the a line of sight score to target
+ * Input providing the a line of sight score to target.
+ * If the agent's sight perception has recently seen the target that's used rather than tracing again.
+ * Results are cached per self/target pair so that repeated evaluations over a short period don't trace again, and
+ * refreshes can be run as async traces, in which case the last known result is returned until the trace completes.
  */
 UCLASS()
 class SUSS_API USussLineOfSightToTargetInputProvider : public USussInputProvider
 {
 	GENERATED_BODY()
+protected:
+	/// Whether to answer from the agent's sight perception when it has recently successfully sensed the target, rather
+	/// than tracing again. Sight perception already traces to every target in range, so this removes most duplicate
+	/// traces; we only trace when the target isn't currently seen. Note that sight perception uses its own trace
+	/// channel. Not used for sphere traces (the 'Radius' parameter), since sight perception only uses line traces.
+	UPROPERTY(EditDefaultsOnly, BlueprintReadOnly)
+	bool bUseSightPerception = true;
+
+	/// When bUseSightPerception is enabled, the maximum age in seconds of a successfully sensed sight stimulus for it
+	/// to be used as line of sight
+	UPROPERTY(EditDefaultsOnly, BlueprintReadOnly, meta=(EditCondition="bUseSightPerception"))
+	float MaxSightStimulusAge = 0.5f;
+
+	/// How long in seconds a line of sight result for a self/target pair can be re-used before tracing again.
+	/// 0 disables caching, so every evaluation traces synchronously.
+	UPROPERTY(EditDefaultsOnly, BlueprintReadOnly)
+	float CachedResultLifetime = 0.1f;
+
+	/// A cached result is also discarded if the eye position of self or the location of the target has moved further
+	/// than this distance since it was traced
+	UPROPERTY(EditDefaultsOnly, BlueprintReadOnly)
+	float CachedResultMaxMovement = 50;
+
+	/// Whether to refresh cached results using async traces. While the trace is pending the last known result is
+	/// returned, so decisions may be made on results which are a frame old. The first request for a self/target pair
+	/// is always traced synchronously so that there is a real result to return.
+	UPROPERTY(EditDefaultsOnly, BlueprintReadOnly, meta=(EditCondition="CachedResultLifetime > 0"))
+	bool bAsyncTraces = true;
+
+	struct FLineOfSightCacheKey
+	{
+		TObjectKey<AActor> Self;
+		TObjectKey<AActor> Target;
+		float Radius = 0;
+
+		FLineOfSightCacheKey() {}
+		FLineOfSightCacheKey(const AActor* InSelf, const AActor* InTarget, float InRadius)
+			: Self(InSelf), Target(InTarget), Radius(InRadius) {}
+
+		bool operator==(const FLineOfSightCacheKey& Other) const
+		{
+			return Self == Other.Self && Target == Other.Target && Radius == Other.Radius;
+		}
+
+		friend uint32 GetTypeHash(const FLineOfSightCacheKey& Key)
+		{
+			return HashCombine(HashCombine(GetTypeHash(Key.Self), GetTypeHash(Key.Target)), GetTypeHash(Key.Radius));
+		}
+	};
+
+	struct FLineOfSightCacheEntry
+	{
+		/// Trace start & end which the result (or the pending trace) is for
+		FVector Start = FVector::ZeroVector;
+		FVector End = FVector::ZeroVector;
+		/// Time that the current result was requested
+		double Time = 0;
+		double LastUsedTime = 0;
+		/// Time that the pending trace was requested
+		double PendingTime = 0;
+		FTraceHandle PendingTrace;
+		bool bPending = false;
+		bool bHasLineOfSight = false;
+	};
+
+	/// Cached results per self/target pair. Inputs are evaluated on the game thread so no locking is needed.
+	mutable TMap<FLineOfSightCacheKey, FLineOfSightCacheEntry> CachedResults;
+	mutable double LastCachePurgeTime = 0;
+
+	/// How long cached results can go without being requested before they're removed
+	float UnusedCacheEntryLifetime = 5;
+	/// How long to wait for an async trace before assuming it has been lost (e.g. the world was torn down)
+	float PendingTraceTimeout = 1;
+
+	bool IsRecentlySeenBySightPerception(const USussBrainComponent* Brain, const AActor* Target) const;
+	bool TraceLineOfSight(const USussBrainComponent* Brain,
+	                      const FVector& Start,
+	                      const FVector& End,
+	                      float Radius,
+	                      const AActor* Self,
+	                      const AActor* Target) const;
+	void RequestAsyncTrace(const FLineOfSightCacheKey& Key,
+	                       FLineOfSightCacheEntry& Entry,
+	                       UWorld* World,
+	                       const FVector& Start,
+	                       const FVector& End,
+	                       float Radius,
+	                       const AActor* Self,
+	                       const AActor* Target,
+	                       double Now) const;
+	void OnAsyncTraceFinished(const FTraceHandle& Handle, FTraceDatum& Datum, FLineOfSightCacheKey Key);
+	bool IsCachedResultValid(const FLineOfSightCacheEntry& Entry, const FVector& Start, const FVector& End, double Now) const;
+	void PurgeCache(double Now) const;
+
 public:
 	USussLineOfSightToTargetInputProvider();
 	virtual float Evaluate_Implementation(const class USussBrainComponent* Brain, const FSussContext& Context,
@@ -33,6 +33,16 @@ protected:
 	UPROPERTY(EditDefaultsOnly, Category=Query)
 	float MinScore = 0;
 
+	/// If true, the EQS query is run asynchronously so that EQS can time-slice it over several frames, rather than
+	/// running it in full during the brain update. Until the results arrive the previous results are used (or no
+	/// results the first time), then the brain is asked to update again. Only applies to uncorrelated queries.
+	UPROPERTY(EditDefaultsOnly, Category=Query, meta=(EditCondition="!bIsCorrelatedWithContext"))
+	bool bRunAsync = false;
+
+	/// EQS params resolved once for a batch of correlated queries, when bUseBatchQueryParams is set
+	TArray<FEnvNamedValue> BatchQueryParams;
+	bool bUseBatchQueryParams = false;
+
 public:
 	
 #if WITH_EDITOR
@@ -47,6 +57,29 @@ protected:
 	                                        const TMap<FName, FSussParameter>& Params,
 	                                        const FSussContext& Context);
 	bool ShouldIncludeResult(const FEnvQueryItem& Item) const;
+	void BuildQueryParams(const TMap<FName, FSussParameter>& Params, TArray<FEnvNamedValue>& OutQueryParams) const;
+
+	virtual bool ShouldExecuteQueryAsync() const override { return bRunAsync && !bIsCorrelatedWithContext; }
+	virtual bool ExecuteQueryAsync(USussBrainComponent* Brain, AActor* Self, const FSussQueryCacheKey& Key, FSussCachedQueryResults& Entry) override;
+	void OnAsyncQueryFinished(TSharedPtr<FEnvQueryResult> Result, FSussQueryCacheKey Key, TWeakObjectPtr<USussBrainComponent> Brain);
+	/// Initialise OutResults to the right type and add the results of a completed EQS query, if not null
+	virtual void WriteEQSResults(const FEnvQueryResult* Result, TSussResultsArray& OutResults) {}
+
+	template<typename T>
+	void ExecuteEQSQueryInContexts(USussBrainComponent* Brain,
+	                               AActor* Self,
+	                               TArrayView<const FSussContext> Contexts,
+	                               const TMap<FName, FSussParameter>& Params,
+	                               const FSussQueryResultLimits& Limits,
+	                               TArray<T>& OutResults,
+	                               TArray<int32>& OutResultCounts)
+	{
+		// Params are the same for every context in the batch, so only resolve them once
+		BuildQueryParams(Params, BatchQueryParams);
+		bUseBatchQueryParams = true;
+		ExecuteQueryInEachContext(Brain, Self, Contexts, Params, Limits, OutResults, OutResultCounts);
+		bUseBatchQueryParams = false;
+	}
 };
 
 /// Subclass this to provide a EQS-powered query which returns targets (actors)
@@ -56,8 +89,18 @@ class USussEQSTargetQueryProvider : public USussEQSQueryProvider
 	GENERATED_BODY()
 protected:
 	virtual void ExecuteQuery(USussBrainComponent* Brain, AActor* Self, const TMap<FName, FSussParameter>& Params, const FSussContext& BaseContext, TArray<TWeakObjectPtr<AActor>>& OutResults);
+	void AppendEQSResults(const FEnvQueryResult& Result, TArray<TWeakObjectPtr<AActor>>& OutResults) const;
 
-	virtual void ExecuteQueryInternal(USussBrainComponent* Brain, AActor* Self, const TMap<FName, FSussParameter>& Params, TSussResultsArray& OutResults) override final
+	virtual void WriteEQSResults(const FEnvQueryResult* Result, TSussResultsArray& OutResults) override
+	{
+		InitResults<TWeakObjectPtr<AActor>>(OutResults);
+		if (Result)
+		{
+			AppendEQSResults(*Result, GetResultsArray<TWeakObjectPtr<AActor>>(OutResults));
+		}
+	}
+
+	virtual void ExecuteQueryInternal(USussBrainComponent* Brain, AActor* Self, const TMap<FName, FSussParameter>& Params, FSussQueryResultLimits& Limits, TSussResultsArray& OutResults) override final
 	{
 		InitResults<TWeakObjectPtr<AActor>>(OutResults);
 		ExecuteQuery(Brain, Self, Params, FSussContext {Self}, GetResultsArray<TWeakObjectPtr<AActor>>(OutResults));
@@ -67,6 +110,7 @@ protected:
 		AActor* Self,
 		const FSussContext& Context,
 		const TMap<FName, FSussParameter>& Params,
+		FSussQueryResultLimits& Limits,
 		TArray<TWeakObjectPtr<AActor>>& OutResults) override final
 	{
 		ExecuteQuery(Brain, Self, Params, Context, OutResults);
@@ -75,13 +119,26 @@ protected:
 		AActor* Self,
 		const FSussContext& Context,
 		const TMap<FName, FSussParameter>& Params,
+		FSussQueryResultLimits& Limits,
 		TArray<FVector>& OutResults) override final {}
 	virtual void ExecuteQueryInContextInternal(USussBrainComponent* Brain,
 		AActor* Self,
 		const FSussContext& Context,
 		const TMap<FName, FSussParameter>& Params,
+		FSussQueryResultLimits& Limits,
 		TArray<FSussContextValue>& OutResults) override final {}
 
+	virtual void ExecuteQueryInContextsInternal(USussBrainComponent* Brain,
+		AActor* Self,
+		TArrayView<const FSussContext> Contexts,
+		const TMap<FName, FSussParameter>& Params,
+		const FSussQueryResultLimits& Limits,
+		TArray<TWeakObjectPtr<AActor>>& OutResults,
+		TArray<int32>& OutResultCounts) override final
+	{
+		ExecuteEQSQueryInContexts(Brain, Self, Contexts, Params, Limits, OutResults, OutResultCounts);
+	}
+
 public:
 	virtual ESussQueryContextElement GetProvidedContextElement() const override { return ESussQueryContextElement::Target; }
 };
@@ -94,8 +151,18 @@ class USussEQSLocationQueryProvider : public USussEQSQueryProvider
 protected:
 	/// Should be overridden by subclasses
 	virtual void ExecuteQuery(USussBrainComponent* Brain, AActor* Self, const TMap<FName, FSussParameter>& Params, const FSussContext& BaseContext, TArray<FVector>& OutResults);
+	void AppendEQSResults(const FEnvQueryResult& Result, TArray<FVector>& OutResults) const;
+
+	virtual void WriteEQSResults(const FEnvQueryResult* Result, TSussResultsArray& OutResults) override
+	{
+		InitResults<FVector>(OutResults);
+		if (Result)
+		{
+			AppendEQSResults(*Result, GetResultsArray<FVector>(OutResults));
+		}
+	}
 
-	virtual void ExecuteQueryInternal(USussBrainComponent* Brain, AActor* Self, const TMap<FName, FSussParameter>& Params, TSussResultsArray& OutResults) override final
+	virtual void ExecuteQueryInternal(USussBrainComponent* Brain, AActor* Self, const TMap<FName, FSussParameter>& Params, FSussQueryResultLimits& Limits, TSussResultsArray& OutResults) override final
 	{
 		InitResults<FVector>(OutResults);
 		ExecuteQuery(Brain, Self, Params, FSussContext {Self}, GetResultsArray<FVector>(OutResults));
@@ -105,11 +172,13 @@ protected:
 		AActor* Self,
 		const FSussContext& Context,
 		const TMap<FName, FSussParameter>& Params,
+		FSussQueryResultLimits& Limits,
 		TArray<TWeakObjectPtr<AActor>>& OutResults) override final {}
 	virtual void ExecuteQueryInContextInternal(USussBrainComponent* Brain,
 		AActor* Self,
 		const FSussContext& Context,
 		const TMap<FName, FSussParameter>& Params,
+		FSussQueryResultLimits& Limits,
 		TArray<FVector>& OutResults) override final
 	{
 		ExecuteQuery(Brain, Self, Params, Context, OutResults);
@@ -118,8 +187,20 @@ protected:
 		AActor* Self,
 		const FSussContext& Context,
 		const TMap<FName, FSussParameter>& Params,
+		FSussQueryResultLimits& Limits,
 		TArray<FSussContextValue>& OutResults) override final {}
 
+	virtual void ExecuteQueryInContextsInternal(USussBrainComponent* Brain,
+		AActor* Self,
+		TArrayView<const FSussContext> Contexts,
+		const TMap<FName, FSussParameter>& Params,
+		const FSussQueryResultLimits& Limits,
+		TArray<FVector>& OutResults,
+		TArray<int32>& OutResultCounts) override final
+	{
+		ExecuteEQSQueryInContexts(Brain, Self, Contexts, Params, Limits, OutResults, OutResultCounts);
+	}
+
 public:
 	virtual ESussQueryContextElement GetProvidedContextElement() const override { return ESussQueryContextElement::Location; }
 };
@@ -3,9 +3,13 @@
 #pragma once
 
 #include "CoreMinimal.h"
+#include "SussContext.h"
+#include "EnvironmentQuery/EnvQueryTypes.h"
 #include "Subsystems/WorldSubsystem.h"
 #include "SussEQSWorldSubsystem.generated.h"
 
+class UEnvQueryInstanceBlueprintWrapper;
+
 /**
  * This class is here to help with EQS support
  */
@@ -15,23 +19,34 @@ class SUSS_API USussEQSWorldSubsystem : public UWorldSubsystem
 	GENERATED_BODY()
 
 protected:
-	// This is a temporary map entirely for EQS target contexts. We need to know for a given query owner, what is the
-	// current target being considered as context (for correlated queries). Since UEnvQueryContext has no information other
-	// than the owner of the query and the query instance, and we don't want to force people to add a "target" property
-	// to their actors (it wouldn't even be valid because you can consider multiple targets, which is what Suss contexts do),
-	// this is the best way to do it. An EQS query adds an entry to this map with a PointerHash of the owner so
-	// USussEnvQueryContext_Target can extract it
+	// SUSS contexts for EQS queries which are in progress. UEnvQueryContext has no information other than the owner of
+	// the query and the query instance, and we don't want to force people to add a "target" property to their actors
+	// (it wouldn't even be valid because you can consider multiple targets, which is what Suss contexts do). So each
+	// query which needs a context registers it here, and passes the handle to the query as a named param, which
+	// USussEnvQueryContext_Target etc can use to find it. Because the handle is per request, the same owner can have
+	// multiple queries in flight at once.
 	UPROPERTY()
-	TMap<uint32, AActor*> TargetContextMap;
+	TMap<int32, FSussContext> QueryContexts;
+
+	/// Contexts for queries run via Blueprint wrappers, removed when the wrapper's query finishes
+	TMap<TWeakObjectPtr<UEnvQueryInstanceBlueprintWrapper>, int32> WrapperContextHandles;
 
-	static uint32 GetTargetKey(const AActor* Owner) { return PointerHash(Owner); }
+	int32 NextContextHandle = 1;
+
+	UFUNCTION()
+	void OnWrapperQueryFinished(UEnvQueryInstanceBlueprintWrapper* Wrapper, EEnvQueryStatus::Type QueryStatus);
 
 public:
 
-	/// Associate a target with the owner of a query so it can be retrieved by USussEnvQueryContext_Target
-	void SetTargetInfo(const AActor* Owner, AActor* Target);
-	/// Clear the association between the owner of a query and a target
-	void ClearTargetInfo(const AActor* Owner);
-	/// Retrieve the current target context for a given query owner 
-	AActor* GetTargetInfo(AActor* Owner);
+	/// The name of the EQS named param which holds the context handle
+	static const FName ContextHandleParamName;
+
+	/// Register the SUSS context for a query, returning the handle to pass as the ContextHandleParamName param
+	int32 AddQueryContext(const FSussContext& Context);
+	/// Remove a context registered with AddQueryContext, once the query has finished
+	void RemoveQueryContext(int32 Handle);
+	/// Register the SUSS context for a query run by a Blueprint wrapper, which is removed when the query finishes
+	int32 AddQueryContext(const FSussContext& Context, UEnvQueryInstanceBlueprintWrapper* Wrapper);
+	/// Retrieve the SUSS context for a query instance, if it has one
+	const FSussContext* GetQueryContext(const FEnvQueryInstance& QueryInstance) const;
 };
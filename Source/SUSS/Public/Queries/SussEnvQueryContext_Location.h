@@ -0,0 +1,19 @@
+﻿// 
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "EnvironmentQuery/EnvQueryContext.h"
+#include "SussEnvQueryContext_Location.generated.h"
+
+/**
+ * EQS helper to expose the location of the current context being considered as an EQS Context value
+ */
+UCLASS()
+class SUSS_API USussEnvQueryContext_Location : public UEnvQueryContext
+{
+	GENERATED_BODY()
+
+public:
+	virtual void ProvideContext(FEnvQueryInstance& QueryInstance, FEnvQueryContextData& ContextData) const override;
+};
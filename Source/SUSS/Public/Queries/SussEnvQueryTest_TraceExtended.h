@@ -24,6 +24,32 @@ class SUSS_API USussEnvQueryTest_TraceExtended : public UEnvQueryTest_Trace
 	UPROPERTY(EditDefaultsOnly, Category=Trace, AdvancedDisplay)
 	FAIDataProviderFloatValue ContextTraceOffset;
 
+	/// Whether to run the traces for all items & contexts in parallel. Traces are read-only scene queries, so this is
+	/// safe, and can be much faster for large numbers of items.
+	UPROPERTY(EditDefaultsOnly, Category=Trace, AdvancedDisplay)
+	bool bParallelTraces = true;
+
+	/// The minimum number of traces before they're run in parallel, below this it's not worth the overhead
+	UPROPERTY(EditDefaultsOnly, Category=Trace, AdvancedDisplay, meta=(EditCondition="bParallelTraces", ClampMin=1))
+	int32 MinParallelTraces = 32;
+
+	/// The maximum number of traces to gather into one batch. Items are traced a batch at a time as the test iterates
+	/// over them, so when the query runs out of time in a step, at most one batch of traces is wasted.
+	UPROPERTY(EditDefaultsOnly, Category=Trace, AdvancedDisplay, meta=(ClampMin=1))
+	int32 TraceBatchSize = 128;
+
+	struct FTraceRequest
+	{
+		FVector ItemLocation;
+		FVector ContextLocation;
+		AActor* ItemActor;
+	};
+	FTraceRequest MakeTraceRequest(const FVector& ItemLocation,
+	                               const FVector& ContextLocation,
+	                               AActor* ItemActor,
+	                               float ItemOffset,
+	                               float ContextOffset) const;
+
 	DECLARE_DELEGATE_RetVal_SevenParams(bool, FDoTraceSignature, const FVector&, const FVector&, AActor*, UWorld*, enum ECollisionChannel, const FCollisionQueryParams&, const FVector&);
 	bool DoLineTraceTo(const FVector& ItemPos,
 	                          const FVector& ContextPos,
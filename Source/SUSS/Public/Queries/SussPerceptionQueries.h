@@ -12,6 +12,7 @@ UE_DECLARE_GAMEPLAY_TAG_EXTERN(TAG_SussQueryPerceptionKnownTargets);
 UE_DECLARE_GAMEPLAY_TAG_EXTERN(TAG_SussQueryPerceptionKnownHostiles);
 UE_DECLARE_GAMEPLAY_TAG_EXTERN(TAG_SussQueryPerceptionKnownNonHostiles);
 UE_DECLARE_GAMEPLAY_TAG_EXTERN(TAG_SussQueryPerceptionKnownHostilesExtended);
+UE_DECLARE_GAMEPLAY_TAG_EXTERN(TAG_SussQueryPerceptionTeamKnownHostiles);
 
 /// Base known targets query provider (not to be used directly)
 UCLASS(Abstract)
@@ -27,6 +28,12 @@ protected:
 	virtual TSubclassOf<UAISense> GetSenseClass(const TMap<FName, FSussParameter>& Params);
 	/// Populate a list of tags that if a target has any of them, they are ignored
 	virtual void GetIgnoreTags(const TMap<FName, FSussParameter>& Params, FGameplayTagContainer& OutTags);
+	/// Filter raw perception results by ignore tags and the query result limits, and append the survivors to OutResults
+	void AppendFilteredResults(const AActor* Self,
+	                           TArray<AActor*>& PerceptionResults,
+	                           const FGameplayTagContainer& IgnoreTags,
+	                           FSussQueryResultLimits& Limits,
+	                           TArray<TWeakObjectPtr<AActor>>& OutResults);
 };
 
 /**
@@ -46,10 +53,11 @@ public:
 	USussPerceptionKnownTargetsQueryProvider();
 protected:
 	
-	virtual void ExecuteQuery(USussBrainComponent* Brain,
+	virtual void ExecuteQueryWithLimits(USussBrainComponent* Brain,
 		AActor* Self,
 		const TMap<FName, FSussParameter>& Params,
 		const FSussContext& Context,
+		FSussQueryResultLimits& Limits,
 		TArray<TWeakObjectPtr<AActor>>& OutResults) override;
 };
 
@@ -69,10 +77,11 @@ class SUSS_API USussPerceptionKnownHostilesQueryProvider : public USussPerceptio
 public:
 	USussPerceptionKnownHostilesQueryProvider();
 protected:
-	virtual void ExecuteQuery(USussBrainComponent* Brain,
+	virtual void ExecuteQueryWithLimits(USussBrainComponent* Brain,
 		AActor* Self,
 		const TMap<FName, FSussParameter>& Params,
 		const FSussContext& Context,
+		FSussQueryResultLimits& Limits,
 		TArray<TWeakObjectPtr<AActor>>& OutResults) override;
 };
 
@@ -92,15 +101,77 @@ class SUSS_API USussPerceptionKnownNonHostilesQueryProvider : public USussPercep
 public:
 	USussPerceptionKnownNonHostilesQueryProvider();
 protected:
-	virtual void ExecuteQuery(USussBrainComponent* Brain,
+	virtual void ExecuteQueryWithLimits(USussBrainComponent* Brain,
 		AActor* Self,
 		const TMap<FName, FSussParameter>& Params,
 		const FSussContext& Context,
+		FSussQueryResultLimits& Limits,
+		TArray<TWeakObjectPtr<AActor>>& OutResults) override;
+};
+
+/**
+ * Query provider which provides a list of all hostiles that are "known" by the perception system of any agent on the
+ * same team as this agent (see IGenericTeamAgentInterface), using USussTeamPerceptionWorldSubsystem. The team's
+ * perception is aggregated when its members' perception changes, at most every TeamPerceptionUpdateInterval, so this is
+ * much cheaper than every agent enumerating its own perception when all you need is what the team knows. Agents with
+ * no team only get hostiles they know about themselves.
+ * Results aren't invalidated when this agent's perception updates, since other team members' perception matters too,
+ * so use Max Frequency to control how up to date they are.
+ * Optional parameters:
+ *    "Sense": A name parameter identifying the single sense you want to test ("Sight", "Hearing", "Damage", "Touch")
+ *    "IgnoreTags": TagContainer of tags which you want to ignore if the actor has (e.g. dead, invisible)
+ */
+UCLASS()
+class SUSS_API USussPerceptionTeamKnownHostilesQueryProvider : public USussPerceptionKnownTargetsQueryProviderBase
+{
+	GENERATED_BODY()
+public:
+	USussPerceptionTeamKnownHostilesQueryProvider();
+protected:
+	virtual void ExecuteQueryWithLimits(USussBrainComponent* Brain,
+		AActor* Self,
+		const TMap<FName, FSussParameter>& Params,
+		const FSussContext& Context,
+		FSussQueryResultLimits& Limits,
 		TArray<TWeakObjectPtr<AActor>>& OutResults) override;
 };
 
 struct FActorPerceptionInfo;
 
+/// Compact summary of the last stimulus registered by one sense, much cheaper to copy than a full FAIStimulus
+USTRUCT(BlueprintType)
+struct SUSS_API FSussStimulusSummary
+{
+	GENERATED_BODY()
+public:
+	/// Index of the sense which registered the stimulus, compare with UAISense::GetSenseID
+	UPROPERTY(BlueprintReadOnly)
+	int32 SenseID = 0;
+
+	/// Where the stimulus happened
+	UPROPERTY(BlueprintReadOnly)
+	FVector Location = FVector::ZeroVector;
+
+	/// How long ago the stimulus happened
+	UPROPERTY(BlueprintReadOnly)
+	float Age = 0;
+
+	UPROPERTY(BlueprintReadOnly)
+	float Strength = 0;
+
+	/// Whether the stimulus was successfully sensed (false means the target was lost by this sense)
+	UPROPERTY(BlueprintReadOnly)
+	uint32 bSuccessfullySensed : 1;
+
+	/// Whether the stimulus has expired, i.e. is remembered but not currently sensed
+	UPROPERTY(BlueprintReadOnly)
+	uint32 bExpired : 1;
+
+	FSussStimulusSummary() : bSuccessfullySensed(0), bExpired(0)
+	{
+	}
+};
+
 USTRUCT(BlueprintType)
 struct SUSS_API FSussActorPerceptionInfo : public FSussContextValueStructBase
 {
@@ -122,10 +193,15 @@ public:
 	UPROPERTY(BlueprintReadOnly)
 	FVector LastLocation = FVector::ZeroVector;
 
-	/// Full information about the actual senses
+	/// Full information about the actual senses. Only filled in by USussBrainComponent::GetPerceptionInfo and
+	/// GetMostRecentPerceptionInfo; the extended hostiles query only fills in Stimuli, which is much cheaper.
 	UPROPERTY(BlueprintReadOnly)
 	TArray<FAIStimulus> LastSensedStimuli;
 
+	/// Summary of the last stimulus of each sense which has registered this target
+	UPROPERTY(BlueprintReadOnly)
+	TArray<FSussStimulusSummary> Stimuli;
+
 	/// Whether the target is hostile
 	UPROPERTY(BlueprintReadOnly)
 	uint32 bIsHostile : 1;
@@ -134,14 +210,41 @@ public:
 	{
 	}
 
-	FSussActorPerceptionInfo(const FActorPerceptionInfo& Info);
+	FSussActorPerceptionInfo(const FActorPerceptionInfo& Info, bool bCopyLastSensedStimuli = true);
+	/// Overwrite this struct with new perception info, re-using the existing stimuli allocations
+	void Update(const FActorPerceptionInfo& Info, bool bCopyLastSensedStimuli = true);
+	/// Find the stimulus summary for a sense, or null if that sense has not registered the target
+	const FSussStimulusSummary* FindStimulus(FAISenseID SenseID) const;
 	virtual FString ToString() const override;
 };
 
+/// Perception info structs generated by one execution of USussPerceptionKnownHostilesExtendedQueryProvider, see
+/// USussBrainComponent::AcquirePerceptionInfoArena
+struct FSussPerceptionInfoArena
+{
+	/// Only the first NumLive are results; the rest are kept from earlier executions so their allocations are re-used
+	TArray<FSussActorPerceptionInfo> Infos;
+	int NumLive = 0;
+
+	/// Get the next struct to fill in, re-using an existing one if possible
+	FSussActorPerceptionInfo& AddLive()
+	{
+		if (NumLive == Infos.Num())
+		{
+			Infos.AddDefaulted();
+		}
+		return Infos[NumLive++];
+	}
+};
+
 /**
  * Query provider which provides extended info about all hostile targets that are "known" by the perception
  * system of the agent. Instead of just providing a target, it provides extra information about when & where the
  * target was last sensed, so it returns a named value struct called "PerceptionInfo" of type FSussActorPerceptionInfo, instead of just a target.
+ *
+ * The perception info structs from each execution are kept together in an arena owned by the brain, which is only
+ * re-used for a later execution once nothing refers to any of its results any more, so results are never changed
+ * while they're held. Only the compact Stimuli summary is filled in, not LastSensedStimuli.
  * 
  * Requires that the agent's AI controller has a UAIPerceptionComponent.
  * "Known" means that the targets have been perceived at some point and have not yet been forgotten.
@@ -163,10 +266,10 @@ protected:
 	/// Populate a list of tags that if a target has any of them, they are ignored
 	virtual void GetIgnoreTags(const TMap<FName, FSussParameter>& Params, FGameplayTagContainer& OutTags);
 	
-	virtual void ExecuteQuery(USussBrainComponent* Brain,
+	virtual void ExecuteQueryWithLimits(USussBrainComponent* Brain,
 		AActor* Self,
 		const TMap<FName, FSussParameter>& Params,
 		const FSussContext& Context,
+		FSussQueryResultLimits& Limits,
 		TArray<FSussContextValue>& OutResults) override;
-	
 };
\ No newline at end of file
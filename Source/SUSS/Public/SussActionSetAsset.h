@@ -6,6 +6,7 @@
 #include "GameplayTagContainer.h"
 #include "Engine/DataAsset.h"
 #include "SussConsideration.h"
+#include "SussQueryProvider.h"
 #include "SussActionSetAsset.generated.h"
 
 
@@ -27,6 +28,15 @@ struct FSussQuery
 	UPROPERTY(EditDefaultsOnly)
 	TMap<FName, FSussParameter> Params;
 
+	/// If > 0, the maximum number of results to use from this query, after ordering them by ResultSort. Often only the
+	/// nearest few targets, or best few locations, could plausibly win, and this avoids evaluating the rest.
+	UPROPERTY(EditDefaultsOnly)
+	int MaxResults = 0;
+
+	/// How to order the results of this query before applying MaxResults
+	UPROPERTY(EditDefaultsOnly)
+	ESussQueryResultSort ResultSort = ESussQueryResultSort::None;
+
 };
 
 USTRUCT()
@@ -111,10 +121,45 @@ public:
 	UPROPERTY(EditDefaultsOnly)
 	TArray<FSussQuery> Queries;
 
+	/// The maximum number of contexts this action will be evaluated in. If the queries would generate more than this,
+	/// a deterministic sample of this many contexts is used instead, to bound the worst-case cost of evaluating this
+	/// action (e.g. when lots of targets are combined with lots of locations). 0 means unlimited.
+	UPROPERTY(EditDefaultsOnly)
+	int MaxContexts = 0;
+
 	/// Considerations score the action and will be run as many times as needed by the combination of results from the queries
 	UPROPERTY(EditDefaultsOnly)
 	TArray<FSussConsideration> Considerations;
 };
+
+/// A group of actions which share queries and considerations. The group's considerations are evaluated once per brain
+/// update rather than once per action; if the group scores zero, none of its actions are considered at all, otherwise
+/// the group score is multiplied into the score of each of its actions.
+USTRUCT()
+struct FSussActionGroup
+{
+	GENERATED_BODY()
+public:
+	/// Optional description, for documentation and debugging
+	UPROPERTY(EditDefaultsOnly)
+	FString Description;
+
+	/// Queries which generate contexts shared by all the actions in this group. If supplied, the actions in this group
+	/// are evaluated in the group contexts which scored > 0, and any queries on the actions themselves are ignored.
+	/// If not supplied, the group considerations are evaluated in the "Self" context only, and actions generate their
+	/// own contexts from their queries as usual.
+	UPROPERTY(EditDefaultsOnly)
+	TArray<FSussQuery> Queries;
+
+	/// Considerations shared by all the actions in this group
+	UPROPERTY(EditDefaultsOnly)
+	TArray<FSussConsideration> Considerations;
+
+	/// The actions in this group. These can still be in different priority groups.
+	UPROPERTY(EditDefaultsOnly)
+	TArray<FSussActionDef> ActionDefs;
+};
+
 /**
  * An action set is a re-usable collection of actions, to make it quicker & easier to build AIs from pre-built behaviours
  */
@@ -128,8 +173,13 @@ protected:
 	UPROPERTY(EditDefaultsOnly)
 	TArray<FSussActionDef> ActionDefs;
 
+	/// Groups of action definitions with shared queries & considerations
+	UPROPERTY(EditDefaultsOnly)
+	TArray<FSussActionGroup> ActionGroups;
+
 public:
 	TArray<FSussActionDef>& GetActions() { return ActionDefs; }
+	TArray<FSussActionGroup>& GetActionGroups() { return ActionGroups; }
 
 	
 };
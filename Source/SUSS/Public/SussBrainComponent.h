@@ -6,11 +6,13 @@
 #include "SussContext.h"
 #include "SussGameSubsystem.h"
 #include "SussPoolSubsystem.h"
+#include "AI/Navigation/NavigationTypes.h"
 #include "Perception/AIPerceptionComponent.h"
 #include "Runtime/AIModule/Classes/BrainComponent.h"
 #include "SussBrainComponent.generated.h"
 
 class UCharacterMovementComponent;
+struct FSussPerceptionInfoArena;
 
 DECLARE_DYNAMIC_MULTICAST_DELEGATE_OneParam(FOnSussBrainUpdate, class USussBrainComponent*, Brain);
 /// How to choose the action to run
@@ -89,6 +91,10 @@ public:
 	UPROPERTY(EditDefaultsOnly)
 	TArray<FSussActionDef> ActionDefs;
 
+	/// Specific groups of action definitions with shared queries & considerations for this behaviour
+	UPROPERTY(EditDefaultsOnly)
+	TArray<FSussActionGroup> ActionGroups;
+
 };
 
 /// Output result of an action+context pair being considered; only recorded if score > 0
@@ -127,6 +133,97 @@ public:
 	
 };
 
+/// The result of evaluating an action group during a brain update
+struct FSussActionGroupEvaluation
+{
+	/// Whether the group has been evaluated in this update yet
+	bool bEvaluated = false;
+	/// The group contexts which scored > 0 (just Self if the group has no queries)
+	TArray<FSussContext> Contexts;
+	/// The group score for each entry in Contexts
+	TArray<float> Scores;
+};
+
+/// Full key identifying a cached consideration input value
+struct SUSS_API FSussConsiderationInputCacheKey
+{
+public:
+	/// Index into CombinedActionsByPriority, or negative for action groups
+	int ActionIndex = 0;
+	int ConsiderationIndex = 0;
+	FSussContext Context;
+	uint32 Hash = 0;
+
+	FSussConsiderationInputCacheKey() {}
+	FSussConsiderationInputCacheKey(int InActionIndex, int InConsiderationIndex, const FSussContext& InContext) :
+		ActionIndex(InActionIndex),
+		ConsiderationIndex(InConsiderationIndex),
+		Context(InContext)
+	{
+		Hash = HashCombine(HashCombine(GetTypeHash(ActionIndex), GetTypeHash(ConsiderationIndex)), GetTypeHash(Context));
+	}
+
+	bool operator==(const FSussConsiderationInputCacheKey& Other) const
+	{
+		// Contexts are compared the same way as correlated query source contexts, struct values by identity
+		return Hash == Other.Hash &&
+			ActionIndex == Other.ActionIndex &&
+			ConsiderationIndex == Other.ConsiderationIndex &&
+			FSussCorrelatedQueryCacheKey::SourceContextsMatch(Context, Other.Context);
+	}
+
+	friend uint32 GetTypeHash(const FSussConsiderationInputCacheKey& Key) { return Key.Hash; }
+};
+
+/// A previously evaluated input value for a consideration, re-used until it expires (see FSussConsideration::MaxFrequency)
+USTRUCT()
+struct FSussConsiderationInputCacheEntry
+{
+	GENERATED_BODY()
+public:
+	/// The raw input value, before bookends & curves are applied
+	float Value = 0;
+	/// The world time after which this value must be re-evaluated
+	double ExpiryTime = 0;
+};
+
+/**
+ * A flat summary of what a brain's perception knows about one actor, see USussBrainComponent::GetPerceptionSnapshot.
+ * Senses are stored as a bit per FAISenseID, so only the first 32 registered senses are represented.
+ */
+struct FSussPerceptionSnapshotEntry
+{
+	TWeakObjectPtr<AActor> Actor;
+	/// Location that the actor was last sensed
+	FVector LastLocation = FVector::ZeroVector;
+	/// Age of the most recent successfully sensed stimulus which hasn't expired, or NeverHappenedAge if none
+	float Age = FAIStimulus::NeverHappenedAge;
+	/// Senses which have a stimulus for this actor which hasn't been forgotten, however long ago it was sensed
+	/// (matches FActorPerceptionInfo::HasKnownStimulusOfSense)
+	uint32 KnownSenses = 0;
+	/// Senses whose stimulus for this actor is still sensed or hasn't expired yet
+	/// (matches FActorPerceptionInfo::HasAnyKnownStimulus)
+	uint32 ActiveSenses = 0;
+	/// Senses which are currently sensing this actor (successfully sensed & not expired)
+	uint32 CurrentSenses = 0;
+	bool bIsHostile = false;
+
+	static uint32 GetSenseBit(FAISenseID Sense) { return Sense.IsValid() && Sense.Index < 32 ? 1u << Sense.Index : 0; }
+	bool HasAnyKnownStimulus() const { return ActiveSenses != 0; }
+	bool HasKnownStimulusOfSense(FAISenseID Sense) const { return (KnownSenses & GetSenseBit(Sense)) != 0; }
+	bool HasAnyCurrentStimulus() const { return CurrentSenses != 0; }
+};
+
+/// A path which was found while scoring actions, kept so that the chosen action can re-use it
+struct FSussScoringPath
+{
+	/// The destination which was requested
+	FVector Destination = FVector::ZeroVector;
+	FNavPathSharedPtr Path;
+	/// The world time the path was recorded
+	double Time = 0;
+};
+
 UCLASS(ClassGroup=(Custom), meta=(BlueprintSpawnableComponent))
 class SUSS_API USussBrainComponent : public UBrainComponent
 {
@@ -168,6 +265,12 @@ protected:
 
 	/// Combination of ActionSets and ActionDefs, sorted by descending priority group
 	TArray<FSussActionDef> CombinedActionsByPriority;
+	/// Action groups from ActionSets and ActionGroups (without their action defs, which are in CombinedActionsByPriority)
+	TArray<FSussActionGroup> CombinedActionGroups;
+	/// Index into CombinedActionGroups for each entry in CombinedActionsByPriority, or INDEX_NONE if not in a group
+	TArray<int> CombinedActionGroupIndices;
+	/// Evaluation of each entry in CombinedActionGroups during the current update
+	TArray<FSussActionGroupEvaluation> ActionGroupEvaluations;
 
 	/// The scoring result of the current action definition being executed, if any
 	FSussActionScoringResult CurrentActionResult;
@@ -177,11 +280,35 @@ protected:
 	TArray<FSussActionScoringResult> CandidateActions;
 	/// Record of when each action in CombinedActionsByPriority order has been run & details 
 	TArray<FSussActionHistory> ActionHistory;
+	/// Input values for considerations which have a MaxFrequency, keyed on action index, consideration index & context
+	TMap<FSussConsiderationInputCacheKey, FSussConsiderationInputCacheEntry> ConsiderationInputCache;
+	/// Working space for partial scores (from groups & gate considerations) per context during update
+	TArray<float> ContextPartialScores;
+	/// Working space for the number of results per source context from a batched correlated query
+	TArray<int32> CorrelatedResultCounts;
+	/// Paths found while scoring (e.g. by path distance inputs), keyed on quantised destination. Inputs are evaluated
+	/// with a const brain, hence mutable.
+	mutable TMap<FIntVector, FSussScoringPath> ScoringPaths;
+	/// How long paths found while scoring are kept for re-use
+	float MaxScoringPathAge = 2;
+	/// Summary of perception data shared by all perception queries in a frame, see GetPerceptionSnapshot
+	mutable TArray<FSussPerceptionSnapshotEntry> PerceptionSnapshot;
+	/// The frame PerceptionSnapshot was built in
+	mutable uint64 PerceptionSnapshotFrame = MAX_uint64;
+	/// Arenas of perception info structs generated for this brain, see AcquirePerceptionInfoArena
+	TArray<TSharedPtr<FSussPerceptionInfoArena, ESPMode::NotThreadSafe>> PerceptionInfoArenas;
 
 	UPROPERTY(Transient)
 	UAIPerceptionComponent* PerceptionComp;
 	TMap<FGameplayTag, FDelegateHandle> TagDelegates;
 
+	/// Counts of events which invalidate cached query results generated for this brain
+	FSussQueryInvalidationCounts QueryInvalidationCounts;
+	/// Tags which providers used by our queries want to invalidate results on, see USussQueryProvider::InvalidateOnTagsChanged
+	/// There's only one count for all of these, so a change to any of them invalidates all tag-dependent results.
+	FGameplayTagContainer QueryInvalidationTags;
+	FDelegateHandle QueryInvalidationTagDelegate;
+
 	bool bIsLogicStopped = false;
 	FString LogicStoppedReason;
 	
@@ -199,6 +326,7 @@ public:
 	FOnSussBrainUpdate OnPostBrainUpdate;
 	
 	const FSussBrainConfig& GetBrainConfig() const { return BrainConfig; }
+	const FSussQueryInvalidationCounts& GetQueryInvalidationCounts() const { return QueryInvalidationCounts; }
 
 	UFUNCTION(BlueprintCallable)
 	void SetBrainConfig(const FSussBrainConfig& NewConfig);
@@ -291,6 +419,22 @@ public:
 						   TSubclassOf<UAISense> SenseClass = nullptr,
 						   bool bSenseClassInclude = true);
 
+	/**
+	 * Get a flat summary of everything this brain's perception knows about. It's built at most once per frame (and
+	 * again if perception is updated), then shared by every perception query & helper in the brain update, rather
+	 * than each of them iterating & filtering the perception component's data again.
+	 * Entries with a stale actor are excluded.
+	 */
+	const TArray<FSussPerceptionSnapshotEntry>& GetPerceptionSnapshot() const;
+
+	/**
+	 * Get an empty arena for perception info structs which are about to be returned as query results. Arenas are only
+	 * re-used once this brain holds the only reference to them, so results are never changed while they're held, and
+	 * the structs in a re-used arena keep their allocations. The number of arenas is bounded by how many sets of
+	 * results are held at once, e.g. in cached results and the current action's context.
+	 */
+	TSharedPtr<FSussPerceptionInfoArena, ESPMode::NotThreadSafe> AcquirePerceptionInfoArena();
+
 	virtual void StartLogic() override;
 	virtual void RestartLogic() override;
 	virtual void StopLogic(const FString& Reason) override;
@@ -305,6 +449,25 @@ public:
 	UFUNCTION(BlueprintCallable)
 	bool IsActionInProgress();
 
+	/**
+	 * Record a path which was found while scoring actions, so that an action moving to the same destination can re-use
+	 * it rather than finding the path again. The built-in path distance inputs do this automatically.
+	 * @param Destination The destination which was requested
+	 * @param Path The path found
+	 */
+	void RecordScoringPath(const FVector& Destination, FNavPathSharedPtr Path) const;
+
+	/**
+	 * Get a path to a destination which was found while scoring actions, e.g. by the path distance inputs. Actions which
+	 * move to their context location or target can pass this to AAIController::RequestMove to avoid finding the same
+	 * path again. The path returned is a copy which belongs to this brain, since recorded paths can be shared.
+	 * @param Destination The destination to move to
+	 * @param Tolerance How far the recorded destination can be from Destination, and the start of the path from the
+	 * current location of the pawn
+	 * @return The path, or null if no recent path to this destination was found while scoring
+	 */
+	FNavPathSharedPtr GetScoringPathTo(const FVector& Destination, float Tolerance = 50) const;
+
 	// Helper method to make logs easier to read
 	const UObject* GetLogOwner() const;
 
@@ -348,6 +511,7 @@ public:
 protected:
 	// Called when the game starts
 	virtual void BeginPlay() override;
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
 	void BrainConfigChanged();
 	void InitActions();
 	ESussActionChoiceMethod GetActionChoiceMethod(int Priority, int& OutTopN) const;
@@ -368,15 +532,62 @@ protected:
 	void OnPerceptionUpdated(const TArray<AActor*>& Actors);
 	UFUNCTION()
 	void OnGameplayTagEvent(const FGameplayTag InTag, int32 NewCount);
+	void OnQueryInvalidationTagEvent(const FGameplayTag InTag, int32 NewCount);
+
+	/// Choose Count indices from 0..Total-1, in ascending order, deterministically for a given seed (selection sampling)
+	template<typename FuncType>
+	static void SampleIndices(int Total, int Count, uint32 Seed, FuncType&& Callback)
+	{
+		FRandomStream Stream(Seed);
+		int Remaining = Count;
+		for (int i = 0; i < Total && Remaining > 0; ++i)
+		{
+			// Select with probability Remaining / (Total - i)
+			if (Stream.RandHelper(Total - i) < Remaining)
+			{
+				Callback(i);
+				--Remaining;
+			}
+		}
+	}
 
+	/// Combine InValues with every existing context in OutContexts. If MaxContexts > 0 and there would be more
+	/// combinations than that, a sample of MaxContexts combinations is generated instead.
+	/// @return Whether the results were truncated by MaxContexts
 	template<typename T>
-	static void AppendUncorrelatedContexts(AActor* Self, const TArray<T>& InValues, TArray<FSussContext>& OutContexts, TFunctionRef<void(const T&, FSussContext&)> ValueSetter)
+	static bool AppendUncorrelatedContexts(AActor* Self, const TArray<T>& InValues, TArray<FSussContext>& OutContexts, TFunctionRef<void(const T&, FSussContext&)> ValueSetter, int MaxContexts = 0, uint32 SampleSeed = 0)
 	{
 		if (InValues.IsEmpty())
-			return;
+			return false;
 
 		const int OldSize = OutContexts.Num();
 
+		const int NewSize = FMath::Max(OldSize, 1) * InValues.Num();
+		if (MaxContexts > 0 && NewSize > MaxContexts)
+		{
+			// Only generate a sample of the combinations, in the same order as they would otherwise be generated
+			FSussScopeReservedArray SampledScope = GetSussPool(Self->GetWorld())->ReserveArray<FSussContext>();
+			TArray<FSussContext>& Sampled = *SampledScope.Get<FSussContext>();
+			Sampled.Reserve(MaxContexts);
+			SampleIndices(NewSize, MaxContexts, SampleSeed, [&](int Index)
+			{
+				FSussContext& OutContext = Sampled.AddDefaulted_GetRef();
+				if (OldSize == 0)
+				{
+					OutContext.ControlledActor = Self;
+					ValueSetter(InValues[Index], OutContext);
+				}
+				else
+				{
+					// Combination index is NewValueIndex * OldSize + OldIndex, see below
+					OutContext = OutContexts[Index % OldSize];
+					ValueSetter(InValues[Index / OldSize], OutContext);
+				}
+			});
+			Swap(OutContexts, Sampled);
+			return true;
+		}
+
 		if (OldSize == 0)
 		{
 			// This is the first set of values, so simply copy them in
@@ -416,11 +627,12 @@ protected:
 				}
 			}
 		}
+		return false;
 	}
 	template<typename T>
-	static void AppendUncorrelatedContexts(AActor* Self, FSussScopeReservedArray& ReservedArray, TArray<FSussContext>& OutContexts, TFunctionRef<void(const T&, FSussContext&)> ValueSetter)
+	static bool AppendUncorrelatedContexts(AActor* Self, FSussScopeReservedArray& ReservedArray, TArray<FSussContext>& OutContexts, TFunctionRef<void(const T&, FSussContext&)> ValueSetter, int MaxContexts = 0, uint32 SampleSeed = 0)
 	{
-		AppendUncorrelatedContexts<T>(Self, *ReservedArray.Get<T>(), OutContexts, ValueSetter);
+		return AppendUncorrelatedContexts<T>(Self, *ReservedArray.Get<T>(), OutContexts, ValueSetter, MaxContexts, SampleSeed);
 	}
 
 	template<typename T>
@@ -453,6 +665,60 @@ protected:
 			}
 		}
 	}
+	/**
+	 * Combine the results of a batched correlated query with the source contexts they were generated from.
+	 * The first InResultCounts.Num() entries of InOutContexts are the source contexts; each is combined with the first
+	 * of its results, and copies are appended for the rest. Source contexts which had no results are removed.
+	 */
+	template<typename T>
+	static void ExpandCorrelatedContexts(const TArray<T>& InValues, const TArray<int32>& InResultCounts, TArray<FSussContext>& InOutContexts, TFunctionRef<void(const T&, FSussContext&)> ValueSetter)
+	{
+		const int SourceCount = InResultCounts.Num();
+		check(SourceCount <= InOutContexts.Num());
+
+		// Reserve up front so that source contexts don't move while we copy them
+		int ExtraCount = 0;
+		for (const int32 Count : InResultCounts)
+		{
+			ExtraCount += FMath::Max(Count - 1, 0);
+		}
+		InOutContexts.Reserve(InOutContexts.Num() + ExtraCount);
+
+		int ValueIndex = 0;
+		for (int i = 0; i < SourceCount; ++i)
+		{
+			const int Count = InResultCounts[i];
+			if (Count == 0)
+				continue;
+
+			// Additional values generate copies of the source context, before we modify it with the first value
+			for (int v = 1; v < Count; ++v)
+			{
+				FSussContext& NewContext = InOutContexts.AddDefaulted_GetRef();
+				NewContext = InOutContexts[i];
+				ValueSetter(InValues[ValueIndex + v], NewContext);
+			}
+			ValueSetter(InValues[ValueIndex], InOutContexts[i]);
+			ValueIndex += Count;
+		}
+
+		// Correlated queries require results from BOTH (intersection). Source contexts with no results are invalid, so
+		// remove them in a single stable pass
+		int OutIndex = 0;
+		for (int i = 0; i < InOutContexts.Num(); ++i)
+		{
+			if (i < SourceCount && InResultCounts[i] == 0)
+				continue;
+
+			if (OutIndex != i)
+			{
+				InOutContexts[OutIndex] = MoveTemp(InOutContexts[i]);
+			}
+			++OutIndex;
+		}
+		InOutContexts.SetNum(OutIndex, false);
+	}
+
 	template<typename T>
 	static void AppendCorrelatedContexts(AActor* Self, FSussScopeReservedArray& ReservedArray, FSussContext& SourceContext, TArray<FSussContext>& OutContexts, TFunctionRef<void(const T&, FSussContext&)> ValueSetter)
 	{
@@ -460,12 +726,41 @@ protected:
 	}
 
 	void GenerateContexts(AActor* Self, const FSussActionDef& Action, TArray<FSussContext>& OutContexts);
+	void GenerateContexts(AActor* Self, const TArray<FSussQuery>& Queries, FName DebugName, int MaxContexts, TArray<FSussContext>& OutContexts);
+	const FSussActionGroupEvaluation& EvaluateActionGroup(AActor* Self, int GroupIndex);
 	void IntersectCorrelatedContexts(AActor* Self, const FSussQuery& Query, USussQueryProvider* QueryProvider, const TMap<FName, FSussParameter>& Params, TArray<FSussContext>& InOutContexts);
 	bool AppendUncorrelatedContexts(AActor* Self,
 	                                const FSussQuery& Query,
 	                                USussQueryProvider* QueryProvider,
 	                                const TMap<FName, FSussParameter>& Params,
+	                                int MaxContexts,
+	                                uint32 SampleSeed,
+	                                FName DebugName,
 	                                TArray<FSussContext>& OutContexts);
+	void RecordContextsTruncated(FName DebugName, int Requested, int Kept);
+	float EvaluateConsideration(AActor* Self,
+	                            int ActionIndex,
+	                            int ConsiderationIndex,
+	                            const FSussConsideration& Consideration,
+	                            USussInputProvider* InputProvider,
+	                            const FSussContext& Ctx);
+	void FilterContextsByGates(AActor* Self,
+	                           int ActionIndex,
+	                           const FSussActionDef& Action,
+	                           const TBitArray<>& SelfOnlyConsiderations,
+	                           TBitArray<>& OutGateConsiderations,
+	                           TArray<FSussContext>& InOutContexts);
+	bool IsSelfOnlyConsideration(const FSussConsideration& Consideration, const USussInputProvider* InputProvider) const;
+	bool IsSelfOnlyParameter(const FSussParameter& Param) const;
+	float EvaluateConsiderationInput(AActor* Self,
+	                                 int ActionIndex,
+	                                 int ConsiderationIndex,
+	                                 const FSussConsideration& Consideration,
+	                                 USussInputProvider* InputProvider,
+	                                 const FSussContext& Ctx);
+	void PruneConsiderationInputCache();
+	void PruneScoringPaths();
+	static FIntVector QuantiseScoringPathDestination(const FVector& Destination);
 	bool IsActionSameAsCurrent(int NewActionIndex, const FSussContext& NewContext);
 	bool ShouldSubtractRepetitionPenaltyToProposedAction(int NewActionIndex, const FSussContext& NewContext);
 	
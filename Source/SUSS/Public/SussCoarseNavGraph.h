@@ -0,0 +1,125 @@
+﻿// 
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "NavigationData.h"
+#include "SussQueryCache.h"
+
+/**
+ * A coarse graph over the navmesh used to estimate path distances cheaply, for scoring where only a good ranking of
+ * candidates is needed rather than an exact path length.
+ * The world is divided into cubic cells, each with a single node projected onto the navmesh, and neighbouring nodes are
+ * linked if a navmesh raycast between them is unobstructed. The graph is built lazily as it's searched, so only the
+ * areas agents actually use are ever built.
+ * Distances from a start cell to every cell within range are computed once with a bounded Dijkstra search and cached,
+ * so estimating the distance to many candidate locations from the same start is just a lookup each.
+ * Building the graph needs navmesh queries, so the number made per frame is limited. Searches which run out of budget
+ * are continued on later calls, or by ContinueSearches, and until then locations they haven't reached can't be
+ * estimated.
+ * Not thread safe, only use on the game thread.
+ */
+class SUSS_API FSussCoarseNavGraph
+{
+public:
+	/**
+	 * @param InNavData The navigation data to build the graph on
+	 * @param InFilter The query filter to use for projection & raycasts
+	 * @param InCellSize The size of cells; larger is cheaper but less accurate
+	 * @param InMaxSearchDistance The maximum graph distance to search from a start cell
+	 * @param InMaxNavQueriesPerFrame The maximum navmesh queries made to build the graph per frame, or 0 for no limit
+	 */
+	FSussCoarseNavGraph(const ANavigationData* InNavData,
+	                    FSharedConstNavQueryFilter InFilter,
+	                    float InCellSize,
+	                    float InMaxSearchDistance,
+	                    int InMaxNavQueriesPerFrame);
+
+	/**
+	 * Estimate the path distance between 2 locations.
+	 * @param FromLocation The start location
+	 * @param ToLocation The end location
+	 * @param OutDistance The estimated distance
+	 * @return Whether an estimate could be made. False if either location is not near the navmesh, the end isn't
+	 * connected to the start in the coarse graph within the max search distance, or the search from the start hasn't
+	 * reached the end yet because it ran out of budget.
+	 */
+	bool EstimateDistance(const FVector& FromLocation, const FVector& ToLocation, float& OutDistance);
+
+	/// Continue searches which ran out of budget, using whatever budget is left this frame
+	void ContinueSearches();
+
+	/// Change the maximum navmesh queries made to build the graph per frame, 0 for no limit
+	void SetMaxNavQueriesPerFrame(int InMaxNavQueriesPerFrame) { MaxNavQueriesPerFrame = InMaxNavQueriesPerFrame; }
+	int GetMaxNavQueriesPerFrame() const { return MaxNavQueriesPerFrame; }
+
+	/// Discard the whole graph, e.g. because the navmesh has changed
+	void Reset();
+
+	int GetNumNodes() const { return Nodes.Num(); }
+
+protected:
+	struct FNode
+	{
+		/// Location projected onto the navmesh, only valid if bOnNavMesh
+		FVector Location = FVector::ZeroVector;
+		FIntVector Cell = FIntVector::ZeroValue;
+		/// Linked nodes & the cost to reach them, only valid if bLinksBuilt
+		TArray<TPair<int32, float>, TInlineAllocator<8>> Links;
+		bool bOnNavMesh = false;
+		bool bLinksBuilt = false;
+	};
+
+	struct FOpenNode
+	{
+		int32 Node;
+		float Distance;
+		bool operator<(const FOpenNode& Other) const { return Distance < Other.Distance; }
+	};
+
+	/// Graph distances from a start node
+	struct FDistanceField
+	{
+		/// Distances to settled nodes, which are final even if the search isn't complete
+		TMap<int32, float> Distances;
+		/// The search frontier, kept so that the search can be continued when it runs out of budget
+		TArray<FOpenNode> Open;
+		bool bComplete = false;
+	};
+
+	TWeakObjectPtr<const ANavigationData> NavData;
+	FSharedConstNavQueryFilter Filter;
+	float CellSize;
+	float MaxSearchDistance;
+
+	TArray<FNode> Nodes;
+	TMap<FIntVector, int32> CellNodes;
+	/// Cached distance fields, keyed on start node
+	TSussQueryCache<int32, FDistanceField> DistanceFields;
+
+	/// Maximum number of nodes before the graph is reset, to bound memory
+	int MaxNodes = 65536;
+	/// Maximum number of nodes settled by a single search
+	int MaxSearchNodes = 4096;
+	/// Maximum number of cached distance fields
+	int MaxDistanceFields = 64;
+	/// Maximum navmesh queries made to build the graph per frame, or 0 for no limit
+	int MaxNavQueriesPerFrame = 1000;
+	int NavQueriesThisFrame = 0;
+	uint64 NavQueriesFrame = MAX_uint64;
+	/// Start nodes of distance fields whose search isn't complete
+	TArray<int32> IncompleteSearches;
+
+	FIntVector GetCell(const FVector& Location) const;
+	/// Get or lazily create the node for a cell
+	int32 GetNode(const FIntVector& Cell);
+	void BuildLinks(int32 NodeIndex);
+	/// Get the distance field for a start node, starting or continuing its search within the budget
+	const FDistanceField& GetDistanceField(int32 StartNode);
+	void ContinueSearch(FDistanceField& Field);
+	/// Whether there's enough budget left this frame to build the links of a node
+	bool HasBuildBudget();
+	void ConsumeBuildBudget(int NavQueries);
+	/// Start a new budget if this is a new frame
+	void RefreshBuildBudget();
+};
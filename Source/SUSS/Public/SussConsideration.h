@@ -38,6 +38,12 @@ public:
 	UPROPERTY(EditDefaultsOnly)
 	TMap<FName, FSussParameter> Parameters;
 
+	/// The maximum frequency, in seconds, that the input for this consideration should be re-evaluated for the same
+	/// action & context. In between, the last input value will be re-used. Useful for expensive inputs such as path
+	/// distance or line of sight, which rarely need refreshing at the full brain update rate. 0 means always evaluate.
+	UPROPERTY(EditDefaultsOnly)
+	float MaxFrequency = 0;
+
 	/// Min value of interest of the input, which can be used to re-normalise the range.
 	UPROPERTY(EditDefaultsOnly)
 	FSussParameter BookendMin = FSussParameter::ZeroLiteral;
@@ -61,5 +67,13 @@ public:
 	UPROPERTY(EditDefaultsOnly, meta=(EditCondition="CurveType==ESussCurveType::Custom", EditConditionHides))
 	UCurveFloat* CustomCurve = nullptr;
 
+	/// Whether this consideration is a "gate", i.e. it's mostly used to exclude contexts by scoring zero. Gates are
+	/// evaluated before other considerations across all contexts, so failing contexts are removed before any of the
+	/// continuous (and potentially more expensive) considerations are run. Step curves are always treated as gates.
+	UPROPERTY(EditDefaultsOnly)
+	bool bIsGate = false;
+
 	float EvaluateCurve(float Input) const;
+
+	bool IsGate() const { return bIsGate || CurveType == ESussCurveType::Step; }
 };
@@ -53,7 +53,8 @@ typedef TVariant<
 	float,
 	int,
 	const FSussContextValueStructBase*,
-	TSharedPtr<const FSussContextValueStructBase>
+	TSharedPtr<const FSussContextValueStructBase>,
+	TSharedPtr<const FSussContextValueStructBase, ESPMode::NotThreadSafe>
 > TSussContextValueVariant;
 
 /// A flexibly typed value which can be present in a context so that inputs / autoparameters can use them
@@ -95,6 +96,12 @@ struct FSussContextValue
 	{
 		Value.Set<TSharedPtr<const FSussContextValueStructBase>>(V);
 	}
+	/// Store context structs that will be auto-deleted when finished with, without atomic reference counting. Only use
+	/// this for values which are only ever used on the game thread, like those generated during brain updates.
+	FSussContextValue(const TSharedPtr<const FSussContextValueStructBase, ESPMode::NotThreadSafe>& V) : Type(ESussContextValueType::Struct)
+	{
+		Value.Set<TSharedPtr<const FSussContextValueStructBase, ESPMode::NotThreadSafe>>(V);
+	}
 	/// Store pointers to context structs that you manage the memory for. Be careful with this!
 	/// If you set your query to cache results and your objects get destroyed while the query is still keeping cached
 	/// results, this will cause a crash. If in doubt, use the shared pointer version
@@ -173,6 +180,34 @@ struct FSussContextValue
 		return !(Lhs == RHS);
 	}
 
+	friend uint32 GetTypeHash(const FSussContextValue& V)
+	{
+		const uint32 Hash = GetTypeHash(static_cast<uint8>(V.Type));
+		switch (V.Type)
+		{
+		case ESussContextValueType::Actor:
+			return HashCombine(Hash, GetTypeHash(V.Value.Get<TWeakObjectPtr<AActor>>()));
+		case ESussContextValueType::Vector:
+			return HashCombine(Hash, GetTypeHash(V.Value.Get<FVector>()));
+		case ESussContextValueType::Rotator:
+			return HashCombine(Hash, GetTypeHash(V.Value.Get<FRotator>().Euler()));
+		case ESussContextValueType::Tag:
+			return HashCombine(Hash, GetTypeHash(V.Value.Get<FGameplayTag>()));
+		case ESussContextValueType::Name:
+			return HashCombine(Hash, GetTypeHash(V.Value.Get<FName>()));
+		case ESussContextValueType::Float:
+			return HashCombine(Hash, GetTypeHash(V.Value.Get<float>()));
+		case ESussContextValueType::Int:
+			return HashCombine(Hash, GetTypeHash(V.Value.Get<int>()));
+		case ESussContextValueType::Struct:
+			// Identity only, we can't compare struct contents
+			return HashCombine(Hash, GetTypeHash(V.GetStructValue()));
+		default:
+		case ESussContextValueType::NONE:
+			return Hash;
+		}
+	}
+
 	const FSussContextValueStructBase* GetStructValue() const
 	{
 		if (const auto pRaw = Value.TryGet<const FSussContextValueStructBase*>())
@@ -186,6 +221,13 @@ struct FSussContextValue
 				return pShared->Get();
 			}
 		}
+		if (auto pShared = Value.TryGet<TSharedPtr<const FSussContextValueStructBase, ESPMode::NotThreadSafe>>())
+		{
+			if (pShared->IsValid())
+			{
+				return pShared->Get();
+			}
+		}
 
 		return nullptr;
 	}
@@ -248,6 +290,19 @@ public:
 					
 	}
 
+	friend uint32 GetTypeHash(const FSussContext& Ctx)
+	{
+		uint32 Hash = GetTypeHash(Ctx.ControlledActor);
+		Hash = HashCombine(Hash, GetTypeHash(Ctx.Target));
+		Hash = HashCombine(Hash, GetTypeHash(Ctx.Location));
+		for (const auto& Pair : Ctx.NamedValues)
+		{
+			// Order-independent, since named values could be added in any order
+			Hash ^= HashCombine(GetTypeHash(Pair.Key), GetTypeHash(Pair.Value));
+		}
+		return Hash;
+	}
+
 	FString ToString() const
 	{
 		TStringBuilder<256> Builder;
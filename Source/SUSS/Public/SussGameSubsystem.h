@@ -66,6 +66,14 @@ public:
 	UFUNCTION(BlueprintCallable)
 	void RegisterInputProvider(USussInputProvider* Provider);
 
+	/// Unregister an input provider by class
+	UFUNCTION(BlueprintCallable)
+	void UnregisterInputProviderClass(TSubclassOf<USussInputProvider> ProviderClass);
+
+	/// Unregister an input provider instance
+	UFUNCTION(BlueprintCallable)
+	void UnregisterInputProvider(USussInputProvider* Provider);
+
 	UFUNCTION(BlueprintCallable)
 	USussInputProvider* GetInputProvider(const FGameplayTag& Tag);
 
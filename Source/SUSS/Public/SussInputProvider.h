@@ -9,7 +9,20 @@
 #include "UObject/Object.h"
 #include "SussInputProvider.generated.h"
 
+/// The elements of a context which an input provider reads
+UENUM(BlueprintType, meta=(Bitflags, UseEnumValuesAsMaskValuesInEditor="true"))
+enum class ESussInputContextElements : uint8
+{
+	None = 0 UMETA(Hidden),
+	/// The controlled actor
+	Self = 1 << 0,
+	Target = 1 << 1,
+	Location = 1 << 2,
+	NamedValues = 1 << 3,
 
+	All = Self | Target | Location | NamedValues UMETA(Hidden)
+};
+ENUM_CLASS_FLAGS(ESussInputContextElements)
 
 /**
  * An input provider supplies a float input value to a considerations, which is determined at runtime, and identified by an input tag.
@@ -33,6 +46,12 @@ protected:
 	/// The tag which identifies the input which this provider is supplying
 	UPROPERTY(EditDefaultsOnly, BlueprintReadOnly, meta=(Categories="Suss.Input"))
 	FGameplayTag InputTag;
+
+	/// Which elements of the context this input reads. Inputs which only read Self are evaluated once per action per
+	/// brain update rather than once per context, and can exclude an action before its contexts are generated.
+	/// Defaults to all elements, which is always safe.
+	UPROPERTY(EditDefaultsOnly, BlueprintReadOnly, meta=(Bitmask, BitmaskEnum="/Script/SUSS.ESussInputContextElements"))
+	int32 ContextElements = static_cast<int32>(ESussInputContextElements::All);
 	
 public:
 
@@ -40,6 +59,12 @@ public:
 	
 	virtual FGameplayTag GetInputTag() const { return InputTag; }
 
+	ESussInputContextElements GetContextElements() const { return static_cast<ESussInputContextElements>(ContextElements); }
+
+	/// Whether this input only reads the controlled actor (Self) from the context, and so will return the same result
+	/// for every context generated for an action
+	bool IsSelfOnly() const { return !EnumHasAnyFlags(GetContextElements(), ~ESussInputContextElements::Self); }
+
 	
 	/// Evaluate the input given a context
 	/// Also used to resolve parameters to queries and other inputs, in which case context is solely the Self reference
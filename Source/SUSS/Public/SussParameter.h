@@ -156,6 +156,7 @@ public:
 			Hash = HashCombine(Hash, GetTypeHash(Arg.BoolValue));
 			break;
 		case ESussParamType::Name:
+			Hash = HashCombine(Hash, GetTypeHash(Arg.NameValue));
 			break;
 		};
 		return Hash;
@@ -0,0 +1,223 @@
+﻿// 
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "NavigationData.h"
+#include "SussCoarseNavGraph.h"
+#include "SussQueryCache.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "SussPathDistanceWorldSubsystem.generated.h"
+
+class AAIController;
+
+/// Key for cached path distances. Locations are quantised so that requests for nearby locations share results.
+struct FSussPathDistanceKey
+{
+	TObjectKey<ANavigationData> NavData;
+	TObjectKey<UClass> FilterClass;
+	FIntVector Start = FIntVector::ZeroValue;
+	FIntVector End = FIntVector::ZeroValue;
+	bool bAllowPartialPath = false;
+
+	FSussPathDistanceKey() {}
+	FSussPathDistanceKey(const ANavigationData* InNavData,
+	                     const UClass* InFilterClass,
+	                     const FIntVector& InStart,
+	                     const FIntVector& InEnd,
+	                     bool bInAllowPartialPath)
+		: NavData(InNavData),
+		  FilterClass(InFilterClass),
+		  Start(InStart),
+		  End(InEnd),
+		  bAllowPartialPath(bInAllowPartialPath)
+	{
+	}
+
+	bool operator==(const FSussPathDistanceKey& Other) const
+	{
+		return NavData == Other.NavData &&
+			FilterClass == Other.FilterClass &&
+			Start == Other.Start &&
+			End == Other.End &&
+			bAllowPartialPath == Other.bAllowPartialPath;
+	}
+
+	friend uint32 GetTypeHash(const FSussPathDistanceKey& Key)
+	{
+		uint32 Hash = HashCombine(GetTypeHash(Key.NavData), GetTypeHash(Key.FilterClass));
+		Hash = HashCombine(Hash, GetTypeHash(Key.Start));
+		Hash = HashCombine(Hash, GetTypeHash(Key.End));
+		return HashCombine(Hash, GetTypeHash(Key.bAllowPartialPath));
+	}
+};
+
+struct FSussCachedPathDistance
+{
+	/// The path distance, or an estimate if bHasResult is false
+	float Distance = BIG_NUMBER;
+	/// The path which Distance was measured along, if found
+	FNavPathSharedPtr Path;
+	/// Time that the current result was requested
+	double Time = 0;
+	double LastUsedTime = 0;
+	/// Time that the pending path find was requested
+	double PendingTime = 0;
+	uint32 PendingQueryID = 0;
+	bool bPending = false;
+	bool bHasResult = false;
+};
+
+/// Results of comparing approximate path distances with exact ones, see USussPathDistanceWorldSubsystem::BenchmarkApproxPathDistance
+USTRUCT(BlueprintType)
+struct FSussPathDistanceBenchmarkResult
+{
+	GENERATED_BODY()
+
+	/// The number of reachable locations which were compared
+	UPROPERTY(BlueprintReadOnly)
+	int Samples = 0;
+	/// The number of locations which the coarse graph couldn't estimate, so fell back on the straight line distance
+	UPROPERTY(BlueprintReadOnly)
+	int Fallbacks = 0;
+	/// Mean of |approx - exact| / exact
+	UPROPERTY(BlueprintReadOnly)
+	float MeanRelativeError = 0;
+	/// The proportion of pairs of locations which approximate distances rank in the same order as exact distances
+	UPROPERTY(BlueprintReadOnly)
+	float RankAgreement = 0;
+	/// Mean time per exact distance, which uses a synchronous path find
+	UPROPERTY(BlueprintReadOnly)
+	float ExactMicroseconds = 0;
+	/// Mean time per approximate distance, including lazily building the coarse graph
+	UPROPERTY(BlueprintReadOnly)
+	float ApproxColdMicroseconds = 0;
+	/// Mean time per approximate distance when repeated, once the graph has been built
+	UPROPERTY(BlueprintReadOnly)
+	float ApproxWarmMicroseconds = 0;
+};
+
+/**
+ * World-scope subsystem which provides path distances for inputs. Results are cached per navigation data, filter, and
+ * quantised start & end location for a short time, and by default path finds for results which aren't cached are run
+ * asynchronously. The navigation system runs all the async path finds requested in a frame together as a batch on a
+ * worker thread, so no pathfinding happens inside brain updates. Until the result is ready, the previous result is
+ * returned, or an estimate based on the straight line distance if there isn't one.
+ */
+UCLASS()
+class SUSS_API USussPathDistanceWorldSubsystem : public UWorldSubsystem, public FTickableGameObject
+{
+	GENERATED_BODY()
+protected:
+	/// How long path distances are cached for, from settings
+	float CacheLifetime = 1;
+	/// Grid size that locations are quantised to, from settings
+	float CacheCellSize = 50;
+	/// Whether to find paths asynchronously, from settings
+	bool bAsyncPathFinding = true;
+
+	/// Straight line distance is multiplied by this to estimate path distance when no path has been found yet
+	float EstimatedPathDistanceScale = 1.2f;
+	/// How long to wait for an async path find before assuming it has been lost
+	float PendingPathFindTimeout = 2;
+	/// How long cached distances can go without being requested before they're evicted
+	float UnusedCacheEntryLifetime = 5;
+	/// The maximum number of cached distances
+	int MaxCacheEntries = 4096;
+	/// The maximum number of entries in the cache to check for eviction per tick
+	int MaxCacheEvictionChecksPerTick = 64;
+
+	TSussQueryCache<FSussPathDistanceKey, FSussCachedPathDistance> CachedDistances;
+
+	/// Cell size of coarse graphs used for approximate distances, from settings
+	float ApproxCellSize = 500;
+	/// Max search distance of coarse graphs used for approximate distances, from settings
+	float ApproxMaxSearchDistance = 10000;
+	/// Max navmesh queries per frame to build each coarse graph, from settings
+	int ApproxMaxNavQueriesPerFrame = 1000;
+
+	/// Coarse graphs for approximate distances, per navigation data & filter class
+	TMap<TPair<TObjectKey<ANavigationData>, TObjectKey<UClass>>, TUniquePtr<FSussCoarseNavGraph>> CoarseGraphs;
+
+	virtual bool DoesSupportWorldType(const EWorldType::Type WorldType) const override;
+
+	FIntVector QuantiseLocation(const FVector& Location) const;
+	void RequestPathFind(const FSussPathDistanceKey& Key,
+	                     FSussCachedPathDistance& Entry,
+	                     AAIController* Agent,
+	                     const ANavigationData* NavData,
+	                     const FVector& FromLocation,
+	                     const FVector& ToLocation,
+	                     double Now);
+	void OnPathFound(uint32 QueryID,
+	                 ENavigationQueryResult::Type Result,
+	                 FNavPathSharedPtr Path,
+	                 FSussPathDistanceKey Key);
+	UFUNCTION()
+	void OnNavigationGenerationFinished(ANavigationData* NavData);
+	bool EstimateWithCoarseGraph(AAIController* Agent,
+	                             const FVector& FromLocation,
+	                             const FVector& ToLocation,
+	                             float& OutDistance);
+
+public:
+	USussPathDistanceWorldSubsystem();
+
+	virtual void OnWorldBeginPlay(UWorld& InWorld) override;
+
+	/**
+	 * Get the distance along navmesh paths between 2 locations for an agent, using cached results where available.
+	 * When async path finding is enabled and there is no up to date result, a path find is started and the previous
+	 * result, or an estimate, is returned.
+	 * @param Agent The agent
+	 * @param FromLocation The location to measure from
+	 * @param ToLocation The desired location
+	 * @param bAllowPartialPath Whether to allow partial paths
+	 * @param OutPath Optionally, the path which the returned distance was measured along, if any. This is the previous
+	 * path if a new path find is pending, so it may have been found from a slightly different location.
+	 * @return Distance, or BIG_NUMBER if unreachable
+	 */
+	float GetPathDistance(AAIController* Agent,
+	                      const FVector& FromLocation,
+	                      const FVector& ToLocation,
+	                      bool bAllowPartialPath,
+	                      FNavPathSharedPtr* OutPath = nullptr);
+
+	/**
+	 * Estimate the distance along navmesh paths between 2 locations for an agent, using a coarse graph over the navmesh
+	 * which is built lazily. This is far cheaper than finding a path, and good for ranking candidate locations, but is
+	 * not exact. Use GetPathDistance or find a path for the location which is finally chosen.
+	 * @param Agent The agent
+	 * @param FromLocation The location to measure from
+	 * @param ToLocation The desired location
+	 * @return Estimated distance. Falls back on an estimate based on the straight line distance if the coarse graph
+	 * can't provide one, e.g. because the location is too far away.
+	 */
+	float GetApproxPathDistance(AAIController* Agent, const FVector& FromLocation, const FVector& ToLocation);
+
+	/**
+	 * Compare approximate path distances with exact ones from an agent's current location to random reachable
+	 * locations, for tuning the approximate distance settings. Results are also logged.
+	 * This runs many synchronous path finds, so don't use it in shipping gameplay.
+	 * @param Agent The agent to measure from
+	 * @param NumSamples The number of random locations to compare
+	 * @param Radius The radius to pick random locations in
+	 */
+	UFUNCTION(BlueprintCallable, Category="SUSS")
+	FSussPathDistanceBenchmarkResult BenchmarkApproxPathDistance(AAIController* Agent, int NumSamples = 100, float Radius = 3000);
+
+	virtual UWorld* GetTickableGameObjectWorld() const override { return GetWorld(); }
+	virtual bool IsTickableWhenPaused() const override { return false; }
+	virtual TStatId GetStatId() const override;
+	virtual void Tick(float DeltaTime) override;
+};
+
+inline USussPathDistanceWorldSubsystem* GetSussPathDistanceWorldSubsystem(const UWorld* World)
+{
+	if (IsValid(World) && World->IsGameWorld())
+	{
+		return World->GetSubsystem<USussPathDistanceWorldSubsystem>();
+	}
+		
+	return nullptr;
+}
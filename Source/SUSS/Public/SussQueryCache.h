@@ -0,0 +1,197 @@
+﻿// 
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "SussCommon.h"
+#include "Containers/List.h"
+
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("SUSS Query Cache Hits"), STAT_SUSS_QueryCacheHits, STATGROUP_SUSS, SUSS_API);
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("SUSS Query Cache Misses"), STAT_SUSS_QueryCacheMisses, STATGROUP_SUSS, SUSS_API);
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("SUSS Query Cache Evictions"), STAT_SUSS_QueryCacheEvictions, STATGROUP_SUSS, SUSS_API);
+DECLARE_MEMORY_STAT_EXTERN(TEXT("SUSS Query Cache Memory"), STAT_SUSS_QueryCacheMemory, STATGROUP_SUSS, SUSS_API);
+
+/// Running statistics for a query cache
+struct FSussQueryCacheStats
+{
+	uint32 Hits = 0;
+	uint32 Misses = 0;
+	uint32 Evictions = 0;
+	int Entries = 0;
+	/// Approximate, since we can't know the size of everything results refer to
+	SIZE_T Bytes = 0;
+
+	FSussQueryCacheStats& operator+=(const FSussQueryCacheStats& Other)
+	{
+		Hits += Other.Hits;
+		Misses += Other.Misses;
+		Evictions += Other.Evictions;
+		Entries += Other.Entries;
+		Bytes += Other.Bytes;
+		return *this;
+	}
+};
+
+/**
+ * Cache of query results, keyed on the full query request (KeyType must provide GetTypeHash and operator==, so that
+ * requests which happen to have the same hash never share results). Entries are kept in least-recently-used order so
+ * that the cache can be bounded by number of entries and approximate memory use.
+ * Not thread safe, the owner must guard access.
+ */
+template<typename KeyType, typename EntryType>
+class TSussQueryCache
+{
+protected:
+	typedef TDoubleLinkedList<KeyType> FLruList;
+	typedef typename FLruList::TDoubleLinkedListNode FLruNode;
+
+	struct FItem
+	{
+		EntryType Entry;
+		FLruNode* LruNode = nullptr;
+		SIZE_T Bytes = 0;
+	};
+
+	TMap<KeyType, FItem> Items;
+	/// Keys in order of use, most recent at the head
+	FLruList Lru;
+	SIZE_T TotalBytes = 0;
+	FSussQueryCacheStats Stats;
+
+public:
+	TSussQueryCache() {}
+	~TSussQueryCache() { Empty(); }
+	UE_NONCOPYABLE(TSussQueryCache);
+
+	/// Find an entry, marking it as the most recently used
+	EntryType* Find(const KeyType& Key)
+	{
+		if (FItem* pItem = Items.Find(Key))
+		{
+			if (pItem->LruNode != Lru.GetHead())
+			{
+				Lru.RemoveNode(pItem->LruNode, false);
+				Lru.AddHead(pItem->LruNode);
+			}
+			return &pItem->Entry;
+		}
+		return nullptr;
+	}
+
+	/// Find an entry without affecting the order of use
+	EntryType* FindNoTouch(const KeyType& Key)
+	{
+		if (FItem* pItem = Items.Find(Key))
+		{
+			return &pItem->Entry;
+		}
+		return nullptr;
+	}
+
+	/// Add a new entry for a key which is not already present, as the most recently used
+	EntryType& Add(const KeyType& Key)
+	{
+		FItem& Item = Items.Add(Key);
+		Lru.AddHead(Key);
+		Item.LruNode = Lru.GetHead();
+		return Item.Entry;
+	}
+
+	void RecordHit()
+	{
+		++Stats.Hits;
+		INC_DWORD_STAT(STAT_SUSS_QueryCacheHits);
+	}
+
+	void RecordMiss()
+	{
+		++Stats.Misses;
+		INC_DWORD_STAT(STAT_SUSS_QueryCacheMisses);
+	}
+
+	/// Update the approximate size of an entry
+	void SetEntrySize(const KeyType& Key, SIZE_T Bytes)
+	{
+		if (FItem* pItem = Items.Find(Key))
+		{
+			DEC_MEMORY_STAT_BY(STAT_SUSS_QueryCacheMemory, pItem->Bytes);
+			INC_MEMORY_STAT_BY(STAT_SUSS_QueryCacheMemory, Bytes);
+			TotalBytes = TotalBytes - pItem->Bytes + Bytes;
+			pItem->Bytes = Bytes;
+		}
+	}
+
+	void Remove(const KeyType& Key)
+	{
+		if (FItem* pItem = Items.Find(Key))
+		{
+			DEC_MEMORY_STAT_BY(STAT_SUSS_QueryCacheMemory, pItem->Bytes);
+			TotalBytes -= pItem->Bytes;
+			Lru.RemoveNode(pItem->LruNode);
+			Items.Remove(Key);
+		}
+	}
+
+	/**
+	 * Evict least recently used entries until the cache is within limits. The most recently used entry is never
+	 * evicted, so an entry which has just been added or found remains valid.
+	 * @param MaxEntries Maximum number of entries, or 0 for no limit
+	 * @param MaxBytes Maximum approximate memory use, or 0 for no limit
+	 */
+	void EnforceLimits(int MaxEntries, SIZE_T MaxBytes)
+	{
+		while (Items.Num() > 1 &&
+			((MaxEntries > 0 && Items.Num() > MaxEntries) || (MaxBytes > 0 && TotalBytes > MaxBytes)))
+		{
+			EvictLeastRecent();
+		}
+	}
+
+	/**
+	 * Check up to MaxChecks of the least recently used entries, evicting them if ShouldEvict returns true. Stops at
+	 * the first entry which is kept, since every other entry has been used more recently.
+	 */
+	template<typename PredicateType>
+	void EvictUnused(int MaxChecks, PredicateType&& ShouldEvict)
+	{
+		for (int i = 0; i < MaxChecks && Lru.GetTail(); ++i)
+		{
+			const FItem& Item = Items.FindChecked(Lru.GetTail()->GetValue());
+			if (!ShouldEvict(Item.Entry))
+				break;
+
+			EvictLeastRecent();
+		}
+	}
+
+	void Empty()
+	{
+		DEC_MEMORY_STAT_BY(STAT_SUSS_QueryCacheMemory, TotalBytes);
+		Items.Empty();
+		Lru.Empty();
+		TotalBytes = 0;
+	}
+
+	int Num() const { return Items.Num(); }
+
+	FSussQueryCacheStats GetStats() const
+	{
+		FSussQueryCacheStats Ret = Stats;
+		Ret.Entries = Items.Num();
+		Ret.Bytes = TotalBytes;
+		return Ret;
+	}
+
+protected:
+	void EvictLeastRecent()
+	{
+		if (FLruNode* Tail = Lru.GetTail())
+		{
+			// Copy key, removing the node frees it
+			const KeyType Key = Tail->GetValue();
+			Remove(Key);
+			++Stats.Evictions;
+			INC_DWORD_STAT(STAT_SUSS_QueryCacheEvictions);
+		}
+	}
+};
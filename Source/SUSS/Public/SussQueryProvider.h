@@ -5,9 +5,11 @@
 #include "CoreMinimal.h"
 #include "Engine/DataAsset.h"
 #include "GameplayTagContainer.h"
+#include "GenericTeamAgentInterface.h"
 #include "SussContext.h"
 #include "UObject/Object.h"
 #include "SussParameter.h"
+#include "SussQueryCache.h"
 #include "SussQueryProvider.generated.h"
 
 
@@ -27,20 +29,187 @@ enum class ESussQueryContextElement : uint8
 	NamedValue,
 };
 
+/// How to order query results, mostly useful in conjunction with a maximum number of results
+UENUM(BlueprintType)
+enum class ESussQueryResultSort : uint8
+{
+	/// Keep the order the query provided them in (e.g. EQS results are already ordered best first)
+	None,
+	/// Results nearest to the controlled actor first
+	NearestFirst,
+	/// Results furthest from the controlled actor first
+	FurthestFirst
+};
+
+/// The result limits requested for a single execution of a query. These are passed through the execution rather than
+/// stored on the provider, so nested or re-entrant requests to the same provider each keep their own.
+struct FSussQueryResultLimits
+{
+public:
+	/// If > 0, the maximum number of results to keep
+	int MaxResults = 0;
+	ESussQueryResultSort ResultSort = ESussQueryResultSort::None;
+	/// Providers which apply the limits themselves while generating results (see USussQueryProvider::SelectResults)
+	/// set this, so that they aren't applied again afterwards
+	bool bApplied = false;
+
+	FSussQueryResultLimits() {}
+	FSussQueryResultLimits(int InMaxResults, ESussQueryResultSort InResultSort) : MaxResults(InMaxResults), ResultSort(InResultSort) {}
+
+	bool HasLimits() const { return MaxResults > 0 || ResultSort != ESussQueryResultSort::None; }
+};
+
 typedef TVariant<
 		TArray<TWeakObjectPtr<AActor>>,
 		TArray<FVector>,
 		TArray<FSussContextValue>
 	> TSussResultsArray;
 
+/// Read-only view of one set of cached query results. Cached results are never modified once generated, so holding a
+/// snapshot keeps that version of the results alive without copying them, even if the query re-runs in the meantime.
+struct FSussQueryResultsSnapshot
+{
+public:
+	TSharedPtr<const TSussResultsArray, ESPMode::ThreadSafe> Results;
+	/// Incremented every time the query which owns these results is re-run
+	uint32 Version = 0;
+
+	bool IsValid() const { return Results.IsValid(); }
+
+	template<typename T>
+	const TArray<T>& Get() const
+	{
+		if (Results.IsValid() && Results->IsType<TArray<T>>())
+		{
+			return Results->Get<TArray<T>>();
+		}
+		static const TArray<T> Empty;
+		return Empty;
+	}
+};
+
+/// Counts of events on a brain which can invalidate cached query results, see USussQueryProvider::bInvalidateOnPerceptionUpdated
+struct FSussQueryInvalidationCounts
+{
+	uint32 PerceptionUpdates = 0;
+	uint32 TagChanges = 0;
+};
+
 struct FSussCachedQueryResults
 {
 public:
 	TMap<FName, FSussParameter> Params;
 	TWeakObjectPtr<AActor> ControlledActor;
-	float TimeSinceLastRun = 100000;
+	/// Provider cache time at which the query was last run
+	double LastRunTime = TNumericLimits<double>::Lowest();
+	/// Provider cache time at which these results were last requested
+	double LastUsedTime = 0;
+	int MaxResults = 0;
+	ESussQueryResultSort ResultSort = ESussQueryResultSort::None;
+	uint32 Version = 0;
+	/// The brain's invalidation counts when the query was last run
+	FSussQueryInvalidationCounts InvalidationCounts;
+	/// Whether stale results have been served and a deferred refresh is queued
+	bool bRefreshPending = false;
+	/// Whether the query is currently running asynchronously to update these results
+	bool bAsyncPending = false;
+	/// The ID of the asynchronous query which is updating these results, so that completions of superseded queries are ignored
+	int32 AsyncQueryID = INDEX_NONE;
+	/// The brain to run a deferred refresh with
+	TWeakObjectPtr<USussBrainComponent> RefreshBrain;
+	/// Shared so that snapshots can be handed out; only ever modified in place when no snapshots are outstanding
+	TSharedPtr<TSussResultsArray, ESPMode::ThreadSafe> Results;
+
+	FSussQueryResultsSnapshot GetSnapshot() const
+	{
+		return FSussQueryResultsSnapshot { Results, Version };
+	}
+};
+
+/// Cached results of a correlated query, for a single source context
+struct FSussCachedCorrelatedQueryResults
+{
+public:
+	TWeakObjectPtr<AActor> ControlledActor;
+	/// Only to detect when the target has been destroyed, the source context is part of the key
+	TWeakObjectPtr<AActor> SourceTarget;
+	/// Provider cache time at which the query was last run
+	double LastRunTime = TNumericLimits<double>::Lowest();
+	/// The frequency these results were requested with, after which they're evicted
+	float MaxFrequency = 0;
+	/// The brain's invalidation counts when the query was last run
+	FSussQueryInvalidationCounts InvalidationCounts;
 	TSussResultsArray Results;
 };
+
+/// Full key identifying a request for uncorrelated query results
+struct SUSS_API FSussQueryCacheKey
+{
+public:
+	/// Compared by identity only. Null if the query doesn't depend on Self, or results are shared by location
+	const AActor* Self = nullptr;
+	TMap<FName, FSussParameter> Params;
+	int MaxResults = 0;
+	ESussQueryResultSort ResultSort = ESussQueryResultSort::None;
+	/// Quantised location of Self, when results are shared by location
+	FIntVector LocationCell = FIntVector::ZeroValue;
+	/// Team of Self, when results are shared by location
+	uint8 TeamId = FGenericTeamId::NoTeam;
+	uint32 Hash = 0;
+
+	FSussQueryCacheKey() {}
+	FSussQueryCacheKey(const AActor* InSelf,
+	                   const TMap<FName, FSussParameter>& InParams,
+	                   int InMaxResults,
+	                   ESussQueryResultSort InResultSort,
+	                   const FIntVector& InLocationCell = FIntVector::ZeroValue,
+	                   uint8 InTeamId = FGenericTeamId::NoTeam);
+
+	static bool ParamsMatch(const TMap<FName, FSussParameter>& Params1, const TMap<FName, FSussParameter>& Params2);
+
+	bool operator==(const FSussQueryCacheKey& Other) const
+	{
+		return Hash == Other.Hash &&
+			Self == Other.Self &&
+			MaxResults == Other.MaxResults &&
+			ResultSort == Other.ResultSort &&
+			LocationCell == Other.LocationCell &&
+			TeamId == Other.TeamId &&
+			ParamsMatch(Params, Other.Params);
+	}
+
+	friend uint32 GetTypeHash(const FSussQueryCacheKey& Key) { return Key.Hash; }
+
+	SIZE_T GetAllocatedSize() const { return Params.GetAllocatedSize(); }
+};
+
+/// Full key identifying a request for correlated query results in a single source context
+struct SUSS_API FSussCorrelatedQueryCacheKey
+{
+public:
+	FSussQueryCacheKey Request;
+	FSussContext SourceContext;
+	uint32 Hash = 0;
+
+	FSussCorrelatedQueryCacheKey() {}
+	FSussCorrelatedQueryCacheKey(const FSussQueryCacheKey& InRequest, const FSussContext& InSourceContext);
+
+	/// Whether 2 source contexts are the same for caching purposes. Unlike FSussContext::operator==, struct values
+	/// are compared by identity, which is stable for cached results.
+	static bool SourceContextsMatch(const FSussContext& Context1, const FSussContext& Context2);
+
+	bool operator==(const FSussCorrelatedQueryCacheKey& Other) const
+	{
+		return Hash == Other.Hash &&
+			Request == Other.Request &&
+			SourceContextsMatch(SourceContext, Other.SourceContext);
+	}
+
+	friend uint32 GetTypeHash(const FSussCorrelatedQueryCacheKey& Key) { return Key.Hash; }
+
+	SIZE_T GetAllocatedSize() const { return Request.GetAllocatedSize() + SourceContext.NamedValues.GetAllocatedSize(); }
+};
+
 /**
  * Query providers are responsible for supplying some element of context for action evaluation, e.g. a location, or a target.
  * Action descriptions in a brain list all the queries they need running, and in turn the queries declare which elements
@@ -87,7 +256,7 @@ protected:
 	/// generated from another query.
 	/// If false this query will simply generate values independently of any other query. The first query in an action
 	/// has to be uncorrelated.
-	/// Note: Correlated queries can never cache their results.
+	/// Correlated queries cache their results per source context, so they're only re-used for the same source context.
 	UPROPERTY(EditDefaultsOnly, BlueprintReadOnly)
 	bool bIsCorrelatedWithContext = false;
 
@@ -100,7 +269,6 @@ protected:
 	/// Whether or not this query should re-use cached results within the max requested frequency
 	/// You might want to set this to false if your query just reads already prepared data from elsewhere, which is
 	/// updated only when needed, and thus when the query fires you always want the latest from that. E.g. perception.
-	/// Note: Correlated queries can never cache their results.
 	UPROPERTY(EditDefaultsOnly, BlueprintReadOnly)
 	bool bUseCachedResults = true;
 
@@ -109,8 +277,93 @@ protected:
 	/// results point to will outlive the cache.
 	bool bDisableRawPointerCacheWarning = false; 
 
-	// Cached results for each params combination
-	TMap<uint32, FSussCachedQueryResults> CachedResultsByParamsHash;
+	/// The maximum number of results to keep cached for different requests, least recently used are evicted first.
+	/// Correlated results are cached separately, with the same limit. 0 means unlimited.
+	UPROPERTY(EditDefaultsOnly, BlueprintReadOnly)
+	int MaxCacheEntries = 512;
+
+	/// The approximate maximum memory, in KB, to use for cached results, least recently used are evicted first.
+	/// Correlated results are cached separately, with the same limit. 0 means unlimited.
+	UPROPERTY(EditDefaultsOnly, BlueprintReadOnly)
+	int MaxCacheSizeKB = 0;
+
+	/// If true, agents which are near each other (and on the same team) share cached results, even though Self is
+	/// relevant. Useful for expensive position-dependent queries such as "cover near me", where a group of agents
+	/// would otherwise all run the same query. Results are generated from the location of whichever agent ran the
+	/// query, so this trades some accuracy for fewer queries; considerations are still evaluated per agent.
+	UPROPERTY(EditDefaultsOnly, BlueprintReadOnly, meta=(EditCondition="bUseCachedResults && bSelfIsRelevant"))
+	bool bShareResultsByLocation = false;
+
+	/// When sharing results by location, the size of the grid cells agents must be in to share results
+	UPROPERTY(EditDefaultsOnly, BlueprintReadOnly, meta=(EditCondition="bShareResultsByLocation", ClampMin=1))
+	float SharedResultsCellSize = 500;
+
+	/// When sharing results by location, whether agents must also be on the same team (see IGenericTeamAgentInterface)
+	UPROPERTY(EditDefaultsOnly, BlueprintReadOnly, meta=(EditCondition="bShareResultsByLocation"))
+	bool bShareResultsOnlyWithinTeam = true;
+
+	/// If true, cached results are discarded when the perception of the agent they were generated for is updated, so
+	/// that a long max frequency can be used without acting on out of date perception.
+	UPROPERTY(EditDefaultsOnly, BlueprintReadOnly, meta=(EditCondition="bUseCachedResults"))
+	bool bInvalidateOnPerceptionUpdated = false;
+
+	/// Cached results are discarded when any of these gameplay tags are added to or removed from the agent they were
+	/// generated for (requires an ability system component)
+	UPROPERTY(EditDefaultsOnly, BlueprintReadOnly, meta=(EditCondition="bUseCachedResults"))
+	FGameplayTagContainer InvalidateOnTagsChanged;
+
+	/// If true, cached results are discarded if any actor in them has been destroyed
+	UPROPERTY(EditDefaultsOnly, BlueprintReadOnly, meta=(EditCondition="bUseCachedResults"))
+	bool bInvalidateOnResultActorDestroyed = false;
+
+	/// If true, when cached results are older than the requested max frequency they're still returned, and the query
+	/// is re-run later in the provider tick instead of inline. This takes the query cost off the decision path, at the
+	/// expense of decisions being made on slightly older data. Only applies to uncorrelated queries.
+	UPROPERTY(EditDefaultsOnly, BlueprintReadOnly, meta=(EditCondition="bUseCachedResults"))
+	bool bRefreshStaleResultsDeferred = false;
+
+	/// When bRefreshStaleResultsDeferred is enabled, how much older than the max frequency results can be and still be
+	/// returned while a refresh is pending. Results older than this are re-run inline as usual.
+	UPROPERTY(EditDefaultsOnly, BlueprintReadOnly, meta=(EditCondition="bRefreshStaleResultsDeferred"))
+	float MaxStaleResultAge = 1;
+
+	/// When bRefreshStaleResultsDeferred is enabled, the time budget in milliseconds for running deferred refreshes
+	/// each tick. At least one refresh is always run per tick, so that the queue keeps moving.
+	UPROPERTY(EditDefaultsOnly, BlueprintReadOnly, meta=(EditCondition="bRefreshStaleResultsDeferred"))
+	float DeferredRefreshBudgetMs = 1;
+
+	// Cached results for each request
+	TSussQueryCache<FSussQueryCacheKey, FSussCachedQueryResults> CachedResults;
+
+	// Cached results of correlated queries for each request & source context combination
+	TSussQueryCache<FSussCorrelatedQueryCacheKey, FSussCachedCorrelatedQueryResults> CachedCorrelatedResults;
+
+	// Requests whose stale results have been served, waiting to be re-run in Tick
+	TArray<FSussQueryCacheKey> PendingRefreshes;
+
+	/// Time used to stamp cached results, advanced by Tick. Cached results are checked for expiry when they're read,
+	/// rather than having to update every entry each tick.
+	double CacheTime = 0;
+
+	/// How long cached results can go without being requested before they're evicted
+	float UnusedCacheEntryLifetime = 5;
+
+	/// The maximum number of entries in each cache to check for eviction per tick
+	int MaxCacheEvictionChecksPerTick = 32;
+
+	float GetCacheAge(double Time) const { return static_cast<float>(CacheTime - Time); }
+	SIZE_T GetMaxCacheBytes() const { return static_cast<SIZE_T>(FMath::Max(MaxCacheSizeKB, 0)) * 1024; }
+
+	template<typename KeyType, typename EntryType>
+	static SIZE_T EstimateCacheEntrySize(const KeyType& Key, const EntryType& Entry, const TSussResultsArray& Results)
+	{
+		SIZE_T Size = sizeof(KeyType) * 2 + sizeof(EntryType) + Key.GetAllocatedSize() * 2;
+		Visit([&Size](const auto& Array)
+		{
+			Size += Array.GetAllocatedSize();
+		}, Results);
+		return Size;
+	}
 
 	mutable FCriticalSection Guard;
 
@@ -141,6 +394,127 @@ protected:
 		return Results.Get<TArray<T>>();
 	}
 
+	static bool GetResultLocation(const AActor* Result, FVector& OutLocation)
+	{
+		if (IsValid(Result))
+		{
+			OutLocation = Result->GetActorLocation();
+			return true;
+		}
+		return false;
+	}
+	static bool GetResultLocation(const TWeakObjectPtr<AActor>& Result, FVector& OutLocation)
+	{
+		return GetResultLocation(Result.Get(), OutLocation);
+	}
+	static bool GetResultLocation(const FVector& Result, FVector& OutLocation)
+	{
+		OutLocation = Result;
+		return true;
+	}
+	static bool GetResultLocation(const FSussContextValue& Result, FVector& OutLocation)
+	{
+		switch (Result.Type)
+		{
+		case ESussContextValueType::Actor:
+			return GetResultLocation(Result.Value.Get<TWeakObjectPtr<AActor>>(), OutLocation);
+		case ESussContextValueType::Vector:
+			return GetResultLocation(Result.Value.Get<FVector>(), OutLocation);
+		default:
+			return false;
+		}
+	}
+
+	/**
+	 * Orders results by a key and keeps only the first MaxResults. Uses partial selection so that only the results
+	 * which are kept need to be ordered. Ties keep their original order.
+	 * @param InOutResults The results to sort & truncate
+	 * @param MaxResults The maximum number of results to keep, or 0 for all
+	 * @param GetKey Function returning the sort key of a result, lowest first
+	 */
+	template<typename T, typename AllocatorType, typename KeyFuncType>
+	static void SelectResults(TArray<T, AllocatorType>& InOutResults, int MaxResults, KeyFuncType&& GetKey)
+	{
+		const int Num = InOutResults.Num();
+		if (Num == 0)
+			return;
+		const int Keep = (MaxResults > 0 && MaxResults < Num) ? MaxResults : Num;
+
+		typedef TPair<float, int32> FKeyIndex;
+		auto Less = [](const FKeyIndex& A, const FKeyIndex& B)
+		{
+			return A.Key < B.Key || (A.Key == B.Key && A.Value < B.Value);
+		};
+		auto Greater = [&Less](const FKeyIndex& A, const FKeyIndex& B) { return Less(B, A); };
+
+		// Max-heap of the best Keep results so far, so the worst of them is at the top to be replaced
+		TArray<FKeyIndex, TInlineAllocator<64>> Selected;
+		Selected.Reserve(Keep);
+		for (int i = 0; i < Num; ++i)
+		{
+			const FKeyIndex Entry(GetKey(InOutResults[i]), i);
+			if (Selected.Num() < Keep)
+			{
+				Selected.HeapPush(Entry, Greater);
+			}
+			else if (Less(Entry, Selected.HeapTop()))
+			{
+				Selected.HeapPopDiscard(Greater);
+				Selected.HeapPush(Entry, Greater);
+			}
+		}
+		Selected.Sort(Less);
+
+		TArray<T, AllocatorType> Sorted;
+		Sorted.Reserve(Keep);
+		for (const auto& Entry : Selected)
+		{
+			Sorted.Add(MoveTemp(InOutResults[Entry.Value]));
+		}
+		InOutResults = MoveTemp(Sorted);
+	}
+
+	/// Apply result limits to a list of results
+	template<typename T, typename AllocatorType>
+	static void ApplyResultLimits(const AActor* Self, const FSussQueryResultLimits& Limits, TArray<T, AllocatorType>& InOutResults)
+	{
+		if (Limits.ResultSort == ESussQueryResultSort::None || !IsValid(Self))
+		{
+			if (Limits.MaxResults > 0 && InOutResults.Num() > Limits.MaxResults)
+			{
+				InOutResults.RemoveAt(Limits.MaxResults, InOutResults.Num() - Limits.MaxResults);
+			}
+			return;
+		}
+
+		const FVector Origin = Self->GetActorLocation();
+		const float Sign = Limits.ResultSort == ESussQueryResultSort::NearestFirst ? 1.f : -1.f;
+		SelectResults(InOutResults, Limits.MaxResults, [&Origin, Sign](const T& Result)
+		{
+			FVector Location;
+			// Results without a location always go last
+			return GetResultLocation(Result, Location) ? Sign * FVector::DistSquared(Origin, Location) : UE_BIG_NUMBER;
+		});
+	}
+
+	/// Apply result limits to the results of an execution, unless the provider already applied them itself
+	template<typename T>
+	static void FinishResultLimits(const AActor* Self, const FSussQueryResultLimits& Limits, TArray<T>& InOutResults)
+	{
+		if (!Limits.bApplied)
+		{
+			ApplyResultLimits(Self, Limits, InOutResults);
+		}
+	}
+
+	static void FinishResultLimits(const AActor* Self, const FSussQueryResultLimits& Limits, TSussResultsArray& InOutResults)
+	{
+		Visit([Self, &Limits](auto& Results)
+		{
+			FinishResultLimits(Self, Limits, Results);
+		}, InOutResults);
+	}
+
 
 public:
 
@@ -150,6 +524,7 @@ public:
 
 	bool IsCorrelatedWithContext() const { return bIsCorrelatedWithContext; }
 	bool GetSelfIsRelevant() const { return bSelfIsRelevant; }
+	const FGameplayTagContainer& GetInvalidateOnTagsChanged() const { return InvalidateOnTagsChanged; }
 
 	// I'd prefer to make this pure virtual but UCLASS doesn't allow that
 	virtual ESussQueryContextElement GetProvidedContextElement() const { return ESussQueryContextElement::Target; } 
@@ -157,50 +532,253 @@ public:
 	virtual void Tick(float DeltaTime)
 	{
 		FScopeLock Lock(&Guard);
-		
-		TArray<uint32> KeysToRemove;
-		for (auto& Result : CachedResultsByParamsHash)
+
+		CacheTime += DeltaTime;
+
+		if (PendingRefreshes.Num() > 0)
 		{
-			// If the AI that used to use this has gone stale, remove
-			if (Result.Value.ControlledActor.IsStale() || !Result.Value.ControlledActor.IsValid())
-			{
-				KeysToRemove.Add(Result.Key);
-			}
-			else
-			{
-				Result.Value.TimeSinceLastRun += DeltaTime;
-			}
+			RunDeferredRefreshes();
 		}
 
-		for (uint32 Key : KeysToRemove)
+		// Expiry is checked when results are read, so all we need to do here is gradually clean up the least recently
+		// used entries which are no longer useful
+		CachedResults.EvictUnused(MaxCacheEvictionChecksPerTick, [this](const FSussCachedQueryResults& Entry)
 		{
-			CachedResultsByParamsHash.Remove(Key);
-		}
+			// If the AI that used to use this has gone stale, or nothing has asked for these results in a while
+			return !Entry.ControlledActor.IsValid() || GetCacheAge(Entry.LastUsedTime) > UnusedCacheEntryLifetime;
+		});
+
+		// Correlated results are evicted once expired, since source contexts change often and are unlikely to recur
+		CachedCorrelatedResults.EvictUnused(MaxCacheEvictionChecksPerTick, [this](const FSussCachedCorrelatedQueryResults& Entry)
+		{
+			return GetCacheAge(Entry.LastRunTime) >= Entry.MaxFrequency ||
+				!Entry.ControlledActor.IsValid() ||
+				Entry.SourceTarget.IsStale();
+		});
 	}
 
-	/// Retrieves the query results, using cached values if possible
+	/// Get statistics for the results cached by this provider
+	FSussQueryCacheStats GetCacheStats() const
+	{
+		FScopeLock Lock(&Guard);
+
+		FSussQueryCacheStats Stats = CachedResults.GetStats();
+		Stats += CachedCorrelatedResults.GetStats();
+		return Stats;
+	}
+
+	/**
+	 * Retrieves the query results, using cached values if possible. The returned array belongs to the cache, so it's
+	 * only valid until the next request to this provider; use GetResultsSnapshot to hold on to results for longer.
+	 * @param Brain The brain requesting the results
+	 * @param Self The controlled actor
+	 * @param MaxFrequency The maximum age of cached results which can be re-used
+	 * @param Params Parameters to the query
+	 * @param MaxResults If > 0, the maximum number of results to return
+	 * @param ResultSort How to order the results; if MaxResults is used, the first MaxResults in this order are returned
+	 */
 	template<typename T>
-	const TArray<T>& GetResults(USussBrainComponent* Brain, AActor* Self, float MaxFrequency, const TMap<FName, FSussParameter>& Params)
+	const TArray<T>& GetResults(USussBrainComponent* Brain,
+	                            AActor* Self,
+	                            float MaxFrequency,
+	                            const TMap<FName, FSussParameter>& Params,
+	                            int MaxResults = 0,
+	                            ESussQueryResultSort ResultSort = ESussQueryResultSort::None)
 	{
 		FScopeLock Lock(&Guard);
 		
-		auto& Results = MaybeExecuteQuery(Brain, Self, MaxFrequency, Params, CachedResultsByParamsHash);
-		return GetResultsArray<T>(Results.Results);
+		auto& Results = MaybeExecuteQuery(Brain, Self, MaxFrequency, Params, MaxResults, ResultSort);
+		// Results of an async query may not have arrived yet
+		return Results.GetSnapshot().Get<T>();
+	}
+
+	/**
+	 * Retrieves a read-only snapshot of the query results, using cached values if possible. Unlike GetResults, the
+	 * snapshot remains valid (and unchanged) even if the query is re-run while it's held, so it can be used directly
+	 * instead of copying the results.
+	 * @copydoc GetResults
+	 */
+	FSussQueryResultsSnapshot GetResultsSnapshot(USussBrainComponent* Brain,
+	                                             AActor* Self,
+	                                             float MaxFrequency,
+	                                             const TMap<FName, FSussParameter>& Params,
+	                                             int MaxResults = 0,
+	                                             ESussQueryResultSort ResultSort = ESussQueryResultSort::None)
+	{
+		FScopeLock Lock(&Guard);
+
+		return MaybeExecuteQuery(Brain, Self, MaxFrequency, Params, MaxResults, ResultSort).GetSnapshot();
 	}
 
 	/// Run the query, correlated with an existing context generated from another query
 	/// Note: results are never cached on correlated queries.
 	template<typename T>
-	void GetResultsInContext(USussBrainComponent* Brain, AActor* Self, const FSussContext& Context, const TMap<FName, FSussParameter>& Params, TArray<T>& OutResults)
+	void GetResultsInContext(USussBrainComponent* Brain,
+	                         AActor* Self,
+	                         const FSussContext& Context,
+	                         const TMap<FName, FSussParameter>& Params,
+	                         TArray<T>& OutResults,
+	                         int MaxResults = 0,
+	                         ESussQueryResultSort ResultSort = ESussQueryResultSort::None)
 	{
+		FScopeLock Lock(&Guard);
+
 		// No caching, direct call through
-		ExecuteQueryInContextInternal(Brain, Self, Context, Params, OutResults);
+		FSussQueryResultLimits Limits(MaxResults, ResultSort);
+		ExecuteQueryInContextInternal(Brain, Self, Context, Params, Limits, OutResults);
+		FinishResultLimits(Self, Limits, OutResults);
+	}
+
+	/**
+	 * Run the query correlated with a whole batch of existing contexts at once. This is equivalent to calling
+	 * GetResultsInContext for each context, but allows providers to share setup work across the batch, and results
+	 * are cached per source context.
+	 * @param Brain The brain requesting the results
+	 * @param Self The controlled actor
+	 * @param Contexts The source contexts to run the query in
+	 * @param MaxFrequency The maximum age of cached results for a source context which can be re-used
+	 * @param Params Parameters to the query
+	 * @param OutResults Results for all contexts are appended here, grouped in the same order as Contexts
+	 * @param OutResultCounts Receives the number of results appended for each of Contexts
+	 * @param MaxResults If > 0, the maximum number of results to return per context
+	 * @param ResultSort How to order the results for each context
+	 */
+	template<typename T>
+	void GetResultsInContexts(USussBrainComponent* Brain,
+	                          AActor* Self,
+	                          TArrayView<const FSussContext> Contexts,
+	                          float MaxFrequency,
+	                          const TMap<FName, FSussParameter>& Params,
+	                          TArray<T>& OutResults,
+	                          TArray<int32>& OutResultCounts,
+	                          int MaxResults = 0,
+	                          ESussQueryResultSort ResultSort = ESussQueryResultSort::None)
+	{
+		FScopeLock Lock(&Guard);
+
+		OutResultCounts.Reset(Contexts.Num());
+		const FSussQueryResultLimits Limits(MaxResults, ResultSort);
+		if (bUseCachedResults && MaxFrequency > 0)
+		{
+			ExecuteQueryInContextsCached(Brain, Self, Contexts, MaxFrequency, Params, Limits, OutResults, OutResultCounts);
+		}
+		else
+		{
+			ExecuteQueryInContextsInternal(Brain, Self, Contexts, Params, Limits, OutResults, OutResultCounts);
+		}
 	}
 
 protected:
 
-	uint32 HashQueryRequest(AActor* Self, const TMap<FName, FSussParameter>& Params);
 	bool ParamsMatch(const TMap<FName, FSussParameter>& Params1, const TMap<FName, FSussParameter>& Params2) const;
+	FSussQueryCacheKey MakeCacheKey(AActor* Self, const TMap<FName, FSussParameter>& Params, int MaxResults, ESussQueryResultSort ResultSort) const;
+
+	/// Whether results generated for one controlled actor can be used for another
+	bool CanUseResultsGeneratedFor(const AActor* ResultsSelf, const AActor* Self) const
+	{
+		return !bSelfIsRelevant || bShareResultsByLocation || ResultsSelf == Self;
+	}
+
+	static FSussQueryInvalidationCounts GetInvalidationCounts(const USussBrainComponent* Brain);
+	static bool HasDestroyedActors(const TSussResultsArray& Results);
+
+	/**
+	 * Whether cached results have been invalidated by an event since they were generated
+	 * @param Counts The invalidation counts recorded when the results were generated
+	 * @param Results The cached results
+	 * @param Brain The brain the results were generated for, or null if the requesting brain is a different one
+	 */
+	bool IsInvalidated(const FSussQueryInvalidationCounts& Counts, const TSussResultsArray* Results, const USussBrainComponent* Brain) const;
+
+	virtual bool ShouldUseCachedCorrelatedResults(const FSussCachedCorrelatedQueryResults& Results,
+	                                              USussBrainComponent* Brain,
+	                                              AActor* Self,
+	                                              float MaxFrequency) const
+	{
+		// Everything else is part of the key. Brain events only invalidate results generated for the same brain
+		return GetCacheAge(Results.LastRunTime) < MaxFrequency &&
+			CanUseResultsGeneratedFor(Results.ControlledActor.Get(), Self) &&
+			!IsInvalidated(Results.InvalidationCounts, &Results.Results, Results.ControlledActor.Get() == Self ? Brain : nullptr);
+	}
+
+	template<typename T>
+	void ExecuteQueryInContextsCached(USussBrainComponent* Brain,
+	                                  AActor* Self,
+	                                  TArrayView<const FSussContext> Contexts,
+	                                  float MaxFrequency,
+	                                  const TMap<FName, FSussParameter>& Params,
+	                                  const FSussQueryResultLimits& Limits,
+	                                  TArray<T>& OutResults,
+	                                  TArray<int32>& OutResultCounts)
+	{
+		const FSussQueryCacheKey Request = MakeCacheKey(Self, Params, Limits.MaxResults, Limits.ResultSort);
+		const FSussQueryInvalidationCounts InvalidationCounts = GetInvalidationCounts(Brain);
+
+		// Find which source contexts have usable cached results, then run the query for all the others in one batch
+		TArray<FSussCorrelatedQueryCacheKey, TInlineAllocator<32>> Keys;
+		TBitArray<TInlineAllocator<4>> Hits;
+		TArray<FSussContext> MissContexts;
+		Keys.Reserve(Contexts.Num());
+		for (const FSussContext& Context : Contexts)
+		{
+			const FSussCorrelatedQueryCacheKey& Key = Keys.Emplace_GetRef(Request, Context);
+			const auto pEntry = CachedCorrelatedResults.Find(Key);
+			const bool bHit = pEntry && ShouldUseCachedCorrelatedResults(*pEntry, Brain, Self, MaxFrequency);
+			Hits.Add(bHit);
+			if (bHit)
+			{
+				CachedCorrelatedResults.RecordHit();
+			}
+			else
+			{
+				CachedCorrelatedResults.RecordMiss();
+				MissContexts.Add(Context);
+			}
+		}
+
+		TArray<T> MissResults;
+		TArray<int32> MissResultCounts;
+		if (MissContexts.Num() > 0)
+		{
+			ExecuteQueryInContextsInternal(Brain, Self, MissContexts, Params, Limits, MissResults, MissResultCounts);
+		}
+
+		// Nothing is evicted until we're done, so entries found above are still valid
+		int MissIndex = 0;
+		int MissResultIndex = 0;
+		for (int i = 0; i < Contexts.Num(); ++i)
+		{
+			if (Hits[i])
+			{
+				const auto& Cached = GetResultsArray<T>(CachedCorrelatedResults.Find(Keys[i])->Results);
+				OutResults.Append(Cached);
+				OutResultCounts.Add(Cached.Num());
+			}
+			else
+			{
+				const int Count = MissResultCounts[MissIndex++];
+				auto pEntry = CachedCorrelatedResults.Find(Keys[i]);
+				if (!pEntry)
+				{
+					pEntry = &CachedCorrelatedResults.Add(Keys[i]);
+				}
+				auto& Entry = *pEntry;
+				Entry.ControlledActor = Self;
+				Entry.SourceTarget = Contexts[i].Target;
+				Entry.LastRunTime = CacheTime;
+				Entry.MaxFrequency = MaxFrequency;
+				Entry.InvalidationCounts = InvalidationCounts;
+				InitResults<T>(Entry.Results);
+				GetResultsArray<T>(Entry.Results).Append(MissResults.GetData() + MissResultIndex, Count);
+				CachedCorrelatedResults.SetEntrySize(Keys[i], EstimateCacheEntrySize(Keys[i], Entry, Entry.Results));
+				OutResults.Append(MissResults.GetData() + MissResultIndex, Count);
+				OutResultCounts.Add(Count);
+				MissResultIndex += Count;
+			}
+		}
+
+		CachedCorrelatedResults.EnforceLimits(MaxCacheEntries, GetMaxCacheBytes());
+	}
 
 	virtual bool ShouldUseCachedResults(const FSussCachedQueryResults& Results, USussBrainComponent* Brain, AActor* Self, float MaxFrequency, const TMap<FName, FSussParameter>& Params) const
 	{
@@ -209,10 +787,14 @@ protected:
 			return false;
 		
 		// Always re-run if time has run out for cached results
-		if (Results.TimeSinceLastRun >= MaxFrequency)
+		if (GetCacheAge(Results.LastRunTime) >= MaxFrequency)
+			return false;
+
+		if (!CanUseResultsGeneratedFor(Results.ControlledActor.Get(), Self))
 			return false;
 
-		if (Results.ControlledActor.Get() != Self)
+		// Brain events only invalidate results generated for the same brain
+		if (IsInvalidated(Results.InvalidationCounts, Results.Results.Get(), Results.ControlledActor.Get() == Self ? Brain : nullptr))
 			return false;
 
 		// Otherwise, if we're within the re-use time, the only time we should not re-use is if the value of a relevant
@@ -220,52 +802,190 @@ protected:
 		return ParamsMatch(Results.Params, Params);
 	}
 
-	virtual void ExecuteQueryInternal(USussBrainComponent* Brain, AActor* Self, const TMap<FName, FSussParameter>& Params, TSussResultsArray& OutResults)
+	virtual void ExecuteQueryInternal(USussBrainComponent* Brain, AActor* Self, const TMap<FName, FSussParameter>& Params, FSussQueryResultLimits& Limits, TSussResultsArray& OutResults)
 	{
 		// Subclass specific
 	}
-	virtual void ExecuteQueryInContextInternal(USussBrainComponent* Brain, AActor* Self, const FSussContext& Context, const TMap<FName, FSussParameter>& Params, TArray<TWeakObjectPtr<AActor>>& OutResults)
+	virtual void ExecuteQueryInContextInternal(USussBrainComponent* Brain, AActor* Self, const FSussContext& Context, const TMap<FName, FSussParameter>& Params, FSussQueryResultLimits& Limits, TArray<TWeakObjectPtr<AActor>>& OutResults)
 	{
 		// Subclass specific
 	}
-	virtual void ExecuteQueryInContextInternal(USussBrainComponent* Brain, AActor* Self, const FSussContext& Context, const TMap<FName, FSussParameter>& Params, TArray<FVector>& OutResults)
+	virtual void ExecuteQueryInContextInternal(USussBrainComponent* Brain, AActor* Self, const FSussContext& Context, const TMap<FName, FSussParameter>& Params, FSussQueryResultLimits& Limits, TArray<FVector>& OutResults)
 	{
 		// Subclass specific
 	}
-	virtual void ExecuteQueryInContextInternal(USussBrainComponent* Brain, AActor* Self, const FSussContext& Context, const TMap<FName, FSussParameter>& Params, TArray<FSussContextValue>& OutResults)
+	virtual void ExecuteQueryInContextInternal(USussBrainComponent* Brain, AActor* Self, const FSussContext& Context, const TMap<FName, FSussParameter>& Params, FSussQueryResultLimits& Limits, TArray<FSussContextValue>& OutResults)
 	{
 		// Subclass specific
 	}
+
+	/// Batched versions of ExecuteQueryInContextInternal. Subclasses can override these to share work across the
+	/// batch; by default they just run the query for each context in turn.
+	virtual void ExecuteQueryInContextsInternal(USussBrainComponent* Brain, AActor* Self, TArrayView<const FSussContext> Contexts, const TMap<FName, FSussParameter>& Params, const FSussQueryResultLimits& Limits, TArray<TWeakObjectPtr<AActor>>& OutResults, TArray<int32>& OutResultCounts)
+	{
+		ExecuteQueryInEachContext(Brain, Self, Contexts, Params, Limits, OutResults, OutResultCounts);
+	}
+	virtual void ExecuteQueryInContextsInternal(USussBrainComponent* Brain, AActor* Self, TArrayView<const FSussContext> Contexts, const TMap<FName, FSussParameter>& Params, const FSussQueryResultLimits& Limits, TArray<FVector>& OutResults, TArray<int32>& OutResultCounts)
+	{
+		ExecuteQueryInEachContext(Brain, Self, Contexts, Params, Limits, OutResults, OutResultCounts);
+	}
+	virtual void ExecuteQueryInContextsInternal(USussBrainComponent* Brain, AActor* Self, TArrayView<const FSussContext> Contexts, const TMap<FName, FSussParameter>& Params, const FSussQueryResultLimits& Limits, TArray<FSussContextValue>& OutResults, TArray<int32>& OutResultCounts)
+	{
+		ExecuteQueryInEachContext(Brain, Self, Contexts, Params, Limits, OutResults, OutResultCounts);
+	}
+
+	template<typename T>
+	void ExecuteQueryInEachContext(USussBrainComponent* Brain,
+	                               AActor* Self,
+	                               TArrayView<const FSussContext> Contexts,
+	                               const TMap<FName, FSussParameter>& Params,
+	                               const FSussQueryResultLimits& Limits,
+	                               TArray<T>& OutResults,
+	                               TArray<int32>& OutResultCounts)
+	{
+		const bool bHasLimits = Limits.HasLimits();
+		TArray<T> ContextResults;
+		for (const FSussContext& Context : Contexts)
+		{
+			const int StartNum = OutResults.Num();
+			FSussQueryResultLimits ContextLimits(Limits.MaxResults, Limits.ResultSort);
+			ExecuteQueryInContextInternal(Brain, Self, Context, Params, ContextLimits, OutResults);
+			if (bHasLimits && !ContextLimits.bApplied && OutResults.Num() > StartNum)
+			{
+				// Limits apply per context, so only to the results we just added
+				ContextResults.Reset();
+				ContextResults.Append(OutResults.GetData() + StartNum, OutResults.Num() - StartNum);
+				OutResults.RemoveAt(StartNum, OutResults.Num() - StartNum, false);
+				ApplyResultLimits(Self, ContextLimits, ContextResults);
+				OutResults.Append(ContextResults);
+			}
+			OutResultCounts.Add(OutResults.Num() - StartNum);
+		}
+	}
 	
-	void ExecuteQuery(USussBrainComponent* Brain, AActor* Self, const TMap<FName, FSussParameter>& Params, FSussCachedQueryResults& OutResults)
+	/// Prepare a cache entry to have new results written to it
+	static void BeginNewResults(FSussCachedQueryResults& Entry)
+	{
+		++Entry.Version;
+		if (!Entry.Results.IsValid() || !Entry.Results.IsUnique())
+		{
+			// Someone is still holding a snapshot of the previous results, leave that alone
+			Entry.Results = MakeShared<TSussResultsArray, ESPMode::ThreadSafe>();
+		}
+	}
+
+	/// Whether uncorrelated queries should be run asynchronously using ExecuteQueryAsync
+	virtual bool ShouldExecuteQueryAsync() const { return false; }
+
+	/**
+	 * Start running an uncorrelated query asynchronously. When the results arrive, call CompleteAsyncQuery.
+	 * @param Brain The brain requesting the results
+	 * @param Self The controlled actor
+	 * @param Key The cache key for the request, which includes the params
+	 * @param Entry The cache entry which will receive the results. If it has no results yet, they must be initialised
+	 *   as empty, of the correct type, since they'll be returned until the query completes. AsyncQueryID must be set
+	 *   to the ID which will be passed to CompleteAsyncQuery.
+	 * @return Whether the query was started; if not, it's run synchronously instead
+	 */
+	virtual bool ExecuteQueryAsync(USussBrainComponent* Brain, AActor* Self, const FSussQueryCacheKey& Key, FSussCachedQueryResults& Entry)
+	{
+		return false;
+	}
+
+	/**
+	 * Complete a query started with ExecuteQueryAsync
+	 * @param Brain The brain which requested the results, which is asked to update now they've arrived
+	 * @param Key The cache key for the request
+	 * @param QueryID The ID of the query which completed. If the entry is no longer waiting for this query, because
+	 *   it was evicted and re-added while the query was running, the results are discarded.
+	 * @param WriteResults Function which writes the results to the TSussResultsArray passed to it
+	 */
+	void CompleteAsyncQuery(USussBrainComponent* Brain, const FSussQueryCacheKey& Key, int32 QueryID, TFunctionRef<void(AActor* Self, TSussResultsArray&)> WriteResults);
+
+	void ExecuteQuery(USussBrainComponent* Brain,
+	                  AActor* Self,
+	                  const TMap<FName, FSussParameter>& Params,
+	                  int MaxResults,
+	                  ESussQueryResultSort ResultSort,
+	                  FSussCachedQueryResults& OutResults)
 	{
 		OutResults.Params = Params;
 		OutResults.ControlledActor = Self;
-		OutResults.TimeSinceLastRun = 0;
-		ExecuteQueryInternal(Brain, Self, Params, OutResults.Results);
+		OutResults.LastRunTime = CacheTime;
+		OutResults.MaxResults = MaxResults;
+		OutResults.ResultSort = ResultSort;
+		OutResults.bRefreshPending = false;
+		OutResults.InvalidationCounts = GetInvalidationCounts(Brain);
+		BeginNewResults(OutResults);
+		// Limits are applied before caching, so the cache never holds more than needed
+		FSussQueryResultLimits Limits(MaxResults, ResultSort);
+		ExecuteQueryInternal(Brain, Self, Params, Limits, *OutResults.Results);
+		FinishResultLimits(Self, Limits, *OutResults.Results);
 	}
 	
+	/// Queue a re-run of the query for cached results which have been served stale
+	void QueueDeferredRefresh(const FSussQueryCacheKey& Key, FSussCachedQueryResults& Entry, USussBrainComponent* Brain);
+	/// Re-run queries whose stale results were served, within DeferredRefreshBudgetMs
+	void RunDeferredRefreshes();
+
 	const FSussCachedQueryResults& MaybeExecuteQuery(USussBrainComponent* Brain,
 	                                                 AActor* Self,
 	                                                 float MaxFrequency,
 	                                                 const TMap<FName, FSussParameter>& Params,
-	                                                 TMap<uint32, FSussCachedQueryResults>& CachedResults)
+	                                                 int MaxResults,
+	                                                 ESussQueryResultSort ResultSort)
 	{
-		const uint32 ParamsHash = HashQueryRequest(Self, Params);
-		if (const auto pResultStruct = CachedResults.Find(ParamsHash))
+		const FSussQueryCacheKey Key = MakeCacheKey(Self, Params, MaxResults, ResultSort);
+		auto pResultStruct = CachedResults.Find(Key);
+		if (pResultStruct && ShouldUseCachedResults(*pResultStruct, Brain, Self, MaxFrequency, Params))
 		{
-			if (!ShouldUseCachedResults(*pResultStruct, Brain, Self, MaxFrequency, Params))
+			CachedResults.RecordHit();
+			pResultStruct->LastUsedTime = CacheTime;
+			return *pResultStruct;
+		}
+		if (pResultStruct && bRefreshStaleResultsDeferred &&
+			ShouldUseCachedResults(*pResultStruct, Brain, Self, MaxFrequency + MaxStaleResultAge, Params))
+		{
+			// Stale but not too stale; serve it now and re-run later
+			CachedResults.RecordHit();
+			pResultStruct->LastUsedTime = CacheTime;
+			QueueDeferredRefresh(Key, *pResultStruct, Brain);
+			return *pResultStruct;
+		}
+
+		CachedResults.RecordMiss();
+		if (!pResultStruct)
+		{
+			// First run of this query
+			pResultStruct = &CachedResults.Add(Key);
+		}
+		// Re-use cache entry if it existed, to keep allocations
+		pResultStruct->LastUsedTime = CacheTime;
+
+		if (ShouldExecuteQueryAsync())
+		{
+			// Until the query completes, we return the previous results (if any)
+			if (!pResultStruct->bAsyncPending)
 			{
-				// Run query again, but re-use cache entry. Reset to keep allocations
-				ExecuteQuery(Brain, Self, Params, *pResultStruct);
+				pResultStruct->Params = Params;
+				pResultStruct->ControlledActor = Self;
+				pResultStruct->MaxResults = MaxResults;
+				pResultStruct->ResultSort = ResultSort;
+				pResultStruct->InvalidationCounts = GetInvalidationCounts(Brain);
+				pResultStruct->bAsyncPending = ExecuteQueryAsync(Brain, Self, Key, *pResultStruct);
+			}
+			if (pResultStruct->bAsyncPending)
+			{
+				CachedResults.EnforceLimits(MaxCacheEntries, GetMaxCacheBytes());
+				return *pResultStruct;
 			}
-			return *pResultStruct;
 		}
 
-		// First run of this query
-		auto& ResultStruct = CachedResults.Emplace(ParamsHash);
-		ExecuteQuery(Brain, Self, Params, ResultStruct);
-		return ResultStruct;
+		ExecuteQuery(Brain, Self, Params, MaxResults, ResultSort, *pResultStruct);
+		CachedResults.SetEntrySize(Key, EstimateCacheEntrySize(Key, *pResultStruct, *pResultStruct->Results));
+		// Never evicts the entry we just used
+		CachedResults.EnforceLimits(MaxCacheEntries, GetMaxCacheBytes());
+		return *pResultStruct;
 	}
 	
 };
@@ -292,6 +1012,22 @@ protected:
 							  const FSussContext& BaseContext,
 							  TArray<TWeakObjectPtr<AActor>>& OutResults);
 
+	/**
+	 * Version of ExecuteQuery which is also given the result limits requested for this execution. By default this just
+	 * calls ExecuteQuery, and the limits are applied to the results afterwards. Override this instead of ExecuteQuery
+	 * if you can apply the limits more efficiently while generating results (see SelectResults), and set
+	 * Limits.bApplied = true if you do.
+	 */
+	virtual void ExecuteQueryWithLimits(USussBrainComponent* Brain,
+	                                    AActor* Self,
+	                                    const TMap<FName, FSussParameter>& Params,
+	                                    const FSussContext& BaseContext,
+	                                    FSussQueryResultLimits& Limits,
+	                                    TArray<TWeakObjectPtr<AActor>>& OutResults)
+	{
+		ExecuteQuery(Brain, Self, Params, BaseContext, OutResults);
+	}
+
 	/**
 	 * Query execution function which should be overridden in Blueprints
 	 * @param Brain The brain executing this query
@@ -308,21 +1044,21 @@ protected:
 	                    const FSussContext& BaseContext,
 	                    UPARAM(ref) TArray<AActor*>& OutResults);
 
-	virtual void ExecuteQueryInternal(USussBrainComponent* Brain, AActor* Self, const TMap<FName, FSussParameter>& Params, TSussResultsArray& OutResults) override final
+	virtual void ExecuteQueryInternal(USussBrainComponent* Brain, AActor* Self, const TMap<FName, FSussParameter>& Params, FSussQueryResultLimits& Limits, TSussResultsArray& OutResults) override final
 	{
 		InitResults<TWeakObjectPtr<AActor>>(OutResults);
-		ExecuteQuery(Brain, Self, Params, FSussContext { Self }, GetResultsArray<TWeakObjectPtr<AActor>>(OutResults));
+		ExecuteQueryWithLimits(Brain, Self, Params, FSussContext { Self }, Limits, GetResultsArray<TWeakObjectPtr<AActor>>(OutResults));
 	}
 
-	virtual void ExecuteQueryInContextInternal(USussBrainComponent* Brain, AActor* Self, const FSussContext& Context, const TMap<FName, FSussParameter>& Params, TArray<TWeakObjectPtr<AActor>>& OutResults) override final
+	virtual void ExecuteQueryInContextInternal(USussBrainComponent* Brain, AActor* Self, const FSussContext& Context, const TMap<FName, FSussParameter>& Params, FSussQueryResultLimits& Limits, TArray<TWeakObjectPtr<AActor>>& OutResults) override final
 	{
-		ExecuteQuery(Brain, Self, Params, Context, OutResults);
+		ExecuteQueryWithLimits(Brain, Self, Params, Context, Limits, OutResults);
 	}
-	virtual void ExecuteQueryInContextInternal(USussBrainComponent* Brain, AActor* Self, const FSussContext& Context, const TMap<FName, FSussParameter>& Params, TArray<FVector>& OutResults) override final
+	virtual void ExecuteQueryInContextInternal(USussBrainComponent* Brain, AActor* Self, const FSussContext& Context, const TMap<FName, FSussParameter>& Params, FSussQueryResultLimits& Limits, TArray<FVector>& OutResults) override final
 	{
 		// N/A: final disallows further override
 	}
-	virtual void ExecuteQueryInContextInternal(USussBrainComponent* Brain, AActor* Self, const FSussContext& Context, const TMap<FName, FSussParameter>& Params, TArray<FSussContextValue>& OutResults) override final
+	virtual void ExecuteQueryInContextInternal(USussBrainComponent* Brain, AActor* Self, const FSussContext& Context, const TMap<FName, FSussParameter>& Params, FSussQueryResultLimits& Limits, TArray<FSussContextValue>& OutResults) override final
 	{
 		// N/A: final disallows further override
 	}
@@ -353,6 +1089,17 @@ protected:
 	                          const FSussContext& BaseContext,
 	                          TArray<FVector>& OutResults);
 
+	/// @copydoc USussTargetQueryProvider::ExecuteQueryWithLimits
+	virtual void ExecuteQueryWithLimits(USussBrainComponent* Brain,
+	                                    AActor* Self,
+	                                    const TMap<FName, FSussParameter>& Params,
+	                                    const FSussContext& BaseContext,
+	                                    FSussQueryResultLimits& Limits,
+	                                    TArray<FVector>& OutResults)
+	{
+		ExecuteQuery(Brain, Self, Params, BaseContext, OutResults);
+	}
+
 	/**
 	 * Query execution function which should be overridden in Blueprints
 	 * @param Brain The brain executing this query
@@ -370,21 +1117,21 @@ protected:
 	                    UPARAM(ref) TArray<FVector>& OutResults);
 	
 
-	virtual void ExecuteQueryInternal(USussBrainComponent* Brain, AActor* Self, const TMap<FName, FSussParameter>& Params, TSussResultsArray& OutResults) override final
+	virtual void ExecuteQueryInternal(USussBrainComponent* Brain, AActor* Self, const TMap<FName, FSussParameter>& Params, FSussQueryResultLimits& Limits, TSussResultsArray& OutResults) override final
 	{
 		InitResults<FVector>(OutResults);
-		ExecuteQuery(Brain, Self, Params, FSussContext {Self}, GetResultsArray<FVector>(OutResults));
+		ExecuteQueryWithLimits(Brain, Self, Params, FSussContext {Self}, Limits, GetResultsArray<FVector>(OutResults));
 	}
 
-	virtual void ExecuteQueryInContextInternal(USussBrainComponent* Brain, AActor* Self, const FSussContext& Context, const TMap<FName, FSussParameter>& Params, TArray<FVector>& OutResults) override final
+	virtual void ExecuteQueryInContextInternal(USussBrainComponent* Brain, AActor* Self, const FSussContext& Context, const TMap<FName, FSussParameter>& Params, FSussQueryResultLimits& Limits, TArray<FVector>& OutResults) override final
 	{
-		ExecuteQuery(Brain, Self, Params, Context, OutResults);
+		ExecuteQueryWithLimits(Brain, Self, Params, Context, Limits, OutResults);
 	}
-	virtual void ExecuteQueryInContextInternal(USussBrainComponent* Brain, AActor* Self, const FSussContext& Context, const TMap<FName, FSussParameter>& Params, TArray<TWeakObjectPtr<AActor>>& OutResults) override final
+	virtual void ExecuteQueryInContextInternal(USussBrainComponent* Brain, AActor* Self, const FSussContext& Context, const TMap<FName, FSussParameter>& Params, FSussQueryResultLimits& Limits, TArray<TWeakObjectPtr<AActor>>& OutResults) override final
 	{
 		// N/A: final disallows further override
 	}
-	virtual void ExecuteQueryInContextInternal(USussBrainComponent* Brain, AActor* Self, const FSussContext& Context, const TMap<FName, FSussParameter>& Params, TArray<FSussContextValue>& OutResults) override final
+	virtual void ExecuteQueryInContextInternal(USussBrainComponent* Brain, AActor* Self, const FSussContext& Context, const TMap<FName, FSussParameter>& Params, FSussQueryResultLimits& Limits, TArray<FSussContextValue>& OutResults) override final
 	{
 		// N/A: final disallows further override
 	}
@@ -450,6 +1197,17 @@ protected:
 	                          const FSussContext& Context,
 	                          TArray<FSussContextValue>& OutResults);
 
+	/// @copydoc USussTargetQueryProvider::ExecuteQueryWithLimits
+	virtual void ExecuteQueryWithLimits(USussBrainComponent* Brain,
+	                                    AActor* Self,
+	                                    const TMap<FName, FSussParameter>& Params,
+	                                    const FSussContext& Context,
+	                                    FSussQueryResultLimits& Limits,
+	                                    TArray<FSussContextValue>& OutResults)
+	{
+		ExecuteQuery(Brain, Self, Params, Context, OutResults);
+	}
+
 	
 	/**
 	 * Query execution function which should be overridden in Blueprints
@@ -462,29 +1220,29 @@ protected:
 	UFUNCTION(BlueprintImplementableEvent, DisplayName="ExecuteQuery", meta=(ForceAsFunction))
 	void ExecuteQueryBP(USussBrainComponent* Brain, AActor* ControlledActor, const TMap<FName, FSussParameter>& Params, const FSussContext& BaseContext);
 
-	virtual void ExecuteQueryInternal(USussBrainComponent* Brain, AActor* Self, const TMap<FName, FSussParameter>& Params, TSussResultsArray& OutResults) override final
+	virtual void ExecuteQueryInternal(USussBrainComponent* Brain, AActor* Self, const TMap<FName, FSussParameter>& Params, FSussQueryResultLimits& Limits, TSussResultsArray& OutResults) override final
 	{
 		InitResults<FSussContextValue>(OutResults);
 		// We have to store local version so BP can interact using helper functions
 		TempOutArray = &(OutResults.Get<TArray<FSussContextValue>>());
-		ExecuteQuery(Brain, Self, Params, FSussContext {Self}, GetResultsArray<FSussContextValue>(OutResults));
+		ExecuteQueryWithLimits(Brain, Self, Params, FSussContext {Self}, Limits, GetResultsArray<FSussContextValue>(OutResults));
 		TempOutArray = nullptr;
 
 	}
 
-	virtual void ExecuteQueryInContextInternal(USussBrainComponent* Brain, AActor* Self, const FSussContext& Context, const TMap<FName, FSussParameter>& Params, TArray<FSussContextValue>& OutResults) override final
+	virtual void ExecuteQueryInContextInternal(USussBrainComponent* Brain, AActor* Self, const FSussContext& Context, const TMap<FName, FSussParameter>& Params, FSussQueryResultLimits& Limits, TArray<FSussContextValue>& OutResults) override final
 	{
 		// We have to store local version so BP can interact using helper functions
 		TempOutArray = &OutResults;
-		ExecuteQuery(Brain, Self, Params, Context, OutResults);
+		ExecuteQueryWithLimits(Brain, Self, Params, Context, Limits, OutResults);
 		TempOutArray = nullptr;
 
 	}
-	virtual void ExecuteQueryInContextInternal(USussBrainComponent* Brain, AActor* Self, const FSussContext& Context, const TMap<FName, FSussParameter>& Params, TArray<TWeakObjectPtr<AActor>>& OutResults) override final
+	virtual void ExecuteQueryInContextInternal(USussBrainComponent* Brain, AActor* Self, const FSussContext& Context, const TMap<FName, FSussParameter>& Params, FSussQueryResultLimits& Limits, TArray<TWeakObjectPtr<AActor>>& OutResults) override final
 	{
 		// N/A: final disallows further override
 	}
-	virtual void ExecuteQueryInContextInternal(USussBrainComponent* Brain, AActor* Self, const FSussContext& Context, const TMap<FName, FSussParameter>& Params, TArray<FVector>& OutResults) override final
+	virtual void ExecuteQueryInContextInternal(USussBrainComponent* Brain, AActor* Self, const FSussContext& Context, const TMap<FName, FSussParameter>& Params, FSussQueryResultLimits& Limits, TArray<FVector>& OutResults) override final
 	{
 		// N/A: final disallows further override
 	}
@@ -74,6 +74,27 @@ public:
 	UPROPERTY(config, EditAnywhere, Category = Optimisation, meta = (ToolTip = "The interval at which we'll re-calculate the distance to the players when the agent is beyond the far distance"))
 	float OutOfBoundsDistanceCheckInterval = 3;
 
+	UPROPERTY(config, EditAnywhere, Category = Optimisation, meta = (ToolTip = "How long in seconds path distances calculated for inputs are cached. 0 disables caching, so that every path distance input runs a synchronous path find"))
+	float PathDistanceCacheLifetime = 1;
+
+	UPROPERTY(config, EditAnywhere, Category = Optimisation, meta = (ToolTip = "The grid size that path start and end locations are quantised to when caching path distances, so that nearby requests share results"))
+	float PathDistanceCacheCellSize = 50;
+
+	UPROPERTY(config, EditAnywhere, Category = Optimisation, meta = (ToolTip = "Whether path distances which aren't cached are found with async path finding. The previous result, or an estimate, is used until the path has been found"))
+	bool AsyncPathDistance = true;
+
+	UPROPERTY(config, EditAnywhere, Category = Optimisation, meta = (ToolTip = "The cell size of the coarse navmesh graph used by approximate path distance inputs. Larger cells are cheaper but less accurate"))
+	float ApproxPathDistanceCellSize = 500;
+
+	UPROPERTY(config, EditAnywhere, Category = Optimisation, meta = (ToolTip = "How far approximate path distance inputs search the coarse navmesh graph. Locations beyond this use an estimate based on the straight line distance"))
+	float ApproxPathDistanceMaxSearchDistance = 10000;
+
+	UPROPERTY(config, EditAnywhere, Category = Optimisation, meta = (ToolTip = "The maximum number of navmesh queries made per frame to build the coarse navmesh graph used by approximate path distance inputs, 0 for no limit. Locations the graph hasn't reached yet use an estimate based on the straight line distance"))
+	int ApproxPathDistanceMaxNavQueriesPerFrame = 1000;
+
+	UPROPERTY(config, EditAnywhere, Category = Optimisation, meta = (ToolTip = "The minimum time in seconds between updates of a team's aggregated perception, which are only made when a team member's perception has changed"))
+	float TeamPerceptionUpdateInterval = 0.2f;
+
 	UPROPERTY(config, EditAnywhere, Category = Collision, meta = (ToolTip = "The trace channel to use when determining Line of Sight tests. Defaults to Visibility but if you want AI to avoid shooting each other you might want to use a custom trace."))
 	TEnumAsByte<ECollisionChannel> LineOfSightTraceChannel = ECC_Visibility;
 };
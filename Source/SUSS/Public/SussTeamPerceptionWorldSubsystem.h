@@ -0,0 +1,114 @@
+﻿// 
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "GenericTeamAgentInterface.h"
+#include "Perception/AIPerceptionTypes.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "SussTeamPerceptionWorldSubsystem.generated.h"
+
+class USussBrainComponent;
+
+/// A hostile which is known to at least one member of a team
+struct FSussTeamKnownHostile
+{
+	TWeakObjectPtr<AActor> Actor;
+	/// Location that the actor was most recently sensed by any team member
+	FVector LastLocation = FVector::ZeroVector;
+	/// Age of the most recent stimulus currently sensed by any team member, or NeverHappenedAge if none
+	float Age = FAIStimulus::NeverHappenedAge;
+	/// Senses which any team member has a stimulus for, which hasn't been forgotten (see FSussPerceptionSnapshotEntry)
+	uint32 KnownSenses = 0;
+	/// Senses which any team member is currently sensing this actor with
+	uint32 CurrentSenses = 0;
+	/// The number of team members which know about this actor
+	int NumKnownBy = 0;
+
+	bool HasKnownStimulusOfSense(FAISenseID Sense) const
+	{
+		return Sense.IsValid() && Sense.Index < 32 && (KnownSenses & (1u << Sense.Index)) != 0;
+	}
+	bool HasAnyCurrentStimulus() const { return CurrentSenses != 0; }
+};
+
+/// Aggregated perception of all the members of a team
+struct FSussTeamPerception
+{
+	TArray<FSussTeamKnownHostile> KnownHostiles;
+	/// Index into KnownHostiles for each actor
+	TMap<TObjectKey<AActor>, int> HostileIndices;
+	/// The number of team members which contributed
+	int NumMembers = 0;
+	/// World time this was last updated; ages are as of this time
+	double UpdateTime = TNumericLimits<double>::Lowest();
+};
+
+/**
+ * World-scope subsystem which aggregates the perception of brains by team (see IGenericTeamAgentInterface), so that
+ * behaviour which only needs to know about hostiles known to the team doesn't have to enumerate every agent's
+ * perception separately. Brains with a perception component register themselves on BeginPlay, and tell the subsystem
+ * when their perception is updated. In its tick, the subsystem re-aggregates the perception of teams which any member
+ * has had a perception update since last time, at most once every TeamPerceptionUpdateInterval (see USussSettings).
+ */
+UCLASS()
+class SUSS_API USussTeamPerceptionWorldSubsystem : public UWorldSubsystem, public FTickableGameObject
+{
+	GENERATED_BODY()
+protected:
+	struct FTeam
+	{
+		/// Brains on this team which contribute to its perception
+		TArray<TWeakObjectPtr<USussBrainComponent>> Members;
+		FSussTeamPerception Perception;
+		/// Whether a member's perception has been updated, or a member has joined or left, since Perception was updated
+		bool bDirty = false;
+	};
+
+	/// Minimum time between updates of a team's perception, from settings
+	float UpdateInterval = 0.2f;
+
+	/// Members & aggregated perception per team. Agents with no team don't share perception, so aren't in here.
+	TMap<uint8, FTeam> Teams;
+	/// The team each registered brain was in when last checked, including NoTeam
+	TMap<TObjectKey<USussBrainComponent>, uint8> MemberTeams;
+
+	virtual bool DoesSupportWorldType(const EWorldType::Type WorldType) const override;
+	void AddToTeam(USussBrainComponent* Brain, uint8 TeamId);
+	void RemoveFromTeam(USussBrainComponent* Brain, uint8 TeamId);
+	void UpdateTeamPerception(FTeam& Team, double Now);
+
+public:
+	USussTeamPerceptionWorldSubsystem();
+
+	/// Register a brain so that its perception contributes to its team's perception
+	void RegisterMember(USussBrainComponent* Brain);
+	/// Remove a brain from team perception
+	void UnregisterMember(USussBrainComponent* Brain);
+	/// Tell the subsystem that a member's perception has been updated, so its team's perception needs updating. This is
+	/// also when a change of team is picked up.
+	void OnMemberPerceptionUpdated(USussBrainComponent* Brain);
+
+	/**
+	 * Get the aggregated perception of a team, as of its last update.
+	 * Agents with no team (FGenericTeamId::NoTeam) don't share perception, so their perception is never aggregated.
+	 * @param TeamId The team
+	 * @return The team's perception. Don't keep this, it's only valid until team membership changes or the subsystem ticks
+	 */
+	const FSussTeamPerception& GetTeamPerception(FGenericTeamId TeamId) const;
+
+	virtual UWorld* GetTickableGameObjectWorld() const override { return GetWorld(); }
+	virtual bool IsTickableWhenPaused() const override { return false; }
+	virtual TStatId GetStatId() const override;
+	virtual void Tick(float DeltaTime) override;
+};
+
+inline USussTeamPerceptionWorldSubsystem* GetSussTeamPerceptionWorldSubsystem(const UWorld* World)
+{
+	if (IsValid(World) && World->IsGameWorld())
+	{
+		return World->GetSubsystem<USussTeamPerceptionWorldSubsystem>();
+	}
+		
+	return nullptr;
+}
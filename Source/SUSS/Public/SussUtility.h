@@ -7,12 +7,15 @@
 #include "SussCommon.h"
 #include "SussParameter.h"
 #include "SussContext.h"
+#include "GenericTeamAgentInterface.h"
+#include "AI/Navigation/NavigationTypes.h"
 #include "EnvironmentQuery/EnvQueryTypes.h"
 #include "Kismet/BlueprintFunctionLibrary.h"
 #include "SussUtility.generated.h"
 
 struct FSussActorPerceptionInfo;
 class AAIController;
+class ANavigationData;
 /**
  * 
  */
@@ -34,10 +37,20 @@ public:
 	UFUNCTION(BlueprintCallable)
 	static bool ActorHasAllTags(AActor* Actor, const FGameplayTagContainer& Tags);
 
+	/// Run an EQS query synchronously. If Context is supplied, it's available to SUSS EQS contexts such as
+	/// USussEnvQueryContext_Target while the query runs.
 	static TSharedPtr<FEnvQueryResult> RunEQSQuery(UObject* WorldContextObject,
 	                                               UEnvQuery* EQSQuery,
 	                                               const TArray<FEnvNamedValue>& QueryParams,
-	                                               EEnvQueryRunMode::Type QueryMode = EEnvQueryRunMode::AllMatching);
+	                                               EEnvQueryRunMode::Type QueryMode = EEnvQueryRunMode::AllMatching,
+	                                               const FSussContext* Context = nullptr);
+	/// Run an EQS query asynchronously, letting the EQS manager time-slice it. Returns the query ID, or INDEX_NONE on failure
+	static int32 RunEQSQueryAsync(UObject* Querier,
+	                              UEnvQuery* EQSQuery,
+	                              const TArray<FEnvNamedValue>& QueryParams,
+	                              EEnvQueryRunMode::Type QueryMode,
+	                              const FQueryFinishedSignature& OnFinished,
+	                              const FSussContext* Context = nullptr);
 	UFUNCTION(BlueprintCallable, DisplayName="Run EQS Query (SUSS)", meta=(WorldContext=WorldContextObject))
 	static UEnvQueryInstanceBlueprintWrapper* RunEQSQueryBP(AActor* Querier,
 	                                                        UEnvQuery* EQSQuery,
@@ -225,10 +238,10 @@ public:
 	 * @param Params Any contexts you wish to supply to the query
 	 * @param UseCachedResultsFor If > 0, this query will return previous results for the same contexts rather than
 	 *    running the query again, if it was already run within the last N seconds
-	 * @return A list of locations from the query
+	 * @return A copy of the list of locations from the query
 	 */
 	UFUNCTION(BlueprintCallable, Category="SUSS")
-	static const TArray<FVector>& RunLocationQueryWithTargetContext(AActor* Querier, FGameplayTag Tag, AActor* Target, const TMap<FName, FSussParameter>& Params, float UseCachedResultsFor = 0);
+	static TArray<FVector> RunLocationQueryWithTargetContext(AActor* Querier, FGameplayTag Tag, AActor* Target, const TMap<FName, FSussParameter>& Params, float UseCachedResultsFor = 0);
 	/**
 	 * Manually run a query that returns target actors, rather than use it to generate context for a brain decision.
 	 * You might want to do this if you want some query results to manually choose inside an action, rather than evaluating
@@ -274,6 +287,30 @@ public:
 	static float GetPathDistanceFromTo(AAIController* Agent, const FVector& FromLocation, const FVector& ToLocation, bool
 	                                   bAllowPartialPath = false);
 
+	/**
+	 * Find a path between 2 locations for an agent, synchronously.
+	 * @param Agent The actor in question
+	 * @param FromLocation The location to find a path from
+	 * @param ToLocation The desired location
+	 * @param bAllowPartialPath Whether to allow partial paths
+	 * @return The path, or null if there is no path
+	 */
+	static FNavPathSharedPtr FindPathFromTo(AAIController* Agent, const FVector& FromLocation, const FVector& ToLocation, bool bAllowPartialPath = false);
+
+	/**
+	 * Make a copy of a path which is independent of the original, with no observers. Paths are modified by path
+	 * following and re-pathing, so paths which are shared, e.g. cached ones, must be copied before moving along them.
+	 * @param Path The path to copy
+	 * @return The copy, or null if Path is null
+	 */
+	static FNavPathSharedPtr CopyPath(const FNavPathSharedPtr& Path);
+
+	/// Get the navigation data which an agent uses for path finding, or null if there is none
+	static const ANavigationData* GetNavDataForAgent(AAIController* Agent);
+
+	/// Get the team of an actor (see IGenericTeamAgentInterface). Pawns without a team use their controller's team.
+	static FGenericTeamId GetTeamId(const AActor* Actor);
+
 	UFUNCTION(Blueprintable, Category="SUSS")
 	static ECollisionChannel GetLineOfSightTraceChannel();
 